@@ -0,0 +1,192 @@
+/*
+ * Stand-in for Xwayland, for benchmarking the session startup without an
+ * X server.
+ *
+ * Speaks just enough Wayland to do what a rootful Xwayland does on
+ * startup: it maps a toplevel of the size given with -geometry, commits a
+ * buffer to it and then reports its display number on -displayfd. It
+ * stays around until the compositor goes away.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "wayback_log.h"
+#include "xdg-shell-client-protocol.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <wayland-client.h>
+
+/* Nothing connects to it, any number not taken by a real X server will do */
+#define FAKE_DISPLAY 99
+
+struct fake_xwayland
+{
+	struct wl_display *display;
+	struct wl_compositor *compositor;
+	struct wl_shm *shm;
+	struct xdg_wm_base *wm_base;
+
+	struct wl_surface *surface;
+	struct xdg_surface *xdg_surface;
+	struct xdg_toplevel *xdg_toplevel;
+	struct wl_buffer *buffer;
+
+	int width, height;
+	int displayfd;
+};
+
+static struct wl_buffer *create_buffer(struct fake_xwayland *xwayland)
+{
+	char name[64];
+	snprintf(name, sizeof(name), "/wayback-fake-xwayland-%d", (int)getpid());
+
+	size_t stride = xwayland->width * 4;
+	size_t size = stride * xwayland->height;
+	int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+	if (fd >= 0)
+		shm_unlink(name);
+	if (fd < 0 || ftruncate(fd, size) < 0) {
+		wayback_log(LOG_ERROR, "Failed to create shm: %s", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	/* The X root window background */
+	uint32_t *pixels = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (pixels == MAP_FAILED) {
+		wayback_log(LOG_ERROR, "Failed to map buffer: %s", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	for (size_t i = 0; i < size / 4; i++)
+		pixels[i] = 0xff4c4c4c;
+	munmap(pixels, size);
+
+	struct wl_shm_pool *pool = wl_shm_create_pool(xwayland->shm, fd, size);
+	struct wl_buffer *buffer = wl_shm_pool_create_buffer(
+		pool, 0, xwayland->width, xwayland->height, stride, WL_SHM_FORMAT_XRGB8888);
+	wl_shm_pool_destroy(pool);
+	close(fd);
+	return buffer;
+}
+
+static void report_display(struct fake_xwayland *xwayland)
+{
+	if (xwayland->displayfd < 0)
+		return;
+
+	char display[16];
+	int len = snprintf(display, sizeof(display), "%d\n", FAKE_DISPLAY);
+	if (write(xwayland->displayfd, display, len) != len)
+		wayback_log(LOG_ERROR, "Failed to report display: %s", strerror(errno));
+	close(xwayland->displayfd);
+	xwayland->displayfd = -1;
+}
+
+static void wm_base_ping(void *data, struct xdg_wm_base *wm_base, uint32_t serial)
+{
+	xdg_wm_base_pong(wm_base, serial);
+}
+
+static const struct xdg_wm_base_listener wm_base_listener = {
+	.ping = wm_base_ping,
+};
+
+static void xdg_surface_configure(void *data, struct xdg_surface *xdg_surface, uint32_t serial)
+{
+	struct fake_xwayland *xwayland = data;
+
+	xdg_surface_ack_configure(xdg_surface, serial);
+	if (xwayland->buffer != NULL)
+		return;
+
+	xwayland->buffer = create_buffer(xwayland);
+	wl_surface_attach(xwayland->surface, xwayland->buffer, 0, 0);
+	wl_surface_damage_buffer(xwayland->surface, 0, 0, xwayland->width, xwayland->height);
+	wl_surface_commit(xwayland->surface);
+	wl_display_flush(xwayland->display);
+	report_display(xwayland);
+}
+
+static const struct xdg_surface_listener xdg_surface_listener = {
+	.configure = xdg_surface_configure,
+};
+
+static void registry_global(void *data,
+                            struct wl_registry *registry,
+                            uint32_t name,
+                            const char *interface,
+                            uint32_t version)
+{
+	struct fake_xwayland *xwayland = data;
+
+	if (strcmp(interface, wl_compositor_interface.name) == 0) {
+		xwayland->compositor = wl_registry_bind(registry, name, &wl_compositor_interface, 4);
+	} else if (strcmp(interface, wl_shm_interface.name) == 0) {
+		xwayland->shm = wl_registry_bind(registry, name, &wl_shm_interface, 1);
+	} else if (strcmp(interface, xdg_wm_base_interface.name) == 0) {
+		xwayland->wm_base = wl_registry_bind(registry, name, &xdg_wm_base_interface, 1);
+		xdg_wm_base_add_listener(xwayland->wm_base, &wm_base_listener, xwayland);
+	}
+}
+
+static void registry_global_remove(void *data, struct wl_registry *registry, uint32_t name)
+{
+}
+
+static const struct wl_registry_listener registry_listener = {
+	.global = registry_global,
+	.global_remove = registry_global_remove,
+};
+
+int main(int argc, char *argv[])
+{
+	wayback_log_init("wayback-fake-xwayland", LOG_INFO, NULL);
+
+	struct fake_xwayland xwayland = { .width = 1024, .height = 768, .displayfd = -1 };
+
+	/* Everything else Xwayback passes on is of no interest here */
+	for (int i = 1; i + 1 < argc; i++) {
+		if (strcmp(argv[i], "-displayfd") == 0)
+			xwayland.displayfd = strtol(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "-geometry") == 0 &&
+		         sscanf(argv[++i], "%dx%d", &xwayland.width, &xwayland.height) != 2)
+			wayback_log(LOG_WARN, "Ignoring invalid geometry %s", argv[i]);
+	}
+	if (xwayland.width <= 0 || xwayland.height <= 0) {
+		wayback_log(LOG_ERROR, "Invalid geometry %dx%d", xwayland.width, xwayland.height);
+		exit(EXIT_FAILURE);
+	}
+
+	/* Connects through WAYLAND_SOCKET, like the real thing */
+	xwayland.display = wl_display_connect(NULL);
+	if (xwayland.display == NULL) {
+		wayback_log(LOG_ERROR, "Unable to connect to the compositor");
+		exit(EXIT_FAILURE);
+	}
+
+	struct wl_registry *registry = wl_display_get_registry(xwayland.display);
+	wl_registry_add_listener(registry, &registry_listener, &xwayland);
+	wl_display_roundtrip(xwayland.display);
+	if (xwayland.compositor == NULL || xwayland.shm == NULL || xwayland.wm_base == NULL) {
+		wayback_log(LOG_ERROR, "Compositor is missing required globals");
+		exit(EXIT_FAILURE);
+	}
+
+	xwayland.surface = wl_compositor_create_surface(xwayland.compositor);
+	xwayland.xdg_surface = xdg_wm_base_get_xdg_surface(xwayland.wm_base, xwayland.surface);
+	xdg_surface_add_listener(xwayland.xdg_surface, &xdg_surface_listener, &xwayland);
+	xwayland.xdg_toplevel = xdg_surface_get_toplevel(xwayland.xdg_surface);
+	xdg_toplevel_set_title(xwayland.xdg_toplevel, "Xwayland");
+	wl_surface_commit(xwayland.surface);
+
+	while (wl_display_dispatch(xwayland.display) != -1)
+		;
+
+	return EXIT_SUCCESS;
+}
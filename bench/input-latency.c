@@ -0,0 +1,704 @@
+/*
+ * Input-to-photon latency benchmark.
+ *
+ * Starts a headless wayback-compositor, stands in for Xwayland with a
+ * window that repaints on every input event, and injects input through a
+ * privileged virtual pointer or keyboard. The latency of a sample is the
+ * time from injecting the event until the frame callback of the repaint
+ * it caused fires, i.e. until output_frame() has committed that repaint.
+ * That only holds for the immediate frame policy, the deadline policy sends
+ * frame callbacks before compositing, so the benchmark always uses the
+ * former.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "optparse.h"
+#include "utils.h"
+#include "virtual-keyboard-unstable-v1-client-protocol.h"
+#include "wayback_log.h"
+#include "wlr-virtual-pointer-unstable-v1-client-protocol.h"
+#include "xdg-shell-client-protocol.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/input-event-codes.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <wayland-client.h>
+#include <xkbcommon/xkbcommon.h>
+
+#define WINDOW_WIDTH 640
+#define WINDOW_HEIGHT 480
+#define SAMPLE_TIMEOUT_USEC 1000000
+
+/* Stands in for Xwayland */
+struct responder
+{
+	struct wl_display *display;
+	struct wl_compositor *compositor;
+	struct wl_shm *shm;
+	struct xdg_wm_base *wm_base;
+	struct wl_seat *seat;
+	struct wl_pointer *pointer;
+	struct wl_keyboard *keyboard;
+
+	struct wl_surface *surface;
+	struct xdg_surface *xdg_surface;
+	struct xdg_toplevel *xdg_toplevel;
+	bool configured;
+
+	struct wl_buffer *buffers[2];
+	uint32_t *pixels;
+	int next_buffer;
+
+	bool focused;
+};
+
+/* Privileged client injecting input */
+struct injector
+{
+	struct wl_display *display;
+	struct wl_seat *seat;
+	struct zwlr_virtual_pointer_manager_v1 *pointer_manager;
+	struct zwp_virtual_keyboard_manager_v1 *keyboard_manager;
+	struct zwlr_virtual_pointer_v1 *pointer;
+	struct zwp_virtual_keyboard_v1 *keyboard;
+};
+
+struct bench
+{
+	struct responder responder;
+	struct injector injector;
+	bool use_keyboard;
+
+	/* Time the pending sample was injected, 0 if none is in flight */
+	uint64_t inject_usec;
+	bool repainted;
+	/* Frame callback of the repaint answering the pending sample */
+	struct wl_callback *sample_callback;
+	uint64_t *samples;
+	size_t nsamples, missed;
+};
+
+static uint64_t now_usec(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+}
+
+static int create_shm_fd(size_t size)
+{
+	static unsigned int serial;
+	char name[64];
+	snprintf(name, sizeof(name), "/wayback-bench-%d-%u", (int)getpid(), serial++);
+
+	int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+	if (fd >= 0)
+		shm_unlink(name);
+	if (fd < 0 || ftruncate(fd, size) < 0) {
+		wayback_log(LOG_ERROR, "Failed to create shm: %s", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	return fd;
+}
+
+static void frame_done(void *data, struct wl_callback *callback, uint32_t time)
+{
+	struct bench *bench = data;
+	wl_callback_destroy(callback);
+
+	/* Ignore the initial paint and repaints of samples that timed out. */
+	if (callback != bench->sample_callback)
+		return;
+	bench->samples[bench->nsamples++] = now_usec() - bench->inject_usec;
+	bench->inject_usec = 0;
+	bench->sample_callback = NULL;
+}
+
+static const struct wl_callback_listener frame_listener = {
+	.done = frame_done,
+};
+
+static struct wl_callback *repaint(struct bench *bench)
+{
+	struct responder *responder = &bench->responder;
+
+	/* Alternate between two buffers and colours, every repaint changes pixels. */
+	int index = responder->next_buffer;
+	responder->next_buffer ^= 1;
+	uint32_t *pixels = responder->pixels + (size_t)index * WINDOW_WIDTH * WINDOW_HEIGHT;
+	uint32_t color = index ? 0xff202020 : 0xffe0e0e0;
+	for (size_t i = 0; i < WINDOW_WIDTH * WINDOW_HEIGHT; i++)
+		pixels[i] = color;
+
+	wl_surface_attach(responder->surface, responder->buffers[index], 0, 0);
+	wl_surface_damage_buffer(responder->surface, 0, 0, WINDOW_WIDTH, WINDOW_HEIGHT);
+	struct wl_callback *callback = wl_surface_frame(responder->surface);
+	wl_callback_add_listener(callback, &frame_listener, bench);
+	wl_surface_commit(responder->surface);
+	wl_display_flush(responder->display);
+	return callback;
+}
+
+static void handle_input(struct bench *bench)
+{
+	/* Only the first event of a sample repaints, like an X client would coalesce. */
+	if (bench->inject_usec != 0 && !bench->repainted) {
+		bench->repainted = true;
+		bench->sample_callback = repaint(bench);
+	}
+}
+
+static void pointer_enter(void *data,
+                          struct wl_pointer *pointer,
+                          uint32_t serial,
+                          struct wl_surface *surface,
+                          wl_fixed_t x,
+                          wl_fixed_t y)
+{
+	handle_input(data);
+}
+
+static void pointer_leave(void *data,
+                          struct wl_pointer *pointer,
+                          uint32_t serial,
+                          struct wl_surface *surface)
+{
+}
+
+static void pointer_motion(void *data,
+                           struct wl_pointer *pointer,
+                           uint32_t time,
+                           wl_fixed_t x,
+                           wl_fixed_t y)
+{
+	handle_input(data);
+}
+
+static void pointer_button(void *data,
+                           struct wl_pointer *pointer,
+                           uint32_t serial,
+                           uint32_t time,
+                           uint32_t button,
+                           uint32_t state)
+{
+}
+
+static void pointer_axis(void *data,
+                         struct wl_pointer *pointer,
+                         uint32_t time,
+                         uint32_t axis,
+                         wl_fixed_t value)
+{
+}
+
+static void pointer_frame(void *data, struct wl_pointer *pointer)
+{
+}
+
+static void pointer_axis_source(void *data, struct wl_pointer *pointer, uint32_t source)
+{
+}
+
+static void pointer_axis_stop(void *data, struct wl_pointer *pointer, uint32_t time, uint32_t axis)
+{
+}
+
+static void pointer_axis_discrete(void *data,
+                                  struct wl_pointer *pointer,
+                                  uint32_t axis,
+                                  int32_t discrete)
+{
+}
+
+static const struct wl_pointer_listener pointer_listener = {
+	.enter = pointer_enter,
+	.leave = pointer_leave,
+	.motion = pointer_motion,
+	.button = pointer_button,
+	.axis = pointer_axis,
+	.frame = pointer_frame,
+	.axis_source = pointer_axis_source,
+	.axis_stop = pointer_axis_stop,
+	.axis_discrete = pointer_axis_discrete,
+};
+
+static void keyboard_keymap(void *data,
+                            struct wl_keyboard *keyboard,
+                            uint32_t format,
+                            int32_t fd,
+                            uint32_t size)
+{
+	close(fd);
+}
+
+static void keyboard_enter(void *data,
+                           struct wl_keyboard *keyboard,
+                           uint32_t serial,
+                           struct wl_surface *surface,
+                           struct wl_array *keys)
+{
+	struct bench *bench = data;
+	bench->responder.focused = true;
+}
+
+static void keyboard_leave(void *data,
+                           struct wl_keyboard *keyboard,
+                           uint32_t serial,
+                           struct wl_surface *surface)
+{
+	struct bench *bench = data;
+	bench->responder.focused = false;
+}
+
+static void keyboard_key(void *data,
+                         struct wl_keyboard *keyboard,
+                         uint32_t serial,
+                         uint32_t time,
+                         uint32_t key,
+                         uint32_t state)
+{
+	if (state == WL_KEYBOARD_KEY_STATE_PRESSED)
+		handle_input(data);
+}
+
+static void keyboard_modifiers(void *data,
+                               struct wl_keyboard *keyboard,
+                               uint32_t serial,
+                               uint32_t depressed,
+                               uint32_t latched,
+                               uint32_t locked,
+                               uint32_t group)
+{
+}
+
+static void keyboard_repeat_info(void *data,
+                                 struct wl_keyboard *keyboard,
+                                 int32_t rate,
+                                 int32_t delay)
+{
+}
+
+static const struct wl_keyboard_listener keyboard_listener = {
+	.keymap = keyboard_keymap,
+	.enter = keyboard_enter,
+	.leave = keyboard_leave,
+	.key = keyboard_key,
+	.modifiers = keyboard_modifiers,
+	.repeat_info = keyboard_repeat_info,
+};
+
+static void seat_capabilities(void *data, struct wl_seat *seat, uint32_t caps)
+{
+	struct bench *bench = data;
+	struct responder *responder = &bench->responder;
+
+	if ((caps & WL_SEAT_CAPABILITY_POINTER) && responder->pointer == NULL) {
+		responder->pointer = wl_seat_get_pointer(seat);
+		wl_pointer_add_listener(responder->pointer, &pointer_listener, bench);
+	}
+	if ((caps & WL_SEAT_CAPABILITY_KEYBOARD) && responder->keyboard == NULL) {
+		responder->keyboard = wl_seat_get_keyboard(seat);
+		wl_keyboard_add_listener(responder->keyboard, &keyboard_listener, bench);
+	}
+}
+
+static void seat_name(void *data, struct wl_seat *seat, const char *name)
+{
+}
+
+static const struct wl_seat_listener seat_listener = {
+	.capabilities = seat_capabilities,
+	.name = seat_name,
+};
+
+static void wm_base_ping(void *data, struct xdg_wm_base *wm_base, uint32_t serial)
+{
+	xdg_wm_base_pong(wm_base, serial);
+}
+
+static const struct xdg_wm_base_listener wm_base_listener = {
+	.ping = wm_base_ping,
+};
+
+static void xdg_surface_configure(void *data, struct xdg_surface *xdg_surface, uint32_t serial)
+{
+	struct bench *bench = data;
+	xdg_surface_ack_configure(xdg_surface, serial);
+	if (!bench->responder.configured) {
+		bench->responder.configured = true;
+		repaint(bench);
+	}
+}
+
+static const struct xdg_surface_listener xdg_surface_listener = {
+	.configure = xdg_surface_configure,
+};
+
+static void responder_global(void *data,
+                             struct wl_registry *registry,
+                             uint32_t name,
+                             const char *interface,
+                             uint32_t version)
+{
+	struct bench *bench = data;
+	struct responder *responder = &bench->responder;
+
+	if (strcmp(interface, wl_compositor_interface.name) == 0) {
+		responder->compositor = wl_registry_bind(registry, name, &wl_compositor_interface, 4);
+	} else if (strcmp(interface, wl_shm_interface.name) == 0) {
+		responder->shm = wl_registry_bind(registry, name, &wl_shm_interface, 1);
+	} else if (strcmp(interface, xdg_wm_base_interface.name) == 0) {
+		responder->wm_base = wl_registry_bind(registry, name, &xdg_wm_base_interface, 1);
+		xdg_wm_base_add_listener(responder->wm_base, &wm_base_listener, bench);
+	} else if (strcmp(interface, wl_seat_interface.name) == 0 && responder->seat == NULL) {
+		responder->seat = wl_registry_bind(registry, name, &wl_seat_interface, 5);
+		wl_seat_add_listener(responder->seat, &seat_listener, bench);
+	}
+}
+
+static void injector_global(void *data,
+                            struct wl_registry *registry,
+                            uint32_t name,
+                            const char *interface,
+                            uint32_t version)
+{
+	struct bench *bench = data;
+	struct injector *injector = &bench->injector;
+
+	if (strcmp(interface, wl_seat_interface.name) == 0 && injector->seat == NULL) {
+		injector->seat = wl_registry_bind(registry, name, &wl_seat_interface, 1);
+	} else if (strcmp(interface, zwlr_virtual_pointer_manager_v1_interface.name) == 0) {
+		injector->pointer_manager =
+			wl_registry_bind(registry, name, &zwlr_virtual_pointer_manager_v1_interface, 1);
+	} else if (strcmp(interface, zwp_virtual_keyboard_manager_v1_interface.name) == 0) {
+		injector->keyboard_manager =
+			wl_registry_bind(registry, name, &zwp_virtual_keyboard_manager_v1_interface, 1);
+	}
+}
+
+static void registry_global_remove(void *data, struct wl_registry *registry, uint32_t name)
+{
+}
+
+static const struct wl_registry_listener responder_registry_listener = {
+	.global = responder_global,
+	.global_remove = registry_global_remove,
+};
+
+static const struct wl_registry_listener injector_registry_listener = {
+	.global = injector_global,
+	.global_remove = registry_global_remove,
+};
+
+static void responder_setup(struct bench *bench)
+{
+	struct responder *responder = &bench->responder;
+
+	wl_registry_add_listener(
+		wl_display_get_registry(responder->display), &responder_registry_listener, bench);
+	wl_display_roundtrip(responder->display);
+	if (responder->compositor == NULL || responder->shm == NULL || responder->wm_base == NULL) {
+		wayback_log(LOG_ERROR, "Compositor is missing required globals");
+		exit(EXIT_FAILURE);
+	}
+
+	size_t stride = WINDOW_WIDTH * 4;
+	size_t size = stride * WINDOW_HEIGHT;
+	int fd = create_shm_fd(size * 2);
+	responder->pixels = mmap(NULL, size * 2, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (responder->pixels == MAP_FAILED) {
+		wayback_log(LOG_ERROR, "Failed to map buffers: %s", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	struct wl_shm_pool *pool = wl_shm_create_pool(responder->shm, fd, size * 2);
+	for (int i = 0; i < 2; i++)
+		responder->buffers[i] = wl_shm_pool_create_buffer(
+			pool, size * i, WINDOW_WIDTH, WINDOW_HEIGHT, stride, WL_SHM_FORMAT_XRGB8888);
+	wl_shm_pool_destroy(pool);
+	close(fd);
+
+	responder->surface = wl_compositor_create_surface(responder->compositor);
+	responder->xdg_surface = xdg_wm_base_get_xdg_surface(responder->wm_base, responder->surface);
+	xdg_surface_add_listener(responder->xdg_surface, &xdg_surface_listener, bench);
+	responder->xdg_toplevel = xdg_surface_get_toplevel(responder->xdg_surface);
+	xdg_toplevel_set_title(responder->xdg_toplevel, "wayback-bench-input-latency");
+	wl_surface_commit(responder->surface);
+
+	while (!responder->configured) {
+		if (wl_display_dispatch(responder->display) < 0) {
+			wayback_log(LOG_ERROR, "Lost connection to the compositor");
+			exit(EXIT_FAILURE);
+		}
+	}
+	wl_display_roundtrip(responder->display);
+}
+
+static void injector_setup(struct bench *bench)
+{
+	struct injector *injector = &bench->injector;
+
+	wl_registry_add_listener(
+		wl_display_get_registry(injector->display), &injector_registry_listener, bench);
+	wl_display_roundtrip(injector->display);
+	if (injector->seat == NULL || injector->pointer_manager == NULL ||
+	    injector->keyboard_manager == NULL) {
+		wayback_log(LOG_ERROR, "Compositor does not offer virtual input");
+		exit(EXIT_FAILURE);
+	}
+
+	injector->pointer = zwlr_virtual_pointer_manager_v1_create_virtual_pointer(
+		injector->pointer_manager, injector->seat);
+
+	if (bench->use_keyboard) {
+		struct xkb_context *context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
+		struct xkb_keymap *keymap =
+			xkb_keymap_new_from_names(context, NULL, XKB_KEYMAP_COMPILE_NO_FLAGS);
+		char *keymap_str =
+			keymap ? xkb_keymap_get_as_string(keymap, XKB_KEYMAP_FORMAT_TEXT_V1) : NULL;
+		if (keymap_str == NULL) {
+			wayback_log(LOG_ERROR, "Failed to compile keymap");
+			exit(EXIT_FAILURE);
+		}
+		size_t size = strlen(keymap_str) + 1;
+		int fd = create_shm_fd(size);
+		if (write(fd, keymap_str, size) != (ssize_t)size) {
+			wayback_log(LOG_ERROR, "Failed to write keymap: %s", strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+
+		injector->keyboard = zwp_virtual_keyboard_manager_v1_create_virtual_keyboard(
+			injector->keyboard_manager, injector->seat);
+		zwp_virtual_keyboard_v1_keymap(
+			injector->keyboard, WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1, fd, size);
+
+		close(fd);
+		free(keymap_str);
+		xkb_keymap_unref(keymap);
+		xkb_context_unref(context);
+	}
+	wl_display_roundtrip(injector->display);
+}
+
+static void inject(struct bench *bench, size_t i)
+{
+	struct injector *injector = &bench->injector;
+	uint32_t time = now_usec() / 1000;
+
+	bench->repainted = false;
+	bench->inject_usec = now_usec();
+	if (bench->use_keyboard) {
+		zwp_virtual_keyboard_v1_key(
+			injector->keyboard, time, KEY_A, WL_KEYBOARD_KEY_STATE_PRESSED);
+		zwp_virtual_keyboard_v1_key(
+			injector->keyboard, time, KEY_A, WL_KEYBOARD_KEY_STATE_RELEASED);
+	} else {
+		/* Wiggle inside the window, which sits in the top left corner. */
+		zwlr_virtual_pointer_v1_motion_absolute(
+			injector->pointer, time, 10 + i % 2, 10, 1000, 1000);
+		zwlr_virtual_pointer_v1_frame(injector->pointer);
+	}
+	wl_display_flush(injector->display);
+}
+
+/* Dispatches both connections until the in-flight sample completes or times out. */
+static void wait_for_sample(struct bench *bench)
+{
+	struct wl_display *displays[] = { bench->responder.display, bench->injector.display };
+	uint64_t deadline = bench->inject_usec + SAMPLE_TIMEOUT_USEC;
+
+	while (bench->inject_usec != 0) {
+		uint64_t now = now_usec();
+		if (now >= deadline) {
+			bench->missed++;
+			bench->inject_usec = 0;
+			bench->sample_callback = NULL;
+			return;
+		}
+
+		struct pollfd pfds[ARRAY_SIZE(displays)];
+		for (size_t i = 0; i < ARRAY_SIZE(displays); i++) {
+			wl_display_dispatch_pending(displays[i]);
+			wl_display_flush(displays[i]);
+			pfds[i] = (struct pollfd){ .fd = wl_display_get_fd(displays[i]), .events = POLLIN };
+		}
+		if (poll(pfds, ARRAY_SIZE(pfds), (deadline - now + 999) / 1000) < 0 && errno != EINTR)
+			break;
+		for (size_t i = 0; i < ARRAY_SIZE(displays); i++) {
+			if ((pfds[i].revents & POLLIN) && wl_display_dispatch(displays[i]) < 0) {
+				wayback_log(LOG_ERROR, "Lost connection to the compositor");
+				exit(EXIT_FAILURE);
+			}
+		}
+	}
+}
+
+static int compare_samples(const void *a, const void *b)
+{
+	uint64_t sa = *(const uint64_t *)a, sb = *(const uint64_t *)b;
+	return sa < sb ? -1 : sa > sb;
+}
+
+static double percentile(const uint64_t *sorted, size_t n, double p)
+{
+	return sorted[(size_t)(p * (n - 1) + 0.5)] / 1000.0;
+}
+
+extern char **environ;
+
+int main(int argc, char *argv[])
+{
+	wayback_log_init("wayback-bench-input-latency", LOG_INFO, NULL);
+
+	struct bench bench = { 0 };
+	long count = 500;
+	long interval_msec = 23;
+	const struct optcmd opts[] = {
+		{ .name = "-samples",
+		  .description = "number of input events to measure (default 500)",
+		  .flag = OPT_OPERAND,
+		  .ignore = false },
+		{ .name = "-interval",
+		  .description = "milliseconds between input events (default 23)",
+		  .flag = OPT_OPERAND,
+		  .ignore = false },
+		{ .name = "-keyboard",
+		  .description = "inject key presses instead of pointer motion",
+		  .flag = OPT_NOFLAG,
+		  .ignore = false },
+	};
+
+	int cur_opt = 0;
+	while (cur_opt = optparse(argc, argv, opts, ARRAY_SIZE(opts)), cur_opt != -1) {
+		if (strcmp(argv[cur_opt], "-samples") == 0) {
+			count = strtol(argv[cur_opt + 1], NULL, 10);
+		} else if (strcmp(argv[cur_opt], "-interval") == 0) {
+			interval_msec = strtol(argv[cur_opt + 1], NULL, 10);
+		} else if (strcmp(argv[cur_opt], "-keyboard") == 0) {
+			bench.use_keyboard = true;
+		} else {
+			wayback_log(LOG_ERROR, "Unknown option %s", argv[cur_opt]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (count <= 0 || interval_msec < 0) {
+		wayback_log(LOG_ERROR, "Invalid sample count or interval");
+		exit(EXIT_FAILURE);
+	}
+
+	bench.samples = calloc(count, sizeof(*bench.samples));
+	if (bench.samples == NULL) {
+		wayback_log(LOG_ERROR, "Failed to allocate samples");
+		exit(EXIT_FAILURE);
+	}
+
+	const char *compositor_path = getenv("WAYBACK_COMPOSITOR_PATH");
+	if (compositor_path == NULL)
+		compositor_path = WAYBACK_COMPOSITOR_EXEC_PATH;
+
+	int socket_xwayback[2], socket_xwayland[2], socket_input[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, socket_xwayback) == -1 ||
+	    socketpair(AF_UNIX, SOCK_STREAM, 0, socket_xwayland) == -1 ||
+	    socketpair(AF_UNIX, SOCK_STREAM, 0, socket_input) == -1) {
+		wayback_log(LOG_ERROR, "Unable to create compositor sockets");
+		exit(EXIT_FAILURE);
+	}
+
+	char fd_xwayback[64], fd_xwayland[64], fd_input[64];
+	snprintf(fd_xwayback, sizeof(fd_xwayback), "%d", socket_xwayback[0]);
+	snprintf(fd_xwayland, sizeof(fd_xwayland), "%d", socket_xwayland[0]);
+	snprintf(fd_input, sizeof(fd_input), "%d", socket_input[0]);
+
+	setenv("WLR_BACKENDS", "headless", false);
+	setenv("WLR_HEADLESS_OUTPUTS", "1", false);
+	setenv("WLR_LIBINPUT_NO_DEVICES", "1", false);
+	setenv("WAYBACK_VIRTUAL_INPUT_FD", fd_input, true);
+	setenv("WAYBACK_FRAME_POLICY", "immediate", true);
+
+	posix_spawn_file_actions_t file_actions;
+	posix_spawn_file_actions_init(&file_actions);
+	posix_spawn_file_actions_addclose(&file_actions, socket_xwayback[1]);
+	posix_spawn_file_actions_addclose(&file_actions, socket_xwayland[1]);
+	posix_spawn_file_actions_addclose(&file_actions, socket_input[1]);
+
+	pid_t comp_pid;
+	int ret = posix_spawn(&comp_pid,
+	                      compositor_path,
+	                      &file_actions,
+	                      NULL,
+	                      (char *[]){ (char *)compositor_path, fd_xwayback, fd_xwayland, NULL },
+	                      environ);
+	if (ret != 0) {
+		wayback_log(LOG_ERROR, "Failed to launch wayback-compositor: %s", strerror(ret));
+		exit(EXIT_FAILURE);
+	}
+	posix_spawn_file_actions_destroy(&file_actions);
+	close(socket_xwayback[0]);
+	close(socket_xwayland[0]);
+	close(socket_input[0]);
+
+	bench.responder.display = wl_display_connect_to_fd(socket_xwayland[1]);
+	bench.injector.display = wl_display_connect_to_fd(socket_input[1]);
+	if (bench.responder.display == NULL || bench.injector.display == NULL) {
+		wayback_log(LOG_ERROR, "Unable to connect to wayback-compositor");
+		exit(EXIT_FAILURE);
+	}
+
+	/* The virtual keyboard must exist before the window maps to get focus. */
+	injector_setup(&bench);
+	responder_setup(&bench);
+	if (bench.use_keyboard && !bench.responder.focused) {
+		wayback_log(LOG_ERROR, "Benchmark window did not get keyboard focus");
+		exit(EXIT_FAILURE);
+	}
+
+	/* An interval that is not a multiple of the refresh period spreads the
+	 * samples over the whole frame, so percentiles include vblank waits. */
+	for (long i = 0; i < count; i++) {
+		inject(&bench, i);
+		wait_for_sample(&bench);
+		usleep(interval_msec * 1000);
+	}
+
+	wl_display_disconnect(bench.injector.display);
+	wl_display_disconnect(bench.responder.display);
+	close(socket_xwayback[1]);
+	waitpid(comp_pid, NULL, 0);
+
+	if (bench.nsamples == 0) {
+		wayback_log(LOG_ERROR, "No samples completed (%zu missed)", bench.missed);
+		exit(EXIT_FAILURE);
+	}
+
+	qsort(bench.samples, bench.nsamples, sizeof(*bench.samples), compare_samples);
+	uint64_t total = 0;
+	for (size_t i = 0; i < bench.nsamples; i++)
+		total += bench.samples[i];
+
+	printf("%s input latency over %zu samples (%zu missed), ms:\n",
+	       bench.use_keyboard ? "keyboard" : "pointer",
+	       bench.nsamples,
+	       bench.missed);
+	printf("min %.3f  p50 %.3f  p90 %.3f  p99 %.3f  max %.3f  mean %.3f\n",
+	       bench.samples[0] / 1000.0,
+	       percentile(bench.samples, bench.nsamples, 0.50),
+	       percentile(bench.samples, bench.nsamples, 0.90),
+	       percentile(bench.samples, bench.nsamples, 0.99),
+	       bench.samples[bench.nsamples - 1] / 1000.0,
+	       total / 1000.0 / bench.nsamples);
+
+	free(bench.samples);
+	return bench.missed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,575 @@
+/*
+ * Scene graph load generator.
+ *
+ * Starts a headless wayback-compositor that accepts clients on a debug
+ * socket (WAYBACK_DEBUG_SOCKET), then adds toplevels with popups in steps
+ * while damaging random rectangles of random surfaces at 60 Hz. After each
+ * step it reports the compositor's output frame rate and mean commit time,
+ * read from its metrics page, and its resident memory, so that the per-frame
+ * cost and memory growth can be followed as the surface count rises.
+ *
+ * With -hugepages the compositor renders with Pixman into huge page backed
+ * buffers (WAYBACK_HUGE_PAGES), to be compared with a run with
+ * WLR_RENDERER=pixman alone, which uses 4 KiB pages. -mode 3840x2160 makes
+ * the output large enough for the difference to show.
+ *
+ * -rects damages that many glyph sized rectangles along a line per commit,
+ * like text rendering in Xwayland does, to compare runs with and without
+ * damage coalescing (damage-coalesce in wayback-config(5), off by default).
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "optparse.h"
+#include "utils.h"
+#include "wayback_log.h"
+#include "wayback_metrics.h"
+#include "xdg-shell-client-protocol.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <wayland-client.h>
+
+#define SURFACE_WIDTH 160
+#define SURFACE_HEIGHT 120
+#define POPUP_SIZE 48
+#define GLYPH_WIDTH 8
+#define GLYPH_HEIGHT 16
+#define TICK_USEC (1000000 / 60)
+#define CONNECT_TIMEOUT_USEC 5000000
+
+struct load_surface
+{
+	struct load *load;
+	struct wl_surface *surface;
+	struct xdg_surface *xdg_surface;
+	struct xdg_toplevel *xdg_toplevel;
+	struct xdg_popup *xdg_popup;
+	struct wl_buffer *buffer;
+	uint32_t *pixels;
+	int width, height;
+	bool configured;
+};
+
+struct load
+{
+	struct wl_display *display;
+	struct wl_compositor *compositor;
+	struct wl_shm *shm;
+	struct xdg_wm_base *wm_base;
+
+	struct load_surface *surfaces;
+	size_t nsurfaces, capacity;
+	uint64_t damage_commits;
+	/* Glyphs damaged per commit, 0 for a single random rectangle */
+	long text_rects;
+};
+
+static uint64_t now_usec(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+}
+
+static void create_buffer(struct load *load, struct load_surface *surface)
+{
+	static unsigned int serial;
+	char name[64];
+	snprintf(name, sizeof(name), "/wayback-scene-load-%d-%u", (int)getpid(), serial++);
+
+	size_t stride = surface->width * 4;
+	size_t size = stride * surface->height;
+	int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+	if (fd >= 0)
+		shm_unlink(name);
+	if (fd < 0 || ftruncate(fd, size) < 0) {
+		wayback_log(LOG_ERROR, "Failed to create shm: %s", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	surface->pixels = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (surface->pixels == MAP_FAILED) {
+		wayback_log(LOG_ERROR, "Failed to map buffer: %s", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	struct wl_shm_pool *pool = wl_shm_create_pool(load->shm, fd, size);
+	surface->buffer = wl_shm_pool_create_buffer(
+		pool, 0, surface->width, surface->height, stride, WL_SHM_FORMAT_XRGB8888);
+	wl_shm_pool_destroy(pool);
+	close(fd);
+}
+
+static void fill(struct load_surface *surface, int x, int y, int w, int h, uint32_t color)
+{
+	for (int row = y; row < y + h; row++) {
+		for (int col = x; col < x + w; col++)
+			surface->pixels[row * surface->width + col] = color;
+	}
+}
+
+/* Repaints glyphs at random places along a random line, a few pixels apart */
+static void damage_text(struct load_surface *surface, long rects)
+{
+	uint32_t color = 0xff000000 | (rand() & 0xffffff);
+	int y = rand() % (surface->height - GLYPH_HEIGHT + 1);
+	int x = 0;
+	for (long i = 0; i < rects; i++) {
+		x = (x + GLYPH_WIDTH + rand() % (2 * GLYPH_WIDTH)) % (surface->width - GLYPH_WIDTH + 1);
+		fill(surface, x, y, GLYPH_WIDTH, GLYPH_HEIGHT, color);
+		wl_surface_damage_buffer(surface->surface, x, y, GLYPH_WIDTH, GLYPH_HEIGHT);
+	}
+	wl_surface_attach(surface->surface, surface->buffer, 0, 0);
+	wl_surface_commit(surface->surface);
+}
+
+/* Repaints a random rectangle, or the whole surface. */
+static void damage(struct load_surface *surface, bool full)
+{
+	int x = 0, y = 0, w = surface->width, h = surface->height;
+	if (!full) {
+		w = 1 + rand() % surface->width;
+		h = 1 + rand() % surface->height;
+		x = rand() % (surface->width - w + 1);
+		y = rand() % (surface->height - h + 1);
+	}
+
+	fill(surface, x, y, w, h, 0xff000000 | (rand() & 0xffffff));
+
+	wl_surface_attach(surface->surface, surface->buffer, 0, 0);
+	wl_surface_damage_buffer(surface->surface, x, y, w, h);
+	wl_surface_commit(surface->surface);
+}
+
+static void wm_base_ping(void *data, struct xdg_wm_base *wm_base, uint32_t serial)
+{
+	xdg_wm_base_pong(wm_base, serial);
+}
+
+static const struct xdg_wm_base_listener wm_base_listener = {
+	.ping = wm_base_ping,
+};
+
+static void xdg_surface_configure(void *data, struct xdg_surface *xdg_surface, uint32_t serial)
+{
+	struct load_surface *surface = data;
+
+	xdg_surface_ack_configure(xdg_surface, serial);
+	if (!surface->configured) {
+		surface->configured = true;
+		damage(surface, true);
+	}
+}
+
+static const struct xdg_surface_listener xdg_surface_listener = {
+	.configure = xdg_surface_configure,
+};
+
+static void popup_configure(void *data,
+                            struct xdg_popup *xdg_popup,
+                            int32_t x,
+                            int32_t y,
+                            int32_t width,
+                            int32_t height)
+{
+}
+
+static void popup_done(void *data, struct xdg_popup *xdg_popup)
+{
+}
+
+static const struct xdg_popup_listener popup_listener = {
+	.configure = popup_configure,
+	.popup_done = popup_done,
+};
+
+static struct load_surface *surface_create(struct load *load, int width, int height)
+{
+	/* Surfaces are referenced by their listeners, so never move them. */
+	if (load->nsurfaces == load->capacity) {
+		wayback_log(LOG_ERROR, "Too many surfaces");
+		exit(EXIT_FAILURE);
+	}
+
+	struct load_surface *surface = &load->surfaces[load->nsurfaces++];
+	surface->load = load;
+	surface->width = width;
+	surface->height = height;
+	create_buffer(load, surface);
+	surface->surface = wl_compositor_create_surface(load->compositor);
+	surface->xdg_surface = xdg_wm_base_get_xdg_surface(load->wm_base, surface->surface);
+	xdg_surface_add_listener(surface->xdg_surface, &xdg_surface_listener, surface);
+	return surface;
+}
+
+static void add_toplevel(struct load *load, long popups)
+{
+	struct load_surface *toplevel = surface_create(load, SURFACE_WIDTH, SURFACE_HEIGHT);
+	toplevel->xdg_toplevel = xdg_surface_get_toplevel(toplevel->xdg_surface);
+	xdg_toplevel_set_title(toplevel->xdg_toplevel, "wayback-bench-scene-load");
+	wl_surface_commit(toplevel->surface);
+
+	for (long i = 0; i < popups; i++) {
+		struct xdg_positioner *positioner = xdg_wm_base_create_positioner(load->wm_base);
+		xdg_positioner_set_size(positioner, POPUP_SIZE, POPUP_SIZE);
+		xdg_positioner_set_anchor_rect(
+			positioner, (i * POPUP_SIZE) % SURFACE_WIDTH, SURFACE_HEIGHT / 2, 1, 1);
+
+		struct load_surface *popup = surface_create(load, POPUP_SIZE, POPUP_SIZE);
+		popup->xdg_popup =
+			xdg_surface_get_popup(popup->xdg_surface, toplevel->xdg_surface, positioner);
+		xdg_popup_add_listener(popup->xdg_popup, &popup_listener, popup);
+		xdg_positioner_destroy(positioner);
+		wl_surface_commit(popup->surface);
+	}
+}
+
+static void registry_global(void *data,
+                            struct wl_registry *registry,
+                            uint32_t name,
+                            const char *interface,
+                            uint32_t version)
+{
+	struct load *load = data;
+
+	if (strcmp(interface, wl_compositor_interface.name) == 0) {
+		load->compositor = wl_registry_bind(registry, name, &wl_compositor_interface, 4);
+	} else if (strcmp(interface, wl_shm_interface.name) == 0) {
+		load->shm = wl_registry_bind(registry, name, &wl_shm_interface, 1);
+	} else if (strcmp(interface, xdg_wm_base_interface.name) == 0) {
+		load->wm_base = wl_registry_bind(registry, name, &xdg_wm_base_interface, 1);
+		xdg_wm_base_add_listener(load->wm_base, &wm_base_listener, load);
+	}
+}
+
+static void registry_global_remove(void *data, struct wl_registry *registry, uint32_t name)
+{
+}
+
+static const struct wl_registry_listener registry_listener = {
+	.global = registry_global,
+	.global_remove = registry_global_remove,
+};
+
+/* Damages random surfaces at 60 Hz for the given time. */
+static void run_load(struct load *load, long damage_per_tick, uint64_t duration_usec)
+{
+	uint64_t end = now_usec() + duration_usec;
+	uint64_t next_tick = now_usec();
+
+	for (;;) {
+		uint64_t now = now_usec();
+		if (now >= end)
+			break;
+		if (now >= next_tick) {
+			for (long i = 0; i < damage_per_tick; i++) {
+				struct load_surface *surface = &load->surfaces[rand() % load->nsurfaces];
+				if (surface->configured && load->text_rects > 0) {
+					damage_text(surface, load->text_rects);
+					load->damage_commits++;
+				} else if (surface->configured) {
+					damage(surface, false);
+					load->damage_commits++;
+				}
+			}
+			next_tick += TICK_USEC;
+		}
+
+		wl_display_dispatch_pending(load->display);
+		wl_display_flush(load->display);
+		struct pollfd pfd = { .fd = wl_display_get_fd(load->display), .events = POLLIN };
+		uint64_t wait = next_tick > now ? next_tick - now : 0;
+		if (poll(&pfd, 1, (wait + 999) / 1000) < 0 && errno != EINTR)
+			break;
+		if ((pfd.revents & POLLIN) && wl_display_dispatch(load->display) < 0) {
+			wayback_log(LOG_ERROR, "Lost connection to the compositor");
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
+static const struct wayback_metrics_page *map_metrics(pid_t pid)
+{
+	char name[64];
+	snprintf(name, sizeof(name), WAYBACK_METRICS_SHM_PREFIX "%d", (int)pid);
+
+	int fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+	if (fd < 0)
+		return NULL;
+	const struct wayback_metrics_page *page =
+		mmap(NULL, sizeof(*page), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	return page == MAP_FAILED ? NULL : page;
+}
+
+/* Resident memory in KiB, from /proc */
+static long process_rss_kib(pid_t pid)
+{
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+	FILE *status = fopen(path, "r");
+	if (status == NULL)
+		return -1;
+
+	long rss = -1;
+	char line[256];
+	while (fgets(line, sizeof(line), status) != NULL) {
+		if (sscanf(line, "VmRSS: %ld kB", &rss) == 1)
+			break;
+	}
+	fclose(status);
+	return rss;
+}
+
+/* Mean of the commit latency histogram, taking the middle of each bucket */
+static double mean_commit_usec(const struct wayback_metrics_page *before,
+                               const struct wayback_metrics_page *after)
+{
+	double total = 0;
+	uint64_t count = 0;
+	for (int i = 0; i < WAYBACK_METRICS_LATENCY_BUCKETS; i++) {
+		uint64_t n = after->commit_latency[i] - before->commit_latency[i];
+		total += n * (1.5 * (1 << i));
+		count += n;
+	}
+	return count ? total / count : 0;
+}
+
+extern char **environ;
+
+int main(int argc, char *argv[])
+{
+	wayback_log_init("wayback-bench-scene-load", LOG_INFO, NULL);
+
+	long toplevels = 400;
+	long popups = 1;
+	long steps = 4;
+	long seconds = 3;
+	long damage_per_tick = 20;
+	long text_rects = 0;
+	bool huge_pages = false;
+	const char *mode = NULL;
+	const struct optcmd opts[] = {
+		{ .name = "-toplevels",
+		  .description = "toplevels at the last step (default 400)",
+		  .flag = OPT_OPERAND,
+		  .ignore = false },
+		{ .name = "-popups",
+		  .description = "popups per toplevel (default 1)",
+		  .flag = OPT_OPERAND,
+		  .ignore = false },
+		{ .name = "-steps",
+		  .description = "number of steps to add the toplevels in (default 4)",
+		  .flag = OPT_OPERAND,
+		  .ignore = false },
+		{ .name = "-seconds",
+		  .description = "seconds of load per step (default 3)",
+		  .flag = OPT_OPERAND,
+		  .ignore = false },
+		{ .name = "-damage",
+		  .description = "surfaces damaged per 60 Hz tick (default 20)",
+		  .flag = OPT_OPERAND,
+		  .ignore = false },
+		{ .name = "-rects",
+		  .description = "glyphs damaged per commit, like text (default: one rectangle)",
+		  .flag = OPT_OPERAND,
+		  .ignore = false },
+		{ .name = "-hugepages",
+		  .description = "render with Pixman into huge page backed buffers",
+		  .flag = OPT_NOFLAG,
+		  .ignore = false },
+		{ .name = "-mode",
+		  .description = "output mode, e.g. 3840x2160 (default 1920x1080)",
+		  .flag = OPT_OPERAND,
+		  .ignore = false },
+	};
+
+	int cur_opt = 0;
+	while (cur_opt = optparse(argc, argv, opts, ARRAY_SIZE(opts)), cur_opt != -1) {
+		if (optmatch == NULL) {
+			wayback_log(LOG_ERROR, "Unknown option %s", argv[cur_opt]);
+			exit(EXIT_FAILURE);
+		} else if (strcmp(argv[cur_opt], "-toplevels") == 0) {
+			toplevels = strtol(argv[cur_opt + 1], NULL, 10);
+		} else if (strcmp(argv[cur_opt], "-popups") == 0) {
+			popups = strtol(argv[cur_opt + 1], NULL, 10);
+		} else if (strcmp(argv[cur_opt], "-steps") == 0) {
+			steps = strtol(argv[cur_opt + 1], NULL, 10);
+		} else if (strcmp(argv[cur_opt], "-seconds") == 0) {
+			seconds = strtol(argv[cur_opt + 1], NULL, 10);
+		} else if (strcmp(argv[cur_opt], "-damage") == 0) {
+			damage_per_tick = strtol(argv[cur_opt + 1], NULL, 10);
+		} else if (strcmp(argv[cur_opt], "-rects") == 0) {
+			text_rects = strtol(argv[cur_opt + 1], NULL, 10);
+		} else if (strcmp(argv[cur_opt], "-hugepages") == 0) {
+			huge_pages = true;
+		} else if (strcmp(argv[cur_opt], "-mode") == 0) {
+			mode = argv[cur_opt + 1];
+		}
+	}
+	if (toplevels <= 0 || popups < 0 || steps <= 0 || steps > toplevels || seconds <= 0 ||
+	    damage_per_tick < 0 || text_rects < 0) {
+		wayback_log(LOG_ERROR, "Invalid load parameters");
+		exit(EXIT_FAILURE);
+	}
+
+	struct load load = { .capacity = toplevels * (1 + popups), .text_rects = text_rects };
+	load.surfaces = calloc(load.capacity, sizeof(*load.surfaces));
+	if (load.surfaces == NULL) {
+		wayback_log(LOG_ERROR, "Failed to allocate surfaces");
+		exit(EXIT_FAILURE);
+	}
+
+	const char *compositor_path = getenv("WAYBACK_COMPOSITOR_PATH");
+	if (compositor_path == NULL)
+		compositor_path = WAYBACK_COMPOSITOR_EXEC_PATH;
+
+	/* Stand-ins for Xwayback and Xwayland, which just stay connected */
+	int socket_xwayback[2], socket_xwayland[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, socket_xwayback) == -1 ||
+	    socketpair(AF_UNIX, SOCK_STREAM, 0, socket_xwayland) == -1) {
+		wayback_log(LOG_ERROR, "Unable to create compositor sockets");
+		exit(EXIT_FAILURE);
+	}
+
+	char fd_xwayback[64], fd_xwayland[64], socket_name[64];
+	snprintf(fd_xwayback, sizeof(fd_xwayback), "%d", socket_xwayback[0]);
+	snprintf(fd_xwayland, sizeof(fd_xwayland), "%d", socket_xwayland[0]);
+	snprintf(socket_name, sizeof(socket_name), "wayback-scene-load-%d", (int)getpid());
+
+	setenv("WLR_BACKENDS", "headless", false);
+	setenv("WLR_HEADLESS_OUTPUTS", "1", false);
+	setenv("WLR_LIBINPUT_NO_DEVICES", "1", false);
+	setenv("WAYBACK_DEBUG_SOCKET", socket_name, true);
+	if (huge_pages) {
+		setenv("WLR_RENDERER", "pixman", true);
+		setenv("WAYBACK_HUGE_PAGES", "1", true);
+	}
+
+	/* The headless output takes its mode from a configuration file */
+	char config_path[] = "/tmp/wayback-scene-load-XXXXXX";
+	if (mode != NULL) {
+		int fd = mkstemp(config_path);
+		FILE *config = fd >= 0 ? fdopen(fd, "w") : NULL;
+		if (config == NULL) {
+			wayback_log(LOG_ERROR, "Unable to write %s: %s", config_path, strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+		fprintf(config, "[output HEADLESS-1]\nmode = %s\n", mode);
+		fclose(config);
+		setenv("WAYBACK_CONFIG", config_path, true);
+	}
+
+	posix_spawn_file_actions_t file_actions;
+	posix_spawn_file_actions_init(&file_actions);
+	posix_spawn_file_actions_addclose(&file_actions, socket_xwayback[1]);
+	posix_spawn_file_actions_addclose(&file_actions, socket_xwayland[1]);
+
+	pid_t comp_pid;
+	int ret = posix_spawn(&comp_pid,
+	                      compositor_path,
+	                      &file_actions,
+	                      NULL,
+	                      (char *[]){ (char *)compositor_path, fd_xwayback, fd_xwayland, NULL },
+	                      environ);
+	if (ret != 0) {
+		wayback_log(LOG_ERROR, "Failed to launch wayback-compositor: %s", strerror(ret));
+		exit(EXIT_FAILURE);
+	}
+	posix_spawn_file_actions_destroy(&file_actions);
+	close(socket_xwayback[0]);
+	close(socket_xwayland[0]);
+
+	/* The socket appears once the compositor got that far */
+	uint64_t deadline = now_usec() + CONNECT_TIMEOUT_USEC;
+	while ((load.display = wl_display_connect(socket_name)) == NULL) {
+		if (now_usec() >= deadline || waitpid(comp_pid, NULL, WNOHANG) != 0) {
+			wayback_log(LOG_ERROR, "Unable to connect to wayback-compositor");
+			kill(comp_pid, SIGTERM);
+			exit(EXIT_FAILURE);
+		}
+		usleep(10000);
+	}
+
+	wl_registry_add_listener(wl_display_get_registry(load.display), &registry_listener, &load);
+	wl_display_roundtrip(load.display);
+	if (load.compositor == NULL || load.shm == NULL || load.wm_base == NULL) {
+		wayback_log(LOG_ERROR, "Compositor is missing required globals");
+		exit(EXIT_FAILURE);
+	}
+
+	const struct wayback_metrics_page *metrics = map_metrics(comp_pid);
+	if (metrics == NULL)
+		wayback_log(LOG_WARN, "Compositor metrics are unavailable, only memory is reported");
+
+	const char *renderer = getenv("WLR_RENDERER");
+	printf("# %s output, %s renderer, %s pages\n",
+	       mode != NULL ? mode : "1920x1080",
+	       renderer != NULL ? renderer : "default",
+	       huge_pages ? "huge" : "4 KiB");
+
+	long idle_rss = process_rss_kib(comp_pid);
+	printf("%9s %8s %10s %12s %10s %10s\n",
+	       "toplevels",
+	       "surfaces",
+	       "frames/s",
+	       "commit (us)",
+	       "RSS (KiB)",
+	       "KiB/surf");
+
+	long added = 0;
+	for (long step = 1; step <= steps; step++) {
+		long target = toplevels * step / steps;
+		for (; added < target; added++)
+			add_toplevel(&load, popups);
+		wl_display_roundtrip(load.display);
+
+		struct wayback_metrics_page before = { 0 }, after = { 0 };
+		if (metrics != NULL)
+			wayback_metrics_read(metrics, &before);
+		run_load(&load, damage_per_tick, seconds * 1000000ULL);
+		if (metrics != NULL)
+			wayback_metrics_read(metrics, &after);
+
+		long rss = process_rss_kib(comp_pid);
+		printf("%9ld %8zu %10.1f %12.1f %10ld %10.1f\n",
+		       added,
+		       load.nsurfaces,
+		       (double)(after.frames_committed - before.frames_committed) / seconds,
+		       mean_commit_usec(&before, &after),
+		       rss,
+		       rss >= 0 && idle_rss >= 0 ? (double)(rss - idle_rss) / load.nsurfaces : 0.0);
+		fflush(stdout);
+	}
+	printf("%" PRIu64 " damaged commits\n", load.damage_commits);
+	struct wayback_metrics_page last = { 0 };
+	if (metrics != NULL && wayback_metrics_read(metrics, &last) && last.damage_rects_in > 0)
+		printf("%" PRIu64 " damage rects coalesced into %" PRIu64 ", %" PRIu64
+		       " pixels into %" PRIu64 "\n",
+		       last.damage_rects_in,
+		       last.damage_rects_out,
+		       last.damage_pixels_in,
+		       last.damage_pixels_out);
+
+	wl_display_disconnect(load.display);
+	close(socket_xwayback[1]);
+	close(socket_xwayland[1]);
+	waitpid(comp_pid, NULL, 0);
+	if (mode != NULL)
+		unlink(config_path);
+	free(load.surfaces);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,518 @@
+/*
+ * Session startup and teardown benchmark.
+ *
+ * Runs the whole wayback-session -> Xwayback -> wayback-compositor chain
+ * on the headless backend, with wayback-fake-xwayland standing in for
+ * Xwayland. The session command is this program again, which only tells
+ * the benchmark that it was started and exits. Every session gets its own
+ * scratch directory as XDG_CACHE_HOME and XDG_CONFIG_HOME, so that neither
+ * the user's configuration nor outputs cached by earlier sessions get in
+ * the way, and nothing is left behind.
+ *
+ * Startup is the time from launching wayback-session until the session
+ * command runs, teardown the time from then until every process of the
+ * chain has exited. The first run is reported separately as the cold
+ * start, before the binaries and libraries are in the page cache (as far
+ * as that is the case without -dropcaches, which needs root). Comparing
+ * cold starts with and without -noprefetch shows what Xwayback's readahead
+ * of Xwayland and its data gains.
+ *
+ * With -check, it is a test instead: Xwayback and the compositor have to
+ * exit successfully and, with WAYBACK_LEAK_CHECK set, free everything they
+ * allocated. -vkms runs the check on the DRM backend of a vkms device,
+ * where every session after the first has to keep the mode the previous
+ * one left active, as the stats command of the control socket shows it.
+ * Without a usable vkms device, the test is skipped.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "optparse.h"
+#include "utils.h"
+#include "wayback_log.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <spawn.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define STARTUP_TIMEOUT_MSEC 10000
+
+/* Set in the environment of the session command */
+#define NOTIFY_FD_ENV "WAYBACK_BENCH_NOTIFY_FD"
+/* Where the session command saves the compositor's stats, if set */
+#define STATS_PATH_ENV "WAYBACK_BENCH_STATS"
+
+/* Exit status for tests that meson reports as skipped */
+#define TEST_SKIP 77
+
+/* Processes whose exit status -check looks at, as named in /proc/<pid>/comm */
+static const char *checked_commands[] = { "Xwayback", "wayback-composi" };
+
+struct sample
+{
+	uint64_t startup_usec;
+	uint64_t teardown_usec;
+};
+
+static uint64_t now_usec(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+}
+
+/* Running as the session command, asks the compositor for its stats */
+static bool save_stats(const char *path)
+{
+	const char *socket_path = getenv("WAYBACK_CONTROL_SOCKET");
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	if (socket_path == NULL || strlen(socket_path) >= sizeof(addr.sun_path))
+		return false;
+	strcpy(addr.sun_path, socket_path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return false;
+	FILE *out = NULL;
+	bool ok = connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0 &&
+	          write(fd, "stats\n", 6) == 6 && (out = fopen(path, "w")) != NULL;
+	/* The compositor hangs up after the reply */
+	char buf[4096];
+	ssize_t n;
+	while (ok && (n = read(fd, buf, sizeof(buf))) > 0)
+		ok = fwrite(buf, 1, n, out) == (size_t)n;
+	if (out != NULL && fclose(out) != 0)
+		ok = false;
+	close(fd);
+	return ok;
+}
+
+/* Running as the session command */
+static int notify_started(const char *fd_str)
+{
+	const char *stats_path = getenv(STATS_PATH_ENV);
+	/* Missing stats fail the check, the session still has to end */
+	if (stats_path != NULL && !save_stats(stats_path))
+		wayback_log(LOG_ERROR, "Unable to get the compositor's stats: %s", strerror(errno));
+
+	int fd = strtol(fd_str, NULL, 10);
+	if (write(fd, "", 1) != 1)
+		return EXIT_FAILURE;
+	return EXIT_SUCCESS;
+}
+
+extern char **environ;
+
+/* Whether a child that is waiting to be reaped exited as -check expects */
+static bool child_exited_cleanly(const siginfo_t *info)
+{
+	if (info->si_code == CLD_EXITED && info->si_status == 0)
+		return true;
+
+	char path[64], comm[32] = "";
+	snprintf(path, sizeof(path), "/proc/%d/comm", info->si_pid);
+	FILE *f = fopen(path, "r");
+	if (f != NULL) {
+		if (fgets(comm, sizeof(comm), f) != NULL)
+			comm[strcspn(comm, "\n")] = '\0';
+		fclose(f);
+	}
+	for (size_t i = 0; i < ARRAY_SIZE(checked_commands); i++) {
+		if (strcmp(comm, checked_commands[i]) != 0)
+			continue;
+		if (info->si_code == CLD_EXITED)
+			wayback_log(LOG_ERROR, "%s exited with status %d", comm, info->si_status);
+		else
+			wayback_log(LOG_ERROR, "%s was killed by signal %d", comm, info->si_status);
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Waits for every process of the session. As a subreaper, we also get
+ * Xwayback's children once it is gone. Returns false if checking and one
+ * of checked_commands failed.
+ */
+static bool reap_session(bool check)
+{
+	bool ok = true;
+	siginfo_t info;
+	for (;;) {
+		/* Keep the child around until its name was looked up */
+		memset(&info, 0, sizeof(info));
+		if (waitid(P_ALL, 0, &info, WEXITED | WNOWAIT) == -1) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		if (check && !child_exited_cleanly(&info))
+			ok = false;
+		waitpid(info.si_pid, NULL, 0);
+	}
+	return ok;
+}
+
+/* Removes a session's scratch directory along with what the session left in it */
+static void remove_tree(int at, const char *name)
+{
+	int fd = openat(at, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd < 0) {
+		unlinkat(at, name, 0);
+		return;
+	}
+
+	DIR *dir = fdopendir(fd);
+	if (dir == NULL) {
+		close(fd);
+	} else {
+		struct dirent *entry;
+		while ((entry = readdir(dir)) != NULL) {
+			if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0)
+				remove_tree(dirfd(dir), entry->d_name);
+		}
+		closedir(dir);
+	}
+	unlinkat(at, name, AT_REMOVEDIR);
+}
+
+/* Points the session's configuration, caches and control socket into dir */
+static void isolate_session(const char *dir, bool save_stats)
+{
+	char path[PATH_MAX];
+	setenv("XDG_CACHE_HOME", dir, true);
+	setenv("XDG_CONFIG_HOME", dir, true);
+	/* Doesn't exist, the compositor runs with the defaults */
+	snprintf(path, sizeof(path), "%s/config", dir);
+	setenv("WAYBACK_CONFIG", path, true);
+	snprintf(path, sizeof(path), "%s/control", dir);
+	setenv("WAYBACK_CONTROL_SOCKET", path, true);
+	snprintf(path, sizeof(path), "%s/stats", dir);
+	if (save_stats)
+		setenv(STATS_PATH_ENV, path, true);
+	else
+		unsetenv(STATS_PATH_ENV);
+}
+
+/* Whether the stats saved by the session command show an output that kept its mode */
+static bool kept_mode(const char *dir)
+{
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/stats", dir);
+	FILE *stats = fopen(path, "r");
+	if (stats == NULL) {
+		wayback_log(LOG_ERROR, "The session saved no stats: %s", strerror(errno));
+		return false;
+	}
+
+	bool kept = false;
+	char line[512];
+	while (fgets(line, sizeof(line), stats) != NULL) {
+		if (strncmp(line, "output ", 7) == 0 && strstr(line, "(kept active mode)") != NULL)
+			kept = true;
+	}
+	fclose(stats);
+	return kept;
+}
+
+/* With check_mode, the session has to keep the mode the CRTC is driving */
+static bool run_session(const char *session_path,
+                        const char *self_path,
+                        bool wait_frame,
+                        bool check,
+                        bool check_mode,
+                        struct sample *sample)
+{
+	char dir[] = "/tmp/wayback-bench-XXXXXX";
+	if (mkdtemp(dir) == NULL) {
+		wayback_log(LOG_ERROR, "Failed to create a scratch directory: %s", strerror(errno));
+		return false;
+	}
+	isolate_session(dir, check_mode);
+
+	int notify[2];
+	if (pipe(notify) == -1) {
+		wayback_log(LOG_ERROR, "Failed to create pipe: %s", strerror(errno));
+		remove_tree(AT_FDCWD, dir);
+		return false;
+	}
+	fcntl(notify[0], F_SETFD, FD_CLOEXEC);
+
+	char notify_fd[16];
+	snprintf(notify_fd, sizeof(notify_fd), "%d", notify[1]);
+	setenv(NOTIFY_FD_ENV, notify_fd, true);
+
+	const char *args[] = {
+		session_path, "-sesscmd", self_path, wait_frame ? "-waitframe" : NULL, NULL,
+	};
+	uint64_t start = now_usec();
+	pid_t pid;
+	int ret = posix_spawn(&pid, session_path, NULL, NULL, (char **)args, environ);
+	unsetenv(NOTIFY_FD_ENV);
+	close(notify[1]);
+	if (ret != 0) {
+		wayback_log(LOG_ERROR, "Failed to launch %s: %s", session_path, strerror(ret));
+		close(notify[0]);
+		remove_tree(AT_FDCWD, dir);
+		return false;
+	}
+
+	char byte;
+	struct pollfd pfd = { .fd = notify[0], .events = POLLIN };
+	bool started = poll(&pfd, 1, STARTUP_TIMEOUT_MSEC) == 1 && read(notify[0], &byte, 1) == 1;
+	uint64_t started_at = now_usec();
+	close(notify[0]);
+	if (!started) {
+		wayback_log(LOG_ERROR, "Session did not start");
+		kill(pid, SIGTERM);
+	}
+
+	bool clean = reap_session(check);
+
+	sample->startup_usec = started_at - start;
+	sample->teardown_usec = now_usec() - started_at;
+
+	if (started && check_mode && !kept_mode(dir)) {
+		wayback_log(LOG_ERROR, "The session changed the mode the previous one left");
+		clean = false;
+	}
+	remove_tree(AT_FDCWD, dir);
+	return started && clean;
+}
+
+/* Finds the device node of a vkms card that we can open */
+static bool find_vkms(char *path, size_t size)
+{
+	DIR *dir = opendir("/sys/class/drm");
+	if (dir == NULL)
+		return false;
+
+	bool found = false;
+	struct dirent *entry;
+	while (!found && (entry = readdir(dir)) != NULL) {
+		/* Connectors are listed as card0-Virtual-1 and the like */
+		if (strncmp(entry->d_name, "card", 4) != 0 || strchr(entry->d_name, '-') != NULL)
+			continue;
+
+		char link[PATH_MAX], driver[PATH_MAX];
+		snprintf(link, sizeof(link), "/sys/class/drm/%s/device/driver", entry->d_name);
+		ssize_t len = readlink(link, driver, sizeof(driver) - 1);
+		if (len < 0)
+			continue;
+		driver[len] = '\0';
+		const char *name = strrchr(driver, '/');
+		if (strcmp(name != NULL ? name + 1 : driver, "vkms") != 0)
+			continue;
+
+		snprintf(path, size, "/dev/dri/%s", entry->d_name);
+		found = access(path, R_OK | W_OK) == 0;
+	}
+	closedir(dir);
+	return found;
+}
+
+static bool drop_caches(void)
+{
+	sync();
+	int fd = open("/proc/sys/vm/drop_caches", O_WRONLY | O_CLOEXEC);
+	bool ok = fd >= 0 && write(fd, "3", 1) == 1;
+	if (!ok)
+		wayback_log(LOG_ERROR, "Unable to drop caches: %s", strerror(errno));
+	if (fd >= 0)
+		close(fd);
+	return ok;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+	uint64_t sa = *(const uint64_t *)a, sb = *(const uint64_t *)b;
+	return sa < sb ? -1 : sa > sb;
+}
+
+static void print_stats(const char *what, uint64_t *values, size_t n)
+{
+	if (n == 0)
+		return;
+	qsort(values, n, sizeof(*values), compare_u64);
+	printf("%-14s min %8.3f  p50 %8.3f  max %8.3f ms\n",
+	       what,
+	       values[0] / 1000.0,
+	       values[n / 2] / 1000.0,
+	       values[n - 1] / 1000.0);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *notify_fd = getenv(NOTIFY_FD_ENV);
+	if (notify_fd != NULL)
+		return notify_started(notify_fd);
+
+	wayback_log_init("wayback-bench-startup", LOG_INFO, NULL);
+
+	long runs = 10;
+	bool wait_frame = false;
+	bool prefetch = true;
+	bool cold = false;
+	bool check = false;
+	bool vkms = false;
+	const char *session_path = "wayback-session";
+	const char *xwayland_path = NULL;
+	const struct optcmd opts[] = {
+		{ .name = "-runs",
+		  .description = "number of sessions to start (default 10)",
+		  .flag = OPT_OPERAND,
+		  .ignore = false },
+		{ .name = "-session",
+		  .description = "path to wayback-session",
+		  .flag = OPT_OPERAND,
+		  .ignore = false },
+		{ .name = "-xwayland",
+		  .description = "path to the Xwayland stand-in",
+		  .flag = OPT_OPERAND,
+		  .ignore = false },
+		{ .name = "-waitframe",
+		  .description = "start sessions once the first frame is on screen",
+		  .flag = OPT_NOFLAG,
+		  .ignore = false },
+		{ .name = "-noprefetch",
+		  .description = "start sessions without readahead of Xwayland",
+		  .flag = OPT_NOFLAG,
+		  .ignore = false },
+		{ .name = "-dropcaches",
+		  .description = "drop the page cache before the cold start (needs root)",
+		  .flag = OPT_NOFLAG,
+		  .ignore = false },
+		{ .name = "-check",
+		  .description = "check that sessions exit cleanly, without leaks",
+		  .flag = OPT_NOFLAG,
+		  .ignore = false },
+		{ .name = "-vkms",
+		  .description = "with -check, run on a vkms device and check that modes are kept",
+		  .flag = OPT_NOFLAG,
+		  .ignore = false },
+	};
+
+	int cur_opt = 0;
+	while (cur_opt = optparse(argc, argv, opts, ARRAY_SIZE(opts)), cur_opt != -1) {
+		if (optmatch == NULL) {
+			wayback_log(LOG_ERROR, "Unknown option %s", argv[cur_opt]);
+			exit(EXIT_FAILURE);
+		} else if (strcmp(argv[cur_opt], "-runs") == 0) {
+			runs = strtol(argv[cur_opt + 1], NULL, 10);
+		} else if (strcmp(argv[cur_opt], "-session") == 0) {
+			session_path = argv[cur_opt + 1];
+		} else if (strcmp(argv[cur_opt], "-xwayland") == 0) {
+			xwayland_path = argv[cur_opt + 1];
+		} else if (strcmp(argv[cur_opt], "-waitframe") == 0) {
+			wait_frame = true;
+		} else if (strcmp(argv[cur_opt], "-noprefetch") == 0) {
+			prefetch = false;
+		} else if (strcmp(argv[cur_opt], "-dropcaches") == 0) {
+			cold = true;
+		} else if (strcmp(argv[cur_opt], "-check") == 0) {
+			check = true;
+		} else if (strcmp(argv[cur_opt], "-vkms") == 0) {
+			vkms = true;
+		}
+	}
+	if (vkms && !check) {
+		wayback_log(LOG_ERROR, "-vkms only works with -check");
+		exit(EXIT_FAILURE);
+	}
+	if (check && runs < 1) {
+		wayback_log(LOG_ERROR, "Need at least one run");
+		exit(EXIT_FAILURE);
+	} else if (!check && runs < 2) {
+		wayback_log(LOG_ERROR, "Need at least two runs, a cold and a warm one");
+		exit(EXIT_FAILURE);
+	}
+
+	char self_path[PATH_MAX];
+	ssize_t len = readlink("/proc/self/exe", self_path, sizeof(self_path) - 1);
+	if (len < 0) {
+		wayback_log(LOG_ERROR, "Unable to find own executable: %s", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	self_path[len] = '\0';
+
+	if (xwayland_path != NULL)
+		setenv("XWAYLAND_PATH", xwayland_path, true);
+	if (!prefetch)
+		setenv("WAYBACK_PREFETCH", "0", true);
+	if (check)
+		setenv("WAYBACK_LEAK_CHECK", "1", true);
+
+	if (vkms) {
+		char device[PATH_MAX];
+		if (!find_vkms(device, sizeof(device))) {
+			wayback_log(LOG_INFO, "No vkms device that can be opened, skipping");
+			exit(TEST_SKIP);
+		}
+		setenv("WLR_BACKENDS", "drm", true);
+		setenv("WLR_DRM_DEVICES", device, true);
+		/* Without a seat daemon, root can still open the device directly */
+		if (geteuid() == 0)
+			setenv("LIBSEAT_BACKEND", "noop", false);
+	}
+	setenv("WLR_BACKENDS", "headless", false);
+	setenv("WLR_HEADLESS_OUTPUTS", "1", false);
+	setenv("WLR_LIBINPUT_NO_DEVICES", "1", false);
+
+	if (prctl(PR_SET_CHILD_SUBREAPER, 1) == -1) {
+		wayback_log(LOG_ERROR, "Unable to become a subreaper: %s", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	struct sample *samples = calloc(runs, sizeof(*samples));
+	uint64_t *values = calloc(runs, sizeof(*values));
+	if (samples == NULL || values == NULL) {
+		wayback_log(LOG_ERROR, "Failed to allocate samples");
+		exit(EXIT_FAILURE);
+	}
+	if (cold && !drop_caches())
+		exit(EXIT_FAILURE);
+	for (long i = 0; i < runs; i++) {
+		/* The first session may find the CRTC off, later ones get it from the previous */
+		bool check_mode = vkms && i > 0;
+		if (!run_session(session_path, self_path, wait_frame, check, check_mode, &samples[i]))
+			exit(EXIT_FAILURE);
+	}
+	if (check) {
+		printf("%ld sessions exited cleanly%s\n", runs, vkms ? " on vkms" : "");
+		free(values);
+		free(samples);
+		return EXIT_SUCCESS;
+	}
+
+	printf("session startup over %ld runs%s%s%s:\n",
+	       runs,
+	       wait_frame ? " (-waitframe)" : "",
+	       prefetch ? "" : " (-noprefetch)",
+	       cold ? " (-dropcaches)" : "");
+	printf("%-14s %8.3f ms\n", "cold startup", samples[0].startup_usec / 1000.0);
+	printf("%-14s %8.3f ms\n", "cold teardown", samples[0].teardown_usec / 1000.0);
+	for (long i = 1; i < runs; i++)
+		values[i - 1] = samples[i].startup_usec;
+	print_stats("warm startup", values, runs - 1);
+	for (long i = 1; i < runs; i++)
+		values[i - 1] = samples[i].teardown_usec;
+	print_stats("warm teardown", values, runs - 1);
+
+	free(values);
+	free(samples);
+	return EXIT_SUCCESS;
+}
@@ -15,65 +15,148 @@
 #include <string.h>
 #include <unistd.h>
 
+/* Lookup table for the last options table seen, see optfind() */
+#define OPT_HASH_SLOTS 256
+
 int optind = 0, optpos = 0, optoper = 0;
+const struct optcmd *optmatch = NULL;
+
+static struct
+{
+	const struct optcmd *opts;
+	uint32_t optlen;
+	/* Index + 1 into opts, 0 for empty slots */
+	uint16_t slots[OPT_HASH_SLOTS];
+} opt_hash;
+
+static uint32_t opt_hash_name(const char *name)
+{
+	uint32_t hash = 2166136261u;
+	for (; *name != '\0'; name++)
+		hash = (hash ^ (unsigned char)*name) * 16777619u;
+	return hash;
+}
+
+static void opt_hash_build(const struct optcmd opts[], uint32_t optlen)
+{
+	memset(opt_hash.slots, 0, sizeof(opt_hash.slots));
+	opt_hash.opts = opts;
+	opt_hash.optlen = optlen;
+
+	for (uint32_t i = 0; i < optlen; i++) {
+		uint32_t slot = opt_hash_name(opts[i].name) % OPT_HASH_SLOTS;
+		while (opt_hash.slots[slot] != 0) {
+			/* The first of several entries with the same name wins */
+			if (strcmp(opts[opt_hash.slots[slot] - 1].name, opts[i].name) == 0)
+				break;
+			slot = (slot + 1) % OPT_HASH_SLOTS;
+		}
+		if (opt_hash.slots[slot] == 0)
+			opt_hash.slots[slot] = i + 1;
+	}
+}
+
+/*
+ * Finds the entry for an argument, either by name or, for OPT_NUM entries,
+ * by prefix (e.g. "vt7" for "vt").
+ */
+const struct optcmd *optfind(const struct optcmd opts[], uint32_t optlen, const char *arg)
+{
+	/* Tables are small, keep at most half the slots in use */
+	if (optlen <= OPT_HASH_SLOTS / 2) {
+		if (opt_hash.opts != opts || opt_hash.optlen != optlen)
+			opt_hash_build(opts, optlen);
+
+		uint32_t slot = opt_hash_name(arg) % OPT_HASH_SLOTS;
+		for (; opt_hash.slots[slot] != 0; slot = (slot + 1) % OPT_HASH_SLOTS) {
+			if (strcmp(opts[opt_hash.slots[slot] - 1].name, arg) == 0)
+				return &opts[opt_hash.slots[slot] - 1];
+		}
+	} else {
+		for (uint32_t i = 0; i < optlen; i++) {
+			if (strcmp(opts[i].name, arg) == 0)
+				return &opts[i];
+		}
+	}
+
+	for (uint32_t i = 0; i < optlen; i++) {
+		if (opts[i].flag == OPT_NUM && strncmp(arg, opts[i].name, strlen(opts[i].name)) == 0)
+			return &opts[i];
+	}
+	return NULL;
+}
+
+static void optignored(const char *arg, const struct optcmd *opt)
+{
+	if (strcmp(opt->description, "") != 0)
+		wayback_log(LOG_WARN, "%s: %s", arg, opt->description);
+	else
+		wayback_log(LOG_WARN, "Option %s ignored", arg);
+}
 
 int optparse(int argc, char *argv[], const struct optcmd opts[], uint32_t optlen)
 {
 	optpos++;
 	optpos += optoper;
 	optoper = 0;
+	optmatch = NULL;
 	if (optpos >= argc || !argv[optpos]) {
 		return -1;
 	}
-	for (uint32_t i = 0; i < optlen; i++) {
-		/* help message */
-		if (strcmp(argv[optpos], "-help") == 0) {
-			wayback_log(LOG_INFO,
-			            "Wayback <https://wayback.freedesktop.org/> X.Org compatibility layer");
-			wayback_log(
-				LOG_INFO,
-				"Report bugs to <https://gitlab.freedesktop.org/wayback/wayback/-/issues>.");
-			wayback_log(LOG_INFO, "Usage: %s [option]", argv[0]);
-			wayback_log(LOG_INFO, "\t-help\t\t show this help message");
-			for (size_t j = 0; j < optlen; j++) {
-				if (!opts[j].ignore) {
-					wayback_log(LOG_INFO,
-					            "\t%s%s\t\t %s",
-					            opts[j].name,
-					            opts[j].flag == OPT_OPERAND ? " opt" : "",
-					            opts[j].description);
-				}
-			}
-			exit(EXIT_SUCCESS);
-		} else if (strcmp(argv[optpos], opts[i].name) == 0) {
-			if (((opts[i].flag == OPT_OPERAND) && (((optpos + 1) >= argc || !argv[optpos + 1]))) ||
-			    opts[i].flag == OPT_NUM) {
-				wayback_log(LOG_ERROR, "Option %s requires operand", argv[optpos]);
-				exit(EXIT_FAILURE);
-			} else if (opts[i].ignore == true) {
-				if (strcmp(opts[i].description, "") != 0)
-					wayback_log(LOG_WARN, "%s: %s", argv[optpos], opts[i].description);
-				else
-					wayback_log(LOG_WARN, "Option %s ignored", argv[optpos]);
-			}
 
-			if (opts[i].flag == OPT_OPERAND) {
-				optind++;
-				optoper++;
+	/* help message */
+	if (strcmp(argv[optpos], "-help") == 0) {
+		wayback_log(LOG_INFO,
+		            "Wayback <https://wayback.freedesktop.org/> X.Org compatibility layer");
+		wayback_log(LOG_INFO,
+		            "Report bugs to <https://gitlab.freedesktop.org/wayback/wayback/-/issues>.");
+		wayback_log(LOG_INFO, "Usage: %s [option]", argv[0]);
+		wayback_log(LOG_INFO, "\t-help\t\t show this help message");
+		for (size_t j = 0; j < optlen; j++) {
+			if (!opts[j].ignore) {
+				wayback_log(LOG_INFO,
+				            "\t%s%s\t\t %s",
+				            opts[j].name,
+				            opts[j].flag == OPT_OPERAND ? " opt" : "",
+				            opts[j].description);
 			}
-			optind++;
-			break;
-		} else if (opts[i].flag == OPT_NUM &&
-		           strncmp(argv[optpos], opts[i].name, strlen(opts[i].name)) == 0) {
-			if (opts[i].ignore == true) {
-				if (strcmp(opts[i].description, "") != 0)
-					wayback_log(LOG_WARN, "%s: %s", argv[optpos], opts[i].description);
-				else
-					wayback_log(LOG_WARN, "Option %s ignored", argv[optpos]);
-			}
-			optind++;
-			break;
 		}
+		exit(EXIT_SUCCESS);
 	}
+
+	const struct optcmd *opt = optfind(opts, optlen, argv[optpos]);
+	if (opt == NULL)
+		return optpos;
+	optmatch = opt;
+
+	if (strcmp(argv[optpos], opt->name) != 0) {
+		/* OPT_NUM with its number attached */
+		if (opt->ignore)
+			optignored(argv[optpos], opt);
+		optind++;
+		return optpos;
+	}
+
+	if (((opt->flag == OPT_OPERAND) && (((optpos + 1) >= argc || !argv[optpos + 1]))) ||
+	    opt->flag == OPT_NUM) {
+		wayback_log(LOG_ERROR, "Option %s requires operand", argv[optpos]);
+		exit(EXIT_FAILURE);
+	} else if (opt->ignore) {
+		optignored(argv[optpos], opt);
+	}
+
+	if (opt->flag == OPT_OPERAND) {
+		optind++;
+		optoper++;
+	}
+	optind++;
 	return optpos;
 }
+
+void optparse_reset(void)
+{
+	optind = 0;
+	optpos = 0;
+	optoper = 0;
+	optmatch = NULL;
+}
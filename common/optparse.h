@@ -31,6 +31,16 @@ struct optcmd
 #define IGNORE_OPT_DESC(s, f, d) { .name = s, .description = d, .flag = f, .ignore = true }
 #define IGNORE_OPT(s, f) IGNORE_OPT_DESC(s, f, "")
 
+/*
+ * Returns the position of the next argument in argv, or -1 once all were
+ * seen. optmatch is set to its entry in opts, or NULL for arguments that
+ * are not in the table, so callers can pass those on in the same pass.
+ */
 int optparse(int argc, char *argv[], const struct optcmd opts[], uint32_t optlen);
+const struct optcmd *optfind(const struct optcmd opts[], uint32_t optlen, const char *arg);
+/* Starts over at argv[1], to parse another argument vector */
+void optparse_reset(void);
+
+extern const struct optcmd *optmatch;
 
 #endif
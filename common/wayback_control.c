@@ -0,0 +1,26 @@
+/*
+ * Runtime control socket shared by wayback-compositor and wayback-ctl.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "wayback_control.h"
+
+#include "utils.h"
+
+#include <stdlib.h>
+
+char *control_socket_path(pid_t pid)
+{
+	const char *path = getenv("WAYBACK_CONTROL_SOCKET");
+	if (path != NULL && path[0] != '\0')
+		return strdup_or_exit(path);
+
+	const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+	if (runtime_dir == NULL || runtime_dir[0] == '\0')
+		return NULL;
+
+	char *result;
+	asprintf_or_exit(&result, "%s/" WAYBACK_CONTROL_SOCKET_PREFIX "%d", runtime_dir, (int)pid);
+	return result;
+}
@@ -0,0 +1,22 @@
+/*
+ * Runtime control socket shared by wayback-compositor and wayback-ctl.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef WAYBACK_CONTROL_IMPORTED
+#define WAYBACK_CONTROL_IMPORTED
+
+#include <sys/types.h>
+
+#define WAYBACK_CONTROL_SOCKET_PREFIX "wayback-control-"
+#define WAYBACK_CONTROL_MAX_REQUEST 512
+
+/*
+ * Returns the control socket path of the compositor with the given pid,
+ * honouring WAYBACK_CONTROL_SOCKET, or NULL if XDG_RUNTIME_DIR is unset.
+ * The caller frees the result.
+ */
+char *control_socket_path(pid_t pid);
+
+#endif
@@ -11,7 +11,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 
-static enum wayback_log_level logging_max_verbosity = LOG_INFO;
+enum wayback_log_level wayback_log_max_verbosity = LOG_INFO;
 static char *logging_context = "wayback";
 static bool logging_use_color = true;
 
@@ -31,9 +31,6 @@ static const char *log_prefix[] = {
 
 static void default_log_func(enum wayback_log_level verbosity, const char *fmt, va_list args)
 {
-	if (verbosity > logging_max_verbosity)
-		return;
-
 	unsigned verbosity_lvl = (verbosity < LOG_LAST) ? verbosity : LOG_LAST - 1;
 
 	if (logging_use_color)
@@ -58,7 +55,7 @@ void wayback_log_init(char *ctx,
 	if (ctx)
 		logging_context = ctx;
 
-	logging_max_verbosity = max_verbosity;
+	wayback_log_verbosity(max_verbosity);
 
 	if (log_function)
 		logging_func = log_function;
@@ -70,15 +67,17 @@ void wayback_log_init(char *ctx,
 
 void wayback_log_verbosity(enum wayback_log_level max_verbosity)
 {
-	logging_max_verbosity = max_verbosity;
+	wayback_log_max_verbosity = max_verbosity;
 }
 
 void wayback_vlog(enum wayback_log_level verbosity, const char *format, va_list args)
 {
-	logging_func(verbosity, format, args);
+	if (wayback_log_enabled(verbosity))
+		logging_func(verbosity, format, args);
 }
 
-void wayback_log(enum wayback_log_level verbosity, const char *format, ...)
+/* Only called through the wayback_log() macro, which checks the level */
+void _wayback_log(enum wayback_log_level verbosity, const char *format, ...)
 {
 	va_list args;
 	va_start(args, format);
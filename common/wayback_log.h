@@ -8,6 +8,7 @@
 #define WAYBACK_LOG_IMPORTED
 
 #include <stdarg.h>
+#include <stdbool.h>
 
 enum wayback_log_level
 {
@@ -18,14 +19,37 @@ enum wayback_log_level
 	LOG_LAST,
 };
 
+/*
+ * Messages above this level are compiled out, along with the evaluation of
+ * their arguments. Set through the max_log_level meson option.
+ */
+#ifndef WAYBACK_LOG_MAX_LEVEL
+#define WAYBACK_LOG_MAX_LEVEL LOG_DEBUG
+#endif
+
 typedef void (*wayback_log_func_t)(enum wayback_log_level verbosity, const char *fmt, va_list args);
 
+/* Runtime verbosity, only to be changed through wayback_log_verbosity() */
+extern enum wayback_log_level wayback_log_max_verbosity;
+
+static inline bool wayback_log_enabled(enum wayback_log_level verbosity)
+{
+	return verbosity <= WAYBACK_LOG_MAX_LEVEL && verbosity <= wayback_log_max_verbosity;
+}
+
 void wayback_log_init(char *ctx,
                       enum wayback_log_level max_verbosity,
                       wayback_log_func_t log_function);
 
 void wayback_log_verbosity(enum wayback_log_level max_verbosity);
 void wayback_vlog(enum wayback_log_level verbosity, const char *format, va_list args);
-void wayback_log(enum wayback_log_level verbosity, const char *format, ...);
+void _wayback_log(enum wayback_log_level verbosity, const char *format, ...)
+	__attribute__((format(printf, 2, 3)));
+
+#define wayback_log(verbosity, ...) \
+	do { \
+		if (wayback_log_enabled(verbosity)) \
+			_wayback_log(verbosity, __VA_ARGS__); \
+	} while (0)
 
 #endif
@@ -0,0 +1,97 @@
+/*
+ * Allocation accounting for frequently created objects
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "wayback_mem.h"
+
+#include "wayback_log.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Freed objects kept per pool, enough for a burst of popups */
+#define POOL_CACHE_MAX 8
+
+static struct wayback_pool *pools;
+
+void *wayback_pool_alloc(struct wayback_pool *pool)
+{
+	if (!pool->registered) {
+		pool->registered = true;
+		pool->next = pools;
+		pools = pool;
+	}
+
+	void *object;
+	if (pool->cache != NULL) {
+		object = pool->cache;
+		memcpy(&pool->cache, object, sizeof(pool->cache));
+		pool->cached--;
+		memset(object, 0, pool->size);
+	} else {
+		/* Cached objects link to the next one through their first bytes */
+		object = calloc(1, pool->size < sizeof(void *) ? sizeof(void *) : pool->size);
+		if (object == NULL)
+			return NULL;
+	}
+
+	pool->allocations++;
+	if (++pool->live > pool->peak)
+		pool->peak = pool->live;
+	return object;
+}
+
+void wayback_pool_free(struct wayback_pool *pool, void *object)
+{
+	if (object == NULL)
+		return;
+
+	pool->live--;
+	if (pool->cached < POOL_CACHE_MAX) {
+		memcpy(object, &pool->cache, sizeof(pool->cache));
+		pool->cache = object;
+		pool->cached++;
+	} else {
+		free(object);
+	}
+}
+
+void wayback_mem_report(FILE *out)
+{
+	for (struct wayback_pool *pool = pools; pool != NULL; pool = pool->next) {
+		fprintf(out,
+		        "%-12s %6zu live %6zu peak %8zu bytes %10" PRIu64 " allocated\n",
+		        pool->name,
+		        pool->live,
+		        pool->peak,
+		        (pool->live + pool->cached) * pool->size,
+		        pool->allocations);
+	}
+}
+
+bool wayback_mem_finish(void)
+{
+	bool clean = true;
+	for (struct wayback_pool *pool = pools; pool != NULL; pool = pool->next) {
+		while (pool->cache != NULL) {
+			void *object = pool->cache;
+			memcpy(&pool->cache, object, sizeof(pool->cache));
+			free(object);
+		}
+		pool->cached = 0;
+
+		if (pool->live > 0) {
+			wayback_log(LOG_WARN, "%zu %s were never freed", pool->live, pool->name);
+			clean = false;
+		}
+		wayback_log(LOG_DEBUG,
+		            "%s: %" PRIu64 " allocated, at most %zu at once",
+		            pool->name,
+		            pool->allocations,
+		            pool->peak);
+	}
+	return clean;
+}
@@ -0,0 +1,52 @@
+/*
+ * Allocation accounting for frequently created objects.
+ *
+ * Per-object state such as outputs, keyboards and toplevels is allocated
+ * from pools that count their live objects. Freed objects are cached for
+ * reuse, up to a few per pool. wayback_mem_report() lists every pool that
+ * was used, and wayback_mem_finish() flags objects that were never freed.
+ *
+ * Pools are not thread safe, only use them from the main loop.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef WAYBACK_MEM_IMPORTED
+#define WAYBACK_MEM_IMPORTED
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+struct wayback_pool
+{
+	const char *name;
+	size_t size;
+
+	/* Filled in on first use */
+	struct wayback_pool *next;
+	bool registered;
+	void *cache;
+	size_t cached;
+	size_t live, peak;
+	uint64_t allocations;
+};
+
+/* Defines a pool of objects of the given type, e.g.
+ * WAYBACK_POOL(output_pool, "outputs", struct tinywl_output); */
+#define WAYBACK_POOL(pool, pool_name, type)                                                       \
+	static struct wayback_pool pool = { .name = (pool_name), .size = sizeof(type) }
+
+/* Returns a zeroed object, or NULL if out of memory. */
+void *wayback_pool_alloc(struct wayback_pool *pool);
+void wayback_pool_free(struct wayback_pool *pool, void *object);
+
+void wayback_mem_report(FILE *out);
+/*
+ * Releases cached objects and logs the pools, warning about objects that
+ * are still live. Returns false if there were any.
+ */
+bool wayback_mem_finish(void);
+
+#endif
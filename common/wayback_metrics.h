@@ -0,0 +1,118 @@
+/*
+ * Shared-memory metrics page published by wayback-compositor.
+ *
+ * The compositor creates a POSIX shared memory object named
+ * WAYBACK_METRICS_SHM_PREFIX<pid> holding a struct wayback_metrics_page.
+ * Only its user can read it, or the group named by WAYBACK_METRICS_GROUP.
+ * Monitoring tools map it read-only and take consistent snapshots with
+ * wayback_metrics_read(), without ever waking the compositor up.
+ *
+ * Counters are only ever appended at the end of the struct; readers must
+ * check magic and version, and may rely on size to skip unknown fields.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef WAYBACK_METRICS_IMPORTED
+#define WAYBACK_METRICS_IMPORTED
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#define WAYBACK_METRICS_SHM_PREFIX "/wayback-metrics-"
+#define WAYBACK_METRICS_MAGIC 0x544d4257 /* "WBMT" */
+#define WAYBACK_METRICS_VERSION 1
+
+/* Bucket i counts output commits that took [2^i, 2^(i+1)) microseconds. */
+#define WAYBACK_METRICS_LATENCY_BUCKETS 16
+
+struct wayback_metrics_page
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size;
+	/* Odd while the compositor is updating the page */
+	_Atomic uint32_t seq;
+	int32_t pid;
+	uint32_t clients;
+
+	/* Output frames */
+	uint64_t frames_committed;
+	uint64_t frames_skipped;
+	uint64_t frames_failed;
+	uint64_t scanout_frames;
+	uint64_t commit_latency[WAYBACK_METRICS_LATENCY_BUCKETS];
+
+	/* Input events */
+	uint64_t key_events;
+	uint64_t pointer_motion_events;
+	uint64_t pointer_button_events;
+	uint64_t pointer_axis_events;
+
+	/* Client surface commits and the buffers attached to them */
+	uint64_t surface_commits;
+	uint64_t shm_buffers;
+	uint64_t dmabuf_buffers;
+	uint64_t other_buffers;
+	uint64_t shm_buffer_bytes;
+
+	/* Client connections, see connection.c */
+	uint64_t client_bytes_queued;
+	/* Most bytes a client left unread in its socket */
+	uint64_t client_backlog_max;
+	uint64_t client_near_overflows;
+
+	/* Touch input, see touch.c */
+	uint64_t touch_events;
+	uint64_t touch_frames;
+
+	/* Surface damage before and after coalescing, see damage.c */
+	uint64_t damage_rects_in;
+	uint64_t damage_rects_out;
+	uint64_t damage_pixels_in;
+	uint64_t damage_pixels_out;
+};
+
+static inline void wayback_metrics_begin(struct wayback_metrics_page *page)
+{
+	uint32_t seq = atomic_load_explicit(&page->seq, memory_order_relaxed);
+	atomic_store_explicit(&page->seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+}
+
+static inline void wayback_metrics_end(struct wayback_metrics_page *page)
+{
+	uint32_t seq = atomic_load_explicit(&page->seq, memory_order_relaxed);
+	atomic_store_explicit(&page->seq, seq + 1, memory_order_release);
+}
+
+/* Adds to a single counter, e.g. WAYBACK_METRICS_ADD(page, key_events, 1). */
+#define WAYBACK_METRICS_ADD(page, counter, n)                                                     \
+	do {                                                                                          \
+		wayback_metrics_begin(page);                                                              \
+		(page)->counter += (n);                                                                   \
+		wayback_metrics_end(page);                                                                \
+	} while (0)
+
+/*
+ * Copies a consistent snapshot of the page, retrying while the compositor
+ * is writing. Returns false if no stable copy could be taken.
+ */
+static inline bool wayback_metrics_read(const struct wayback_metrics_page *page,
+                                        struct wayback_metrics_page *snapshot)
+{
+	for (int tries = 0; tries < 1000; tries++) {
+		uint32_t seq = atomic_load_explicit(&page->seq, memory_order_acquire);
+		if (seq & 1)
+			continue;
+		memcpy(snapshot, (const void *)page, sizeof(*snapshot));
+		atomic_thread_fence(memory_order_acquire);
+		if (atomic_load_explicit(&page->seq, memory_order_relaxed) == seq)
+			return true;
+	}
+	return false;
+}
+
+#endif
@@ -0,0 +1,172 @@
+/*
+ * Per-monitor output configuration remembered across sessions.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "wayback_output_cache.h"
+
+#include "utils.h"
+#include "wayback_log.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/* $XDG_CACHE_HOME/wayback/outputs, the directory is created if create is set */
+static char *output_cache_path(bool create)
+{
+	char *dir;
+	const char *cache_home = getenv("XDG_CACHE_HOME");
+	const char *home = getenv("HOME");
+	if (cache_home != NULL && *cache_home != '\0') {
+		if (create)
+			mkdir(cache_home, 0700);
+		asprintf_or_exit(&dir, "%s/wayback", cache_home);
+	} else if (home != NULL) {
+		if (create) {
+			asprintf_or_exit(&dir, "%s/.cache", home);
+			mkdir(dir, 0700);
+			free(dir);
+		}
+		asprintf_or_exit(&dir, "%s/.cache/wayback", home);
+	} else {
+		return NULL;
+	}
+
+	if (create && mkdir(dir, 0700) == -1 && errno != EEXIST) {
+		wayback_log(LOG_WARN, "Unable to create %s: %s", dir, strerror(errno));
+		free(dir);
+		return NULL;
+	}
+
+	char *path;
+	asprintf_or_exit(&path, "%s/outputs", dir);
+	free(dir);
+	return path;
+}
+
+/* FNV-1a over the strings, including their terminators */
+static uint64_t hash_string(uint64_t hash, const char *str)
+{
+	if (str == NULL)
+		str = "";
+	do {
+		hash ^= (unsigned char)*str;
+		hash *= 0x100000001b3ULL;
+	} while (*str++ != '\0');
+	return hash;
+}
+
+uint64_t wayback_output_cache_key(const char *make,
+                                  const char *model,
+                                  const char *serial,
+                                  const char *name)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	hash = hash_string(hash, make);
+	hash = hash_string(hash, model);
+	/* Two identical monitors without a serial number only differ in where
+	 * they are plugged in */
+	hash = hash_string(hash, serial != NULL && *serial != '\0' ? serial : name);
+	return hash != 0 ? hash : 1;
+}
+
+const struct wayback_output_cache *wayback_output_cache_map(void)
+{
+	char *path = output_cache_path(false);
+	if (path == NULL)
+		return NULL;
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	free(path);
+	if (fd < 0)
+		return NULL;
+
+	struct stat st;
+	const struct wayback_output_cache *cache = NULL;
+	if (fstat(fd, &st) == 0 && st.st_size == sizeof(*cache)) {
+		cache = mmap(NULL, sizeof(*cache), PROT_READ, MAP_SHARED, fd, 0);
+		if (cache == MAP_FAILED)
+			cache = NULL;
+	}
+	close(fd);
+
+	if (cache != NULL && (cache->magic != WAYBACK_OUTPUT_CACHE_MAGIC ||
+	                      cache->version != WAYBACK_OUTPUT_CACHE_VERSION)) {
+		wayback_output_cache_unmap(cache);
+		cache = NULL;
+	}
+	return cache;
+}
+
+void wayback_output_cache_unmap(const struct wayback_output_cache *cache)
+{
+	if (cache != NULL)
+		munmap((void *)cache, sizeof(*cache));
+}
+
+const struct wayback_output_cache_entry *
+wayback_output_cache_find(const struct wayback_output_cache *cache, uint64_t key)
+{
+	if (cache == NULL)
+		return NULL;
+	for (int i = 0; i < WAYBACK_OUTPUT_CACHE_ENTRIES; i++) {
+		if (cache->entries[i].key == key)
+			return &cache->entries[i];
+	}
+	return NULL;
+}
+
+bool wayback_output_cache_store(const struct wayback_output_cache_entry *entry)
+{
+	struct wayback_output_cache cache = {
+		.magic = WAYBACK_OUTPUT_CACHE_MAGIC,
+		.version = WAYBACK_OUTPUT_CACHE_VERSION,
+	};
+	const struct wayback_output_cache *old = wayback_output_cache_map();
+	if (old != NULL) {
+		memcpy(cache.entries, old->entries, sizeof(cache.entries));
+		wayback_output_cache_unmap(old);
+	}
+
+	struct wayback_output_cache_entry *slot = &cache.entries[0];
+	for (int i = 0; i < WAYBACK_OUTPUT_CACHE_ENTRIES; i++) {
+		if (cache.entries[i].key == entry->key) {
+			slot = &cache.entries[i];
+			break;
+		}
+		if (cache.entries[i].last_used < slot->last_used)
+			slot = &cache.entries[i];
+	}
+	*slot = *entry;
+	slot->last_used = time(NULL);
+
+	char *path = output_cache_path(true);
+	if (path == NULL)
+		return false;
+	char *tmp;
+	asprintf_or_exit(&tmp, "%s.%d", path, (int)getpid());
+
+	/* Replaced in one go, others may have the old one mapped */
+	bool ok = false;
+	int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd >= 0) {
+		ok = write(fd, &cache, sizeof(cache)) == sizeof(cache);
+		ok = close(fd) == 0 && ok;
+		ok = ok && rename(tmp, path) == 0;
+		if (!ok)
+			unlink(tmp);
+	}
+	if (!ok)
+		wayback_log(LOG_WARN, "Unable to write %s: %s", path, strerror(errno));
+
+	free(tmp);
+	free(path);
+	return ok;
+}
@@ -0,0 +1,73 @@
+/*
+ * Per-monitor output configuration remembered across sessions.
+ *
+ * wayback-compositor records the mode, scale, transform and layout position
+ * each monitor ended up with, along with the X screen size that results,
+ * in $XDG_CACHE_HOME/wayback/outputs. On the next start it applies them in
+ * a single commit instead of picking a mode from scratch, and Xwayback can
+ * size Xwayland before the compositor has reported any output.
+ *
+ * Monitors are told apart by make, model and serial number as read from
+ * their EDID, plus the connector for monitors without a serial number.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef WAYBACK_OUTPUT_CACHE_IMPORTED
+#define WAYBACK_OUTPUT_CACHE_IMPORTED
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define WAYBACK_OUTPUT_CACHE_MAGIC 0x434f4257 /* "WBOC" */
+#define WAYBACK_OUTPUT_CACHE_VERSION 1
+/* The least recently used monitor makes room for a new one */
+#define WAYBACK_OUTPUT_CACHE_ENTRIES 16
+
+struct wayback_output_cache_entry
+{
+	/* 0 for an unused entry */
+	uint64_t key;
+	/* Seconds since the epoch */
+	int64_t last_used;
+	/* Only for matching WAYBACK_OUTPUT in Xwayback */
+	char make[48];
+	char model[48];
+	char name[32];
+
+	int32_t width, height;
+	int32_t refresh_mhz;
+	int32_t transform;
+	float scale;
+	/* Position in the output layout */
+	int32_t x, y;
+	/* Effective resolution, the size of the X screen */
+	int32_t x_width, x_height;
+};
+
+struct wayback_output_cache
+{
+	uint32_t magic;
+	uint32_t version;
+	struct wayback_output_cache_entry entries[WAYBACK_OUTPUT_CACHE_ENTRIES];
+};
+
+uint64_t wayback_output_cache_key(const char *make,
+                                  const char *model,
+                                  const char *serial,
+                                  const char *name);
+
+/* Maps the cache read-only, NULL if there is none or it is unusable */
+const struct wayback_output_cache *wayback_output_cache_map(void);
+void wayback_output_cache_unmap(const struct wayback_output_cache *cache);
+
+const struct wayback_output_cache_entry *
+wayback_output_cache_find(const struct wayback_output_cache *cache, uint64_t key);
+
+/*
+ * Adds or replaces the entry with the same key. The file is replaced as a
+ * whole, mappings of the previous one stay valid but don't see the change.
+ */
+bool wayback_output_cache_store(const struct wayback_output_cache_entry *entry);
+
+#endif
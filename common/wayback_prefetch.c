@@ -0,0 +1,315 @@
+/*
+ * Background readahead of the files a session needs on startup.
+ *
+ * On a cold start from slow storage, most of the time before the X server
+ * is up goes into page faults on Xwayland, its libraries and the xkb
+ * data, and nothing touches them before the compositor has its outputs.
+ * A helper thread asks the kernel to read them ahead with
+ * posix_fadvise(POSIX_FADV_WILLNEED) right at startup, so that the reads
+ * overlap with the compositor's initialization.
+ *
+ * Libraries are found through the DT_NEEDED entries of the executable,
+ * looked up in LD_LIBRARY_PATH and in the directories our own libraries
+ * were loaded from, which is close enough to what the dynamic linker does
+ * without parsing its cache.
+ *
+ * The helper thread must not touch the environment, Xwayback changes it
+ * while spawning its children and setenv() isn't thread safe. So the
+ * library directories are collected before it starts. It also runs with
+ * every signal blocked, they are for the main thread (e.g. Xwayback's
+ * SIGALRM, which interrupts wait4() to sample resource usage).
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "wayback_prefetch.h"
+
+#include "utils.h"
+#include "wayback_log.h"
+
+#include <dirent.h>
+#include <elf.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <link.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Upper bounds, a session needs a few hundred files */
+#define PREFETCH_MAX_FILES 4096
+#define PREFETCH_MAX_DEPTH 4
+#define PREFETCH_MAX_LIBDIRS 32
+
+struct prefetch_file_id
+{
+	dev_t dev;
+	ino_t ino;
+};
+
+struct prefetch
+{
+	char **paths;
+	size_t count;
+
+	char *libdirs[PREFETCH_MAX_LIBDIRS];
+	size_t nlibdirs;
+
+	/* Everything read so far, symlinked libraries show up several times */
+	struct prefetch_file_id seen[PREFETCH_MAX_FILES];
+	size_t nseen;
+
+	uint64_t bytes;
+};
+
+bool wayback_prefetch_enabled(void)
+{
+	const char *env = getenv("WAYBACK_PREFETCH");
+	return env == NULL || strcmp(env, "0") != 0;
+}
+
+static void prefetch_add_libdir(struct prefetch *prefetch, const char *dir, size_t len)
+{
+	if (len == 0 || prefetch->nlibdirs == PREFETCH_MAX_LIBDIRS)
+		return;
+	for (size_t i = 0; i < prefetch->nlibdirs; i++) {
+		if (strlen(prefetch->libdirs[i]) == len && strncmp(prefetch->libdirs[i], dir, len) == 0)
+			return;
+	}
+	char *copy = strndup(dir, len);
+	if (copy != NULL)
+		prefetch->libdirs[prefetch->nlibdirs++] = copy;
+}
+
+static void prefetch_find_libdirs(struct prefetch *prefetch)
+{
+	const char *env = getenv("LD_LIBRARY_PATH");
+	while (env != NULL && *env != '\0') {
+		size_t len = strcspn(env, ":");
+		prefetch_add_libdir(prefetch, env, len);
+		env += len + (env[len] == ':');
+	}
+
+	/* Wherever libc and libwayland came from, so did most of Xwayland's */
+	FILE *maps = fopen("/proc/self/maps", "r");
+	if (maps != NULL) {
+		char line[4096];
+		while (fgets(line, sizeof(line), maps) != NULL) {
+			char *path = strchr(line, '/');
+			if (path == NULL || strstr(path, ".so") == NULL)
+				continue;
+			prefetch_add_libdir(prefetch, path, strrchr(path, '/') - path);
+		}
+		fclose(maps);
+	}
+
+	const char *fallback[] = { "/usr/lib64", "/lib64", "/usr/lib", "/lib" };
+	for (size_t i = 0; i < ARRAY_SIZE(fallback); i++)
+		prefetch_add_libdir(prefetch, fallback[i], strlen(fallback[i]));
+}
+
+static bool prefetch_seen(struct prefetch *prefetch, const struct stat *st)
+{
+	for (size_t i = 0; i < prefetch->nseen; i++) {
+		if (prefetch->seen[i].dev == st->st_dev && prefetch->seen[i].ino == st->st_ino)
+			return true;
+	}
+	if (prefetch->nseen == PREFETCH_MAX_FILES)
+		return true;
+	prefetch->seen[prefetch->nseen++] = (struct prefetch_file_id){ st->st_dev, st->st_ino };
+	return false;
+}
+
+static bool prefetch_path(struct prefetch *prefetch, int at, const char *path, int depth);
+
+/* Translates a virtual address to a file offset through the PT_LOAD segments */
+static bool elf_offset(const ElfW(Phdr) * phdr, size_t phnum, ElfW(Addr) addr, size_t *offset)
+{
+	for (size_t i = 0; i < phnum; i++) {
+		if (phdr[i].p_type == PT_LOAD && addr >= phdr[i].p_vaddr &&
+		    addr < phdr[i].p_vaddr + phdr[i].p_filesz) {
+			*offset = phdr[i].p_offset + (addr - phdr[i].p_vaddr);
+			return true;
+		}
+	}
+	return false;
+}
+
+static void prefetch_needed(struct prefetch *prefetch, const uint8_t *data, size_t size)
+{
+	const ElfW(Ehdr) *ehdr = (const ElfW(Ehdr) *)data;
+	if (size < sizeof(*ehdr) || memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0 ||
+	    ehdr->e_ident[EI_CLASS] != (sizeof(void *) == 8 ? ELFCLASS64 : ELFCLASS32) ||
+	    ehdr->e_phentsize != sizeof(ElfW(Phdr)) ||
+	    ehdr->e_phoff + (size_t)ehdr->e_phnum * sizeof(ElfW(Phdr)) > size)
+		return;
+
+	const ElfW(Phdr) *phdr = (const ElfW(Phdr) *)(data + ehdr->e_phoff);
+	const ElfW(Dyn) *dyn = NULL;
+	size_t ndyn = 0;
+	for (size_t i = 0; i < ehdr->e_phnum; i++) {
+		if (phdr[i].p_type == PT_DYNAMIC && phdr[i].p_offset + phdr[i].p_filesz <= size) {
+			dyn = (const ElfW(Dyn) *)(data + phdr[i].p_offset);
+			ndyn = phdr[i].p_filesz / sizeof(*dyn);
+		}
+	}
+
+	ElfW(Addr) strtab_addr = 0;
+	size_t strtab_size = 0, strtab;
+	for (size_t i = 0; i < ndyn && dyn[i].d_tag != DT_NULL; i++) {
+		if (dyn[i].d_tag == DT_STRTAB)
+			strtab_addr = dyn[i].d_un.d_ptr;
+		else if (dyn[i].d_tag == DT_STRSZ)
+			strtab_size = dyn[i].d_un.d_val;
+	}
+	if (strtab_size == 0 || !elf_offset(phdr, ehdr->e_phnum, strtab_addr, &strtab) ||
+	    strtab + strtab_size > size)
+		return;
+
+	for (size_t i = 0; i < ndyn && dyn[i].d_tag != DT_NULL; i++) {
+		if (dyn[i].d_tag != DT_NEEDED || dyn[i].d_un.d_val >= strtab_size)
+			continue;
+		const char *name = (const char *)data + strtab + dyn[i].d_un.d_val;
+		if (memchr(name, '\0', strtab_size - dyn[i].d_un.d_val) == NULL)
+			continue;
+
+		if (strchr(name, '/') != NULL) {
+			prefetch_path(prefetch, AT_FDCWD, name, 0);
+			continue;
+		}
+		for (size_t j = 0; j < prefetch->nlibdirs; j++) {
+			char path[PATH_MAX];
+			snprintf(path, sizeof(path), "%s/%s", prefetch->libdirs[j], name);
+			if (prefetch_path(prefetch, AT_FDCWD, path, 0))
+				break;
+		}
+	}
+}
+
+static void prefetch_file(struct prefetch *prefetch, int fd, const struct stat *st)
+{
+	posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+	prefetch->bytes += st->st_size;
+
+	/* Only executables and libraries need a closer look, not every xkb file */
+	char magic[SELFMAG];
+	if (pread(fd, magic, sizeof(magic), 0) != SELFMAG || memcmp(magic, ELFMAG, SELFMAG) != 0)
+		return;
+
+	void *data = mmap(NULL, st->st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (data == MAP_FAILED)
+		return;
+	prefetch_needed(prefetch, data, st->st_size);
+	munmap(data, st->st_size);
+}
+
+static void prefetch_dir(struct prefetch *prefetch, int fd, int depth)
+{
+	DIR *dir = fdopendir(fd);
+	if (dir == NULL) {
+		close(fd);
+		return;
+	}
+
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != NULL) {
+		if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0)
+			prefetch_path(prefetch, dirfd(dir), entry->d_name, depth + 1);
+	}
+	closedir(dir);
+}
+
+/* Returns whether path exists, even if it was read already */
+static bool prefetch_path(struct prefetch *prefetch, int at, const char *path, int depth)
+{
+	int fd = openat(at, path, O_RDONLY | O_CLOEXEC | O_NOCTTY | O_NONBLOCK);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) == -1 || prefetch_seen(prefetch, &st)) {
+		close(fd);
+		return true;
+	}
+
+	if (S_ISDIR(st.st_mode) && depth < PREFETCH_MAX_DEPTH) {
+		prefetch_dir(prefetch, fd, depth);
+		return true;
+	} else if (S_ISREG(st.st_mode) && st.st_size > 0) {
+		prefetch_file(prefetch, fd, &st);
+	}
+	close(fd);
+	return true;
+}
+
+static void prefetch_free(struct prefetch *prefetch)
+{
+	for (size_t i = 0; i < prefetch->count; i++)
+		free(prefetch->paths[i]);
+	for (size_t i = 0; i < prefetch->nlibdirs; i++)
+		free(prefetch->libdirs[i]);
+	free(prefetch->paths);
+	free(prefetch);
+}
+
+static void *prefetch_thread(void *data)
+{
+	struct prefetch *prefetch = data;
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (size_t i = 0; i < prefetch->count; i++)
+		prefetch_path(prefetch, AT_FDCWD, prefetch->paths[i], 0);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	long usec = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_nsec - start.tv_nsec) / 1000;
+	wayback_log(LOG_DEBUG,
+	            "Requested readahead of %zu files (%" PRIu64 " KiB) in %ld us",
+	            prefetch->nseen,
+	            prefetch->bytes / 1024,
+	            usec);
+	prefetch_free(prefetch);
+	return NULL;
+}
+
+void wayback_prefetch(const char *const paths[], size_t count)
+{
+	if (!wayback_prefetch_enabled())
+		return;
+
+	struct prefetch *prefetch = calloc(1, sizeof(*prefetch));
+	if (prefetch == NULL || (prefetch->paths = calloc(count, sizeof(char *))) == NULL) {
+		free(prefetch);
+		return;
+	}
+	for (size_t i = 0; i < count; i++) {
+		if (paths[i] != NULL)
+			prefetch->paths[prefetch->count++] = strdup_or_exit(paths[i]);
+	}
+	prefetch_find_libdirs(prefetch);
+
+	/* The thread inherits the signal mask */
+	sigset_t all, old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	pthread_t thread;
+	int ret = pthread_create(&thread, &attr, prefetch_thread, prefetch);
+	pthread_attr_destroy(&attr);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (ret != 0) {
+		wayback_log(LOG_WARN, "Unable to start readahead: %s", strerror(ret));
+		prefetch_free(prefetch);
+	}
+}
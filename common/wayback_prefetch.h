@@ -0,0 +1,24 @@
+/*
+ * Background readahead of the files a session needs on startup.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef WAYBACK_PREFETCH_IMPORTED
+#define WAYBACK_PREFETCH_IMPORTED
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* False if WAYBACK_PREFETCH is set to 0 */
+bool wayback_prefetch_enabled(void);
+
+/*
+ * Starts reading paths into the page cache on a detached thread and
+ * returns right away. Directories are walked, ELF executables and
+ * libraries pull in the libraries they link against. Missing paths and
+ * NULL entries are skipped.
+ */
+void wayback_prefetch(const char *const paths[], size_t count);
+
+#endif
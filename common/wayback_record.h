@@ -0,0 +1,71 @@
+/*
+ * On-disk format of protocol session recordings, written by
+ * wayback-compositor when WAYBACK_RECORD is set and played back by
+ * wayback-replay.
+ *
+ * A recording is a file header followed by records. Every record starts
+ * with a struct wayback_record_header and its payload of the given size.
+ * All integers are native endian, strings and byte arrays are prefixed
+ * with their length as a uint32_t and padded to 4 bytes.
+ *
+ * Message payload (requests and events of the recorded client):
+ *	uint32_t object id, uint32_t opcode, string interface name,
+ *	then the arguments in signature order:
+ *	  i, u, f: the 32-bit value
+ *	  o, n: the object id, 0 for null
+ *	  s: string, length 0 for null, otherwise including the terminator
+ *	  a: byte array
+ *	  h: nothing, file descriptors are not recorded
+ *
+ * Buffer payload, recorded right before the wl_surface.commit request
+ * that submits the buffer:
+ *	uint32_t surface id, width, height, stride, format, then either
+ *	stride * height bytes of pixels or a uint64_t FNV-1a hash of them.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef WAYBACK_RECORD_IMPORTED
+#define WAYBACK_RECORD_IMPORTED
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define WAYBACK_RECORD_MAGIC "WBREC\r\n"
+#define WAYBACK_RECORD_VERSION 1
+
+struct wayback_record_file_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved;
+};
+
+enum wayback_record_type
+{
+	WAYBACK_RECORD_REQUEST = 1,
+	WAYBACK_RECORD_EVENT,
+	WAYBACK_RECORD_BUFFER,
+	WAYBACK_RECORD_BUFFER_HASH,
+};
+
+struct wayback_record_header
+{
+	uint32_t type;
+	uint32_t size;
+	/* Microseconds since the recording started */
+	uint64_t time_usec;
+};
+
+static inline uint64_t wayback_record_hash(const void *data, size_t len)
+{
+	const uint8_t *bytes = data;
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for (size_t i = 0; i < len; i++) {
+		hash ^= bytes[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+#endif
@@ -0,0 +1,157 @@
+/*
+ * Resource accounting of supervised children.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "wayback_rusage.h"
+
+#include "wayback_log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+void wayback_log_rusage(const char *name, pid_t pid, const struct rusage *usage, bool exited)
+{
+	wayback_log(LOG_INFO,
+	            "%s (pid %d) %s: user %ld.%03lds, sys %ld.%03lds, max RSS %ld KiB, "
+	            "%ld voluntary and %ld involuntary context switches, "
+	            "%ld major and %ld minor page faults",
+	            name,
+	            (int)pid,
+	            exited ? "exited" : "so far",
+	            (long)usage->ru_utime.tv_sec,
+	            (long)usage->ru_utime.tv_usec / 1000,
+	            (long)usage->ru_stime.tv_sec,
+	            (long)usage->ru_stime.tv_usec / 1000,
+	            usage->ru_maxrss,
+	            usage->ru_nvcsw,
+	            usage->ru_nivcsw,
+	            usage->ru_majflt,
+	            usage->ru_minflt);
+}
+
+static void ticks_to_timeval(unsigned long long ticks, long hz, struct timeval *tv)
+{
+	tv->tv_sec = ticks / hz;
+	tv->tv_usec = (ticks % hz) * 1000000 / hz;
+}
+
+bool wayback_proc_rusage(pid_t pid, struct rusage *usage)
+{
+	char path[64];
+	char line[512];
+	memset(usage, 0, sizeof(*usage));
+
+	snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+	FILE *file = fopen(path, "r");
+	if (file == NULL)
+		return false;
+	bool ok = fgets(line, sizeof(line), file) != NULL;
+	fclose(file);
+
+	/* The command name may contain spaces and parentheses, skip past it */
+	char *fields = ok ? strrchr(line, ')') : NULL;
+	unsigned long minflt, majflt;
+	unsigned long long utime, stime;
+	if (fields == NULL || sscanf(fields + 2,
+	                             "%*c %*d %*d %*d %*d %*d %*u %lu %*u %lu %*u %llu %llu",
+	                             &minflt,
+	                             &majflt,
+	                             &utime,
+	                             &stime) != 4)
+		return false;
+
+	long hz = sysconf(_SC_CLK_TCK);
+	ticks_to_timeval(utime, hz, &usage->ru_utime);
+	ticks_to_timeval(stime, hz, &usage->ru_stime);
+	usage->ru_minflt = minflt;
+	usage->ru_majflt = majflt;
+
+	snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+	file = fopen(path, "r");
+	if (file == NULL)
+		return true;
+	while (fgets(line, sizeof(line), file) != NULL) {
+		sscanf(line, "VmHWM: %ld", &usage->ru_maxrss);
+		sscanf(line, "voluntary_ctxt_switches: %ld", &usage->ru_nvcsw);
+		sscanf(line, "nonvoluntary_ctxt_switches: %ld", &usage->ru_nivcsw);
+	}
+	fclose(file);
+	return true;
+}
+
+static bool read_cgroup_value(const char *cgroup,
+                              const char *file,
+                              const char *key,
+                              long long *value)
+{
+	char path[4096];
+	char line[256];
+	snprintf(path, sizeof(path), "/sys/fs/cgroup%s/%s", cgroup, file);
+
+	FILE *f = fopen(path, "r");
+	if (f == NULL)
+		return false;
+	bool found = false;
+	size_t key_len = key != NULL ? strlen(key) : 0;
+	while (!found && fgets(line, sizeof(line), f) != NULL) {
+		if (key == NULL)
+			found = sscanf(line, "%lld", value) == 1;
+		else if (strncmp(line, key, key_len) == 0 && line[key_len] == ' ')
+			found = sscanf(line + key_len, "%lld", value) == 1;
+	}
+	fclose(f);
+	return found;
+}
+
+void wayback_log_cgroup_usage(void)
+{
+	/* With cgroup v2 there is a single "0::<path>" line */
+	char line[4096];
+	FILE *file = fopen("/proc/self/cgroup", "r");
+	if (file == NULL)
+		return;
+	char *cgroup = NULL;
+	while (cgroup == NULL && fgets(line, sizeof(line), file) != NULL) {
+		if (strncmp(line, "0::", 3) == 0) {
+			cgroup = line + 3;
+			cgroup[strcspn(cgroup, "\n")] = '\0';
+		}
+	}
+	fclose(file);
+	if (cgroup == NULL)
+		return;
+
+	long long usage_usec, user_usec, system_usec, memory_peak;
+	if (!read_cgroup_value(cgroup, "cpu.stat", "usage_usec", &usage_usec) ||
+	    !read_cgroup_value(cgroup, "cpu.stat", "user_usec", &user_usec) ||
+	    !read_cgroup_value(cgroup, "cpu.stat", "system_usec", &system_usec))
+		return;
+	/* memory.peak needs Linux 5.19 */
+	if (!read_cgroup_value(cgroup, "memory.peak", NULL, &memory_peak))
+		memory_peak = -1;
+
+	wayback_log(LOG_INFO,
+	            "cgroup %s: cpu %lld.%03llds (user %lld.%03llds, sys %lld.%03llds), "
+	            "peak memory %lld KiB",
+	            cgroup,
+	            usage_usec / 1000000,
+	            usage_usec / 1000 % 1000,
+	            user_usec / 1000000,
+	            user_usec / 1000 % 1000,
+	            system_usec / 1000000,
+	            system_usec / 1000 % 1000,
+	            memory_peak >= 0 ? memory_peak / 1024 : -1);
+}
+
+unsigned int wayback_rusage_interval(void)
+{
+	const char *interval = getenv("WAYBACK_RUSAGE_INTERVAL");
+	if (interval == NULL)
+		return 0;
+	long seconds = strtol(interval, NULL, 10);
+	return seconds > 0 ? seconds : 0;
+}
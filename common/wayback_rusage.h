@@ -0,0 +1,30 @@
+/*
+ * Resource accounting of supervised children, shared by Xwayback and
+ * wayback-session.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef WAYBACK_RUSAGE_IMPORTED
+#define WAYBACK_RUSAGE_IMPORTED
+
+#include <stdbool.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+
+/*
+ * Logs CPU time, peak RSS, context switches and page faults of a child,
+ * either collected by wait4() or sampled with wayback_proc_rusage().
+ */
+void wayback_log_rusage(const char *name, pid_t pid, const struct rusage *usage, bool exited);
+
+/* Fills the fields of usage that /proc has for a running process. */
+bool wayback_proc_rusage(pid_t pid, struct rusage *usage);
+
+/* Logs the totals of our own cgroup, which spans the whole session. */
+void wayback_log_cgroup_usage(void);
+
+/* Seconds between samples from WAYBACK_RUSAGE_INTERVAL, 0 if unset. */
+unsigned int wayback_rusage_interval(void);
+
+#endif
@@ -0,0 +1,563 @@
+/*
+ * Compositor configuration file, see wayback-config(5).
+ *
+ * The file is parsed into a struct config_values and watched with inotify
+ * on the event loop. On every change it is parsed again and only what
+ * differs from the previous values is applied, so editing the repeat rate
+ * doesn't reset output modes and vice versa. A file that fails to parse
+ * leaves the running configuration untouched.
+ *
+ * The directory is watched rather than the file so that editors replacing
+ * the file and packages dropping it in place are noticed as well.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "utils.h"
+#include "wayback-compositor.h"
+#include "wayback_log.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <wayland-server-core.h>
+#include <wlr/types/wlr_cursor.h>
+#include <wlr/types/wlr_keyboard.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/types/wlr_seat.h>
+#include <wlr/types/wlr_xcursor_manager.h>
+#include <xkbcommon/xkbcommon.h>
+
+#define CONFIG_MAX_OUTPUTS 16
+
+struct output_config
+{
+	char *name;
+	int width, height;
+	int32_t refresh_mhz;
+	bool has_frame_policy;
+	enum frame_policy frame_policy;
+};
+
+struct config_values
+{
+	int repeat_rate, repeat_delay;
+	char *xkb_rules, *xkb_model, *xkb_layout, *xkb_variant, *xkb_options;
+	char *cursor_theme;
+	int cursor_size;
+	enum frame_policy frame_policy;
+	char *keybindings;
+	struct damage_policy damage;
+
+	struct output_config outputs[CONFIG_MAX_OUTPUTS];
+	int noutputs;
+};
+
+struct wayback_config
+{
+	struct tinywl_server *server;
+	char *path;
+	const char *filename;
+	int inotify_fd;
+	struct wl_event_source *source;
+
+	/* Environment variables take precedence over the file */
+	bool env_frame_policy;
+	bool env_keybindings;
+
+	struct config_values values;
+};
+
+static const struct config_values default_values = {
+	.repeat_rate = 25,
+	.repeat_delay = 600,
+	.cursor_size = 24,
+	.frame_policy = FRAME_POLICY_IMMEDIATE,
+	.damage = {
+		.enabled = false,
+		.merge_distance = 8,
+		.max_rects = 16,
+		.fill_percent = 75,
+		.tile_size = 0,
+	},
+};
+
+static void config_values_finish(struct config_values *values)
+{
+	free(values->xkb_rules);
+	free(values->xkb_model);
+	free(values->xkb_layout);
+	free(values->xkb_variant);
+	free(values->xkb_options);
+	free(values->cursor_theme);
+	free(values->keybindings);
+	for (int i = 0; i < values->noutputs; i++)
+		free(values->outputs[i].name);
+	*values = default_values;
+}
+
+static bool str_equal(const char *a, const char *b)
+{
+	return a == b || (a != NULL && b != NULL && strcmp(a, b) == 0);
+}
+
+static bool damage_policy_equal(const struct damage_policy *a, const struct damage_policy *b)
+{
+	return a->enabled == b->enabled && a->merge_distance == b->merge_distance &&
+	       a->max_rects == b->max_rects && a->fill_percent == b->fill_percent &&
+	       a->tile_size == b->tile_size;
+}
+
+static char *strip(char *str)
+{
+	while (isspace((unsigned char)*str))
+		str++;
+	char *end = str + strlen(str);
+	while (end > str && isspace((unsigned char)end[-1]))
+		end--;
+	*end = '\0';
+	return str;
+}
+
+static bool parse_int(const char *value, int min, int max, int *out)
+{
+	char *end;
+	errno = 0;
+	long parsed = strtol(value, &end, 10);
+	if (errno != 0 || *end != '\0' || end == value || parsed < min || parsed > max)
+		return false;
+	*out = parsed;
+	return true;
+}
+
+static bool parse_string(const char *value, char **out)
+{
+	free(*out);
+	*out = strdup(value);
+	return *out != NULL;
+}
+
+static bool parse_switch(const char *value, bool *out)
+{
+	if (strcmp(value, "on") == 0)
+		*out = true;
+	else if (strcmp(value, "off") == 0)
+		*out = false;
+	else
+		return false;
+	return true;
+}
+
+static bool parse_output_key(struct output_config *output, const char *key, const char *value)
+{
+	if (strcmp(key, "mode") == 0) {
+		float refresh = 0;
+		if (sscanf(value, "%dx%d@%f", &output->width, &output->height, &refresh) < 2 ||
+		    output->width <= 0 || output->height <= 0)
+			return false;
+		output->refresh_mhz = refresh * 1000;
+		return true;
+	} else if (strcmp(key, "frame-policy") == 0) {
+		output->has_frame_policy = true;
+		return frame_policy_from_name(value, &output->frame_policy);
+	}
+	return false;
+}
+
+static bool parse_key(struct config_values *values, const char *key, const char *value)
+{
+	if (strcmp(key, "repeat-rate") == 0)
+		return parse_int(value, 0, 1000, &values->repeat_rate);
+	else if (strcmp(key, "repeat-delay") == 0)
+		return parse_int(value, 0, 10000, &values->repeat_delay);
+	else if (strcmp(key, "xkb-rules") == 0)
+		return parse_string(value, &values->xkb_rules);
+	else if (strcmp(key, "xkb-model") == 0)
+		return parse_string(value, &values->xkb_model);
+	else if (strcmp(key, "xkb-layout") == 0)
+		return parse_string(value, &values->xkb_layout);
+	else if (strcmp(key, "xkb-variant") == 0)
+		return parse_string(value, &values->xkb_variant);
+	else if (strcmp(key, "xkb-options") == 0)
+		return parse_string(value, &values->xkb_options);
+	else if (strcmp(key, "cursor-theme") == 0)
+		return parse_string(value, &values->cursor_theme);
+	else if (strcmp(key, "cursor-size") == 0)
+		return parse_int(value, 1, 512, &values->cursor_size);
+	else if (strcmp(key, "frame-policy") == 0)
+		return frame_policy_from_name(value, &values->frame_policy);
+	else if (strcmp(key, "keybindings") == 0)
+		return parse_string(value, &values->keybindings);
+	else if (strcmp(key, "damage-coalesce") == 0)
+		return parse_switch(value, &values->damage.enabled);
+	else if (strcmp(key, "damage-merge-distance") == 0)
+		return parse_int(value, 0, 256, &values->damage.merge_distance);
+	else if (strcmp(key, "damage-max-rects") == 0)
+		return parse_int(value, 1, DAMAGE_MAX_RECTS, &values->damage.max_rects);
+	else if (strcmp(key, "damage-fill") == 0)
+		return parse_int(value, 0, 100, &values->damage.fill_percent);
+	else if (strcmp(key, "damage-tile") == 0)
+		return parse_int(value, 0, 256, &values->damage.tile_size);
+	return false;
+}
+
+/*
+ * Reads path into values. A missing file yields the defaults, any syntax
+ * error fails the whole file.
+ */
+static bool config_parse(const char *path, struct config_values *values)
+{
+	*values = default_values;
+
+	FILE *file = fopen(path, "r");
+	if (file == NULL) {
+		if (errno == ENOENT)
+			return true;
+		wayback_log(LOG_ERROR, "Failed to open %s: %s", path, strerror(errno));
+		return false;
+	}
+
+	struct output_config *output = NULL;
+	char *line = NULL;
+	size_t size = 0;
+	int lineno = 0;
+	bool ok = true;
+	while (ok && getline(&line, &size, file) != -1) {
+		lineno++;
+		char *comment = strchr(line, '#');
+		if (comment != NULL)
+			*comment = '\0';
+		char *str = strip(line);
+		if (*str == '\0')
+			continue;
+
+		if (*str == '[') {
+			char *end = strchr(str, ']');
+			if (end == NULL || end[1] != '\0' || strncmp(str, "[output ", 8) != 0 ||
+			    values->noutputs == CONFIG_MAX_OUTPUTS) {
+				ok = false;
+				break;
+			}
+			*end = '\0';
+			output = &values->outputs[values->noutputs++];
+			output->name = strdup(strip(str + 8));
+			ok = output->name != NULL;
+			continue;
+		}
+
+		char *equals = strchr(str, '=');
+		if (equals == NULL) {
+			ok = false;
+			break;
+		}
+		*equals = '\0';
+		char *key = strip(str);
+		char *value = strip(equals + 1);
+		ok = output != NULL ? parse_output_key(output, key, value) : parse_key(values, key, value);
+	}
+	free(line);
+	fclose(file);
+
+	if (!ok) {
+		wayback_log(LOG_ERROR, "%s:%d: invalid configuration", path, lineno);
+		config_values_finish(values);
+	}
+	return ok;
+}
+
+static const struct output_config *output_config_find(const struct config_values *values,
+                                                      const struct wlr_output *wlr_output)
+{
+	for (int i = 0; i < values->noutputs; i++) {
+		const struct output_config *output = &values->outputs[i];
+		char make_model[256];
+		snprintf(make_model, sizeof(make_model), "%s %s", wlr_output->make, wlr_output->model);
+		if (strcmp(output->name, wlr_output->name) == 0 || strcmp(output->name, make_model) == 0)
+			return output;
+	}
+	return NULL;
+}
+
+static bool output_config_mode_equal(const struct output_config *a, const struct output_config *b)
+{
+	if (a == NULL || b == NULL)
+		return a == b;
+	return a->width == b->width && a->height == b->height && a->refresh_mhz == b->refresh_mhz;
+}
+
+static enum frame_policy output_frame_policy(struct wayback_config *config,
+                                             const struct output_config *output)
+{
+	if (output != NULL && output->has_frame_policy)
+		return output->frame_policy;
+	return config->server->frame_policy;
+}
+
+/* What values ask for on an output, regardless of changes made at runtime */
+static enum frame_policy configured_frame_policy(struct wayback_config *config,
+                                                 const struct config_values *values,
+                                                 const struct output_config *output)
+{
+	if (output != NULL && output->has_frame_policy)
+		return output->frame_policy;
+	return config->env_frame_policy ? config->server->frame_policy : values->frame_policy;
+}
+
+static void output_config_apply_mode(struct tinywl_output *output,
+                                     const struct output_config *output_config)
+{
+	if (output_config == NULL || output_config->width <= 0)
+		return;
+	if (!output_set_mode(
+			output, output_config->width, output_config->height, output_config->refresh_mhz))
+		wayback_log(LOG_ERROR, "%s: failed to apply configured mode", output->wlr_output->name);
+}
+
+void config_apply_keyboard(struct tinywl_server *server, struct wlr_keyboard *wlr_keyboard)
+{
+	const struct config_values *values =
+		server->config != NULL ? &server->config->values : &default_values;
+
+	const struct xkb_rule_names names = {
+		.rules = values->xkb_rules,
+		.model = values->xkb_model,
+		.layout = values->xkb_layout,
+		.variant = values->xkb_variant,
+		.options = values->xkb_options,
+	};
+	struct xkb_context *context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
+	struct xkb_keymap *keymap =
+		xkb_keymap_new_from_names(context, &names, XKB_KEYMAP_COMPILE_NO_FLAGS);
+	if (keymap == NULL) {
+		wayback_log(LOG_ERROR, "Failed to compile keymap, falling back to the default");
+		keymap = xkb_keymap_new_from_names(context, NULL, XKB_KEYMAP_COMPILE_NO_FLAGS);
+	}
+
+	wlr_keyboard_set_keymap(wlr_keyboard, keymap);
+	xkb_keymap_unref(keymap);
+	xkb_context_unref(context);
+	wlr_keyboard_set_repeat_info(wlr_keyboard, values->repeat_rate, values->repeat_delay);
+}
+
+void config_apply_output(struct tinywl_server *server, struct tinywl_output *output)
+{
+	if (server->config == NULL)
+		return;
+
+	const struct output_config *output_config =
+		output_config_find(&server->config->values, output->wlr_output);
+	output->schedule.policy = output_frame_policy(server->config, output_config);
+	output_config_apply_mode(output, output_config);
+}
+
+bool config_output_has_mode(struct tinywl_server *server, const struct wlr_output *wlr_output)
+{
+	if (server->config == NULL)
+		return false;
+	const struct output_config *output_config =
+		output_config_find(&server->config->values, wlr_output);
+	return output_config != NULL && output_config->width > 0;
+}
+
+void config_apply_cursor(struct tinywl_server *server)
+{
+	const struct config_values *values =
+		server->config != NULL ? &server->config->values : &default_values;
+
+	struct wlr_xcursor_manager *cursor_mgr =
+		wlr_xcursor_manager_create(values->cursor_theme, values->cursor_size);
+	if (cursor_mgr == NULL)
+		return;
+	if (server->cursor_mgr != NULL)
+		wlr_xcursor_manager_destroy(server->cursor_mgr);
+	server->cursor_mgr = cursor_mgr;
+
+	/* Clients set their own cursor while they have pointer focus */
+	if (server->seat != NULL && server->seat->pointer_state.focused_surface == NULL)
+		wlr_cursor_set_xcursor(server->cursor, server->cursor_mgr, "default");
+}
+
+static void config_apply(struct wayback_config *config, const struct config_values *old)
+{
+	struct tinywl_server *server = config->server;
+	const struct config_values *new = &config->values;
+
+	if (old->repeat_rate != new->repeat_rate || old->repeat_delay != new->repeat_delay ||
+	    !str_equal(old->xkb_rules, new->xkb_rules) ||
+	    !str_equal(old->xkb_model, new->xkb_model) ||
+	    !str_equal(old->xkb_layout, new->xkb_layout) ||
+	    !str_equal(old->xkb_variant, new->xkb_variant) ||
+	    !str_equal(old->xkb_options, new->xkb_options)) {
+		struct tinywl_keyboard *keyboard;
+		wl_list_for_each(keyboard, &server->keyboards, link)
+			config_apply_keyboard(server, keyboard->wlr_keyboard);
+	}
+
+	if (!str_equal(old->cursor_theme, new->cursor_theme) || old->cursor_size != new->cursor_size)
+		config_apply_cursor(server);
+
+	if (!config->env_keybindings && !str_equal(old->keybindings, new->keybindings))
+		keybindings_load(server, new->keybindings);
+
+	/* Policies changed through the control socket or a keybinding are left
+	 * alone unless the file changes them too */
+	if (!config->env_frame_policy && old->frame_policy != new->frame_policy)
+		server->frame_policy = new->frame_policy;
+
+	if (!damage_policy_equal(&old->damage, &new->damage))
+		server->damage_policy = new->damage;
+
+	struct tinywl_output *output;
+	wl_list_for_each(output, &server->outputs, link)
+	{
+		const struct output_config *old_output = output_config_find(old, output->wlr_output);
+		const struct output_config *new_output = output_config_find(new, output->wlr_output);
+		enum frame_policy policy = configured_frame_policy(config, new, new_output);
+		if (configured_frame_policy(config, old, old_output) != policy)
+			output->schedule.policy = policy;
+		if (!output_config_mode_equal(old_output, new_output))
+			output_config_apply_mode(output, new_output);
+	}
+}
+
+static void config_reload(struct wayback_config *config)
+{
+	struct config_values values;
+	if (!config_parse(config->path, &values)) {
+		wayback_log(LOG_WARN, "Keeping the previous configuration");
+		return;
+	}
+
+	struct config_values old = config->values;
+	config->values = values;
+	config_apply(config, &old);
+	config_values_finish(&old);
+	wayback_log(LOG_INFO, "Reloaded %s", config->path);
+}
+
+static int config_handle_inotify(int fd, uint32_t mask, void *data)
+{
+	struct wayback_config *config = data;
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	bool changed = false;
+
+	ssize_t len;
+	while ((len = read(fd, buf, sizeof(buf))) > 0) {
+		for (char *ptr = buf; ptr < buf + len;) {
+			const struct inotify_event *event = (const struct inotify_event *)ptr;
+			if (event->len > 0 && strcmp(event->name, config->filename) == 0)
+				changed = true;
+			ptr += sizeof(*event) + event->len;
+		}
+	}
+
+	/* One reload for a whole batch of writes */
+	if (changed)
+		config_reload(config);
+	return 0;
+}
+
+static char *config_default_path(void)
+{
+	char *path;
+	const char *env = getenv("WAYBACK_CONFIG");
+	if (env != NULL)
+		return strdup(env);
+
+	const char *config_home = getenv("XDG_CONFIG_HOME");
+	if (config_home != NULL && config_home[0] != '\0')
+		asprintf_or_exit(&path, "%s/wayback/config", config_home);
+	else if (getenv("HOME") != NULL)
+		asprintf_or_exit(&path, "%s/.config/wayback/config", getenv("HOME"));
+	else
+		return NULL;
+	return path;
+}
+
+static void config_watch(struct wayback_config *config)
+{
+	char *slash = strrchr(config->path, '/');
+	config->filename = slash != NULL ? slash + 1 : config->path;
+	char dir[PATH_MAX];
+	snprintf(dir,
+	         sizeof(dir),
+	         "%.*s",
+	         slash != NULL ? (int)(slash - config->path) : 1,
+	         slash != NULL ? config->path : ".");
+	if (dir[0] == '\0')
+		strcpy(dir, "/");
+
+	uint32_t events = IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_TO | IN_MOVED_FROM;
+	config->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (config->inotify_fd < 0 || inotify_add_watch(config->inotify_fd, dir, events) < 0) {
+		/* Most likely the directory doesn't exist, which is fine */
+		wayback_log(LOG_DEBUG, "Not watching %s: %s", dir, strerror(errno));
+		return;
+	}
+
+	config->source = wl_event_loop_add_fd(wl_display_get_event_loop(config->server->wl_display),
+	                                      config->inotify_fd,
+	                                      WL_EVENT_READABLE,
+	                                      config_handle_inotify,
+	                                      config);
+}
+
+void config_create(struct tinywl_server *server)
+{
+	struct wayback_config *config = calloc(1, sizeof(*config));
+	if (config == NULL)
+		return;
+	config->server = server;
+	config->inotify_fd = -1;
+	config->values = default_values;
+	config->env_frame_policy = getenv("WAYBACK_FRAME_POLICY") != NULL;
+	config->env_keybindings = getenv("WAYBACK_KEYBINDINGS") != NULL;
+	server->config = config;
+
+	config->path = config_default_path();
+	if (config->path == NULL)
+		return;
+
+	/* A broken file shouldn't keep the session from starting */
+	if (!config_parse(config->path, &config->values))
+		wayback_log(LOG_WARN, "Using the default configuration");
+	config_watch(config);
+}
+
+/* Values that the environment doesn't override */
+const char *config_keybindings(struct tinywl_server *server)
+{
+	return server->config != NULL ? server->config->values.keybindings : NULL;
+}
+
+enum frame_policy config_frame_policy(struct tinywl_server *server)
+{
+	return server->config != NULL ? server->config->values.frame_policy
+	                              : default_values.frame_policy;
+}
+
+struct damage_policy config_damage_policy(struct tinywl_server *server)
+{
+	return server->config != NULL ? server->config->values.damage : default_values.damage;
+}
+
+void config_destroy(struct tinywl_server *server)
+{
+	struct wayback_config *config = server->config;
+	if (config == NULL)
+		return;
+
+	if (config->source != NULL)
+		wl_event_source_remove(config->source);
+	if (config->inotify_fd >= 0)
+		close(config->inotify_fd);
+	config_values_finish(&config->values);
+	free(config->path);
+	free(config);
+	server->config = NULL;
+}
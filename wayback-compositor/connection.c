@@ -0,0 +1,180 @@
+/*
+ * Client connection buffers.
+ *
+ * libwayland queues the events for a client in its connection buffer and
+ * writes them to the socket when the buffer is full, and once per event
+ * loop iteration in wl_display_run(). Once the socket's send buffer is
+ * full because the client doesn't read, the connection buffer fills up,
+ * and when that overflows the client is disconnected, which for Xwayland
+ * ends the whole session.
+ *
+ * Buffers of Xwayland and Xwayback are sized with
+ * WAYBACK_CLIENT_BUFFER_SIZE (libwayland 1.23 and later). With connection
+ * stats on (WAYBACK_CONNECTION_STATS or the control socket), a protocol
+ * logger counts the bytes of events queued for them, and every quarter of
+ * a connection buffer's worth the unread bytes in the socket are sampled,
+ * so that a client falling behind shows up in the stats before it turns
+ * into a disconnect. Like the protocol profiler, the logger is only
+ * registered while the stats are on, so they cost nothing otherwise.
+ *
+ * Flushes are deliberately not counted. libwayland decides when to flush,
+ * and how often it did says nothing about whether a client keeps up; the
+ * unread bytes in its socket do.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "wayback-compositor.h"
+#include "wayback_log.h"
+#include "wayback_metrics.h"
+
+#include <linux/sockios.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <wayland-server-core.h>
+
+/* Fixed buffer size of libwayland before 1.23, and its default since */
+#define CONNECTION_BUFFER_DEFAULT 4096
+#ifdef WAYBACK_HAVE_CLIENT_BUFFER_SIZE
+/* Enough for a few frames of a busy input flood */
+#define CONNECTION_BUFFER_SIZE 65536
+#else
+#define CONNECTION_BUFFER_SIZE CONNECTION_BUFFER_DEFAULT
+#endif
+
+static size_t connection_buffer_size(void)
+{
+	const char *env = getenv("WAYBACK_CLIENT_BUFFER_SIZE");
+	if (env == NULL)
+		return CONNECTION_BUFFER_SIZE;
+
+#ifdef WAYBACK_HAVE_CLIENT_BUFFER_SIZE
+	unsigned long size = strtoul(env, NULL, 10);
+	if (size < CONNECTION_BUFFER_DEFAULT) {
+		wayback_log(LOG_WARN,
+		            "Client buffer size %lu is too small, using %d",
+		            size,
+		            CONNECTION_BUFFER_DEFAULT);
+		size = CONNECTION_BUFFER_DEFAULT;
+	}
+	return size;
+#else
+	wayback_log(LOG_WARN, "libwayland is too old to change client buffer sizes");
+	return CONNECTION_BUFFER_SIZE;
+#endif
+}
+
+/*
+ * Samples how much of the socket's send buffer the client left unread.
+ * Past 3/4 of it, libwayland is about to keep events in its own buffer.
+ */
+static void connection_sample(struct wayback_client *client)
+{
+	int fd = wl_client_get_fd(client->client);
+	int unread, sndbuf;
+	socklen_t len = sizeof(sndbuf);
+	if (ioctl(fd, SIOCOUTQ, &unread) < 0 ||
+	    getsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, &len) < 0)
+		return;
+
+	struct tinywl_server *server = client->server;
+	if ((uint32_t)unread > client->max_backlog) {
+		client->max_backlog = unread;
+		struct wayback_metrics_page *page = server->metrics;
+		if ((uint64_t)unread > page->client_backlog_max) {
+			wayback_metrics_begin(page);
+			page->client_backlog_max = unread;
+			wayback_metrics_end(page);
+		}
+	}
+	client->socket_size = sndbuf;
+	if (unread >= sndbuf / 4 * 3) {
+		client->near_overflows++;
+		WAYBACK_METRICS_ADD(server->metrics, client_near_overflows, 1);
+		wayback_log(LOG_DEBUG,
+		            "%s left %d of %d socket bytes unread",
+		            client->name,
+		            unread,
+		            sndbuf);
+	}
+}
+
+static void connection_log_message(void *user_data,
+                                   enum wl_protocol_logger_type direction,
+                                   const struct wl_protocol_logger_message *message)
+{
+	struct tinywl_server *server = user_data;
+
+	if (direction != WL_PROTOCOL_LOGGER_EVENT)
+		return;
+
+	struct wl_client *wl_client = wl_resource_get_client(message->resource);
+	struct wayback_client *client;
+	wl_list_for_each(client, &server->clients, link)
+	{
+		if (client->client != wl_client)
+			continue;
+		uint32_t size = protocol_message_size(message);
+		client->bytes_queued += size;
+		client->unsampled += size;
+		WAYBACK_METRICS_ADD(server->metrics, client_bytes_queued, size);
+		if (client->unsampled >= server->client_buffer_size / 4) {
+			client->unsampled = 0;
+			connection_sample(client);
+		}
+		return;
+	}
+}
+
+void connection_add(struct tinywl_server *server,
+                    struct wayback_client *client,
+                    struct wl_client *wl_client,
+                    const char *name)
+{
+	if (server->client_buffer_size == 0) {
+		server->client_buffer_size = connection_buffer_size();
+		if (getenv("WAYBACK_CONNECTION_STATS") != NULL && !connection_stats_enable(server))
+			wayback_log(LOG_WARN, "Unable to count queued client events");
+	}
+
+	client->server = server;
+	client->client = wl_client;
+	client->name = name;
+#ifdef WAYBACK_HAVE_CLIENT_BUFFER_SIZE
+	wl_client_set_max_buffer_size(wl_client, server->client_buffer_size);
+#endif
+	wl_list_insert(server->clients.prev, &client->link);
+}
+
+void connection_remove(struct wayback_client *client)
+{
+	wl_list_remove(&client->link);
+	wl_list_init(&client->link);
+	client->client = NULL;
+}
+
+bool connection_stats_enable(struct tinywl_server *server)
+{
+	if (server->client_logger == NULL)
+		server->client_logger =
+			wl_display_add_protocol_logger(server->wl_display, connection_log_message, server);
+	return server->client_logger != NULL;
+}
+
+void connection_stats_disable(struct tinywl_server *server)
+{
+	if (server->client_logger != NULL)
+		wl_protocol_logger_destroy(server->client_logger);
+	server->client_logger = NULL;
+}
+
+bool connection_stats_enabled(struct tinywl_server *server)
+{
+	return server->client_logger != NULL;
+}
+
+void connection_destroy(struct tinywl_server *server)
+{
+	connection_stats_disable(server);
+}
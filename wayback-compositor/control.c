@@ -0,0 +1,547 @@
+/*
+ * Runtime control socket for wayback-compositor, used by wayback-ctl(1)
+ * to query statistics and adjust settings without restarting the session.
+ *
+ * Each connection carries a single newline-terminated command. The reply
+ * starts with "ok" or "error: <reason>", followed by free-form text, and
+ * the compositor closes the connection once it has been written.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "utils.h"
+#include "wayback-compositor.h"
+#include "wayback_control.h"
+#include "wayback_log.h"
+#include "wayback_mem.h"
+#include "wayback_metrics.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <wayland-server-core.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/util/log.h>
+
+#define CONTROL_MAX_CONNECTIONS 4
+
+struct control_connection
+{
+	struct wl_list link;
+	struct wayback_control *control;
+	int fd;
+	struct wl_event_source *source;
+	char buf[WAYBACK_CONTROL_MAX_REQUEST];
+	size_t len;
+};
+
+struct wayback_control
+{
+	struct tinywl_server *server;
+	int fd;
+	char *path;
+	struct wl_event_source *source;
+	struct wl_list connections;
+};
+
+typedef void (*control_command_func_t)(struct tinywl_server *server,
+                                       char *args[],
+                                       int nargs,
+                                       FILE *reply);
+
+struct control_command
+{
+	const char *name;
+	const char *usage;
+	control_command_func_t func;
+};
+
+static const struct
+{
+	const char *name;
+	enum wayback_log_level wayback;
+	enum wlr_log_importance wlr;
+} log_levels[] = {
+	{ "error", LOG_ERROR, WLR_ERROR },
+	{ "warn", LOG_WARN, WLR_ERROR },
+	{ "info", LOG_INFO, WLR_INFO },
+	{ "debug", LOG_DEBUG, WLR_DEBUG },
+};
+
+void control_dump_stats(struct tinywl_server *server, FILE *reply)
+{
+	uint32_t now = get_time_msec();
+
+	struct tinywl_output *output;
+	wl_list_for_each(output, &server->outputs, link)
+	{
+		struct wlr_output *wlr_output = output->wlr_output;
+		fprintf(reply,
+		        "output %s: %dx%d@%.3fHz scale %.2f %s%s, %.1f fps, %" PRIu64 " frames%s\n",
+		        wlr_output->name,
+		        wlr_output->width,
+		        wlr_output->height,
+		        wlr_output->refresh / 1000.0,
+		        wlr_output->scale,
+		        wlr_output->enabled ? "enabled" : "disabled",
+		        output->kept_mode ? " (kept active mode)" : "",
+		        wayback_rate_get(&output->frame_rate, now),
+		        output->frame_rate.total,
+		        !output->nested       ? ""
+		        : output->passthrough ? ", nested passthrough"
+		                              : ", nested composited");
+		fprintf(reply,
+		        "  frame policy %s, render %u us, margin %u us, %" PRIu64 " missed\n",
+		        frame_policy_name(output->schedule.policy),
+		        frame_scheduler_predict_usec(output),
+		        output->schedule.margin_usec,
+		        output->schedule.missed);
+	}
+
+	const struct wayback_metrics_page *metrics = server->metrics;
+	fprintf(reply,
+	        "frames: %" PRIu64 " committed, %" PRIu64 " skipped, %" PRIu64 " scanout\n",
+	        metrics->frames_committed,
+	        metrics->frames_skipped,
+	        metrics->scanout_frames);
+	fprintf(reply,
+	        "input: %.1f events/s, %" PRIu64 " events\n",
+	        wayback_rate_get(&server->input_rate, now),
+	        server->input_rate.total);
+	touch_dump_stats(server, reply);
+	damage_dump_stats(server, reply);
+	fprintf(reply,
+	        "clients: %d\n",
+	        wl_list_length(wl_display_get_client_list(server->wl_display)));
+	fprintf(reply, "connection stats: %s\n", connection_stats_enabled(server) ? "on" : "off");
+	struct wayback_client *client;
+	wl_list_for_each(client, &server->clients, link)
+	{
+		if (!connection_stats_enabled(server))
+			break;
+		fprintf(reply,
+		        "  %s: %" PRIu64 " bytes queued, at most %u of %u socket bytes unread, %" PRIu64
+		        " near overflow, buffer %zu\n",
+		        client->name,
+		        client->bytes_queued,
+		        client->max_backlog,
+		        client->socket_size,
+		        client->near_overflows,
+		        server->client_buffer_size);
+	}
+	fprintf(reply, "trace: %s\n", server->trace ? "on" : "off");
+	fprintf(reply, "protocol profiler: %s\n", profiler_is_enabled(server) ? "on" : "off");
+}
+
+static void command_stats(struct tinywl_server *server, char *args[], int nargs, FILE *reply)
+{
+	fprintf(reply, "ok\n");
+	control_dump_stats(server, reply);
+}
+
+static void command_log_level(struct tinywl_server *server, char *args[], int nargs, FILE *reply)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(log_levels); i++) {
+		if (strcmp(args[0], log_levels[i].name) == 0) {
+			if (log_levels[i].wayback > WAYBACK_LOG_MAX_LEVEL) {
+				fprintf(reply, "error: %s messages are not compiled in\n", args[0]);
+				return;
+			}
+			wayback_log_verbosity(log_levels[i].wayback);
+			wlr_log_init(log_levels[i].wlr, NULL);
+			wayback_log(LOG_INFO, "Log level set to %s", log_levels[i].name);
+			fprintf(reply, "ok\n");
+			return;
+		}
+	}
+	fprintf(reply, "error: unknown log level %s\n", args[0]);
+}
+
+static struct tinywl_output *find_output(struct tinywl_server *server, const char *name)
+{
+	struct tinywl_output *output;
+	wl_list_for_each(output, &server->outputs, link)
+	{
+		if (strcmp(output->wlr_output->name, name) == 0)
+			return output;
+	}
+	return NULL;
+}
+
+static void command_output_mode(struct tinywl_server *server, char *args[], int nargs, FILE *reply)
+{
+	struct tinywl_output *found = find_output(server, args[0]);
+	if (found == NULL) {
+		fprintf(reply, "error: no output named %s\n", args[0]);
+		return;
+	}
+
+	int width, height;
+	float refresh = 0;
+	if (sscanf(args[1], "%dx%d@%f", &width, &height, &refresh) < 2 || width <= 0 || height <= 0) {
+		fprintf(reply, "error: invalid mode %s, expected <width>x<height>[@<Hz>]\n", args[1]);
+		return;
+	}
+
+	if (!output_set_mode(found, width, height, (int32_t)(refresh * 1000))) {
+		fprintf(reply, "error: failed to set mode %s on %s\n", args[1], args[0]);
+		return;
+	}
+
+	wayback_log(LOG_INFO, "Output %s switched to %s", args[0], args[1]);
+	fprintf(reply, "ok\n");
+}
+
+static void command_frame_policy(struct tinywl_server *server,
+                                 char *args[],
+                                 int nargs,
+                                 FILE *reply)
+{
+	struct tinywl_output *output = find_output(server, args[0]);
+	if (output == NULL) {
+		fprintf(reply, "error: no output named %s\n", args[0]);
+		return;
+	}
+	if (!frame_policy_from_name(args[1], &output->schedule.policy)) {
+		fprintf(reply, "error: expected immediate or deadline\n");
+		return;
+	}
+	wayback_log(LOG_INFO, "Output %s uses the %s frame policy", args[0], args[1]);
+	fprintf(reply, "ok\n");
+}
+
+static void command_trace(struct tinywl_server *server, char *args[], int nargs, FILE *reply)
+{
+	if (strcmp(args[0], "on") == 0) {
+		server->trace = true;
+	} else if (strcmp(args[0], "off") == 0) {
+		server->trace = false;
+	} else {
+		fprintf(reply, "error: expected on or off\n");
+		return;
+	}
+	wayback_log(LOG_INFO, "Tracing %s", server->trace ? "enabled" : "disabled");
+	fprintf(reply, "ok\n");
+}
+
+static void command_damage_coalesce(struct tinywl_server *server,
+                                    char *args[],
+                                    int nargs,
+                                    FILE *reply)
+{
+	if (strcmp(args[0], "on") == 0) {
+		server->damage_policy.enabled = true;
+	} else if (strcmp(args[0], "off") == 0) {
+		server->damage_policy.enabled = false;
+	} else {
+		fprintf(reply, "error: expected on or off\n");
+		return;
+	}
+	wayback_log(LOG_INFO,
+	            "Damage coalescing %s",
+	            server->damage_policy.enabled ? "enabled" : "disabled");
+	fprintf(reply, "ok\n");
+}
+
+static void command_protocol_profile(struct tinywl_server *server,
+                                     char *args[],
+                                     int nargs,
+                                     FILE *reply)
+{
+	if (strcmp(args[0], "on") == 0) {
+		/* Keeps the summary interval of WAYBACK_PROTOCOL_PROFILE */
+		if (!profiler_enable(server, profiler_interval(server))) {
+			fprintf(reply, "error: failed to enable protocol profiler\n");
+			return;
+		}
+	} else if (strcmp(args[0], "off") == 0) {
+		profiler_disable(server);
+	} else if (strcmp(args[0], "reset") == 0) {
+		profiler_reset(server);
+	} else {
+		fprintf(reply, "error: expected on, off or reset\n");
+		return;
+	}
+	fprintf(reply, "ok\n");
+}
+
+static void command_connection_stats(struct tinywl_server *server,
+                                     char *args[],
+                                     int nargs,
+                                     FILE *reply)
+{
+	if (strcmp(args[0], "on") == 0) {
+		if (!connection_stats_enable(server)) {
+			fprintf(reply, "error: failed to enable connection stats\n");
+			return;
+		}
+	} else if (strcmp(args[0], "off") == 0) {
+		connection_stats_disable(server);
+	} else {
+		fprintf(reply, "error: expected on or off\n");
+		return;
+	}
+	fprintf(reply, "ok\n");
+}
+
+static void command_protocol_stats(struct tinywl_server *server,
+                                   char *args[],
+                                   int nargs,
+                                   FILE *reply)
+{
+	fprintf(reply, "ok\n");
+	profiler_dump(server, reply);
+}
+
+static void command_memory(struct tinywl_server *server, char *args[], int nargs, FILE *reply)
+{
+	fprintf(reply, "ok\n");
+	wayback_mem_report(reply);
+	render_buffers_report(reply);
+}
+
+static void command_help(struct tinywl_server *server, char *args[], int nargs, FILE *reply);
+
+static const struct control_command commands[] = {
+	{ "stats", "", command_stats },
+	{ "log-level", "error|warn|info|debug", command_log_level },
+	{ "output-mode", "<output> <width>x<height>[@<Hz>]", command_output_mode },
+	{ "frame-policy", "<output> immediate|deadline", command_frame_policy },
+	{ "trace", "on|off", command_trace },
+	{ "damage-coalesce", "on|off", command_damage_coalesce },
+	{ "connection-stats", "on|off", command_connection_stats },
+	{ "protocol-profile", "on|off|reset", command_protocol_profile },
+	{ "protocol-stats", "", command_protocol_stats },
+	{ "memory", "", command_memory },
+	{ "help", "", command_help },
+};
+
+/* Number of arguments a command expects, derived from its usage string. */
+static int command_nargs(const struct control_command *command)
+{
+	int nargs = 0;
+	for (const char *c = command->usage; *c != '\0'; c++) {
+		if (c == command->usage || c[-1] == ' ')
+			nargs++;
+	}
+	return nargs;
+}
+
+static void command_help(struct tinywl_server *server, char *args[], int nargs, FILE *reply)
+{
+	fprintf(reply, "ok\n");
+	for (size_t i = 0; i < ARRAY_SIZE(commands); i++)
+		fprintf(reply, "%s %s\n", commands[i].name, commands[i].usage);
+}
+
+static void control_dispatch(struct tinywl_server *server, char *line, FILE *reply)
+{
+	char *args[8];
+	int nargs = 0;
+	char *saveptr = NULL;
+	for (char *tok = strtok_r(line, " \t\r", &saveptr); tok != NULL && nargs < (int)ARRAY_SIZE(args);
+	     tok = strtok_r(NULL, " \t\r", &saveptr))
+		args[nargs++] = tok;
+
+	if (nargs == 0) {
+		fprintf(reply, "error: empty command\n");
+		return;
+	}
+
+	for (size_t i = 0; i < ARRAY_SIZE(commands); i++) {
+		if (strcmp(args[0], commands[i].name) != 0)
+			continue;
+		if (nargs - 1 != command_nargs(&commands[i])) {
+			fprintf(reply, "error: usage: %s %s\n", commands[i].name, commands[i].usage);
+			return;
+		}
+		wayback_log(LOG_DEBUG, "Control command: %s", args[0]);
+		commands[i].func(server, &args[1], nargs - 1, reply);
+		return;
+	}
+	fprintf(reply, "error: unknown command %s\n", args[0]);
+}
+
+static void control_connection_destroy(struct control_connection *conn)
+{
+	wl_event_source_remove(conn->source);
+	close(conn->fd);
+	wl_list_remove(&conn->link);
+	free(conn);
+}
+
+static void connection_reply(struct control_connection *conn)
+{
+	char *buf = NULL;
+	size_t size = 0;
+	FILE *reply = open_memstream(&buf, &size);
+	if (reply == NULL) {
+		wayback_log(LOG_ERROR, "Failed to allocate control reply");
+		return;
+	}
+
+	control_dispatch(conn->control->server, conn->buf, reply);
+	fclose(reply);
+
+	/* Replies are small, the socket buffer will take them in one go. */
+	size_t written = 0;
+	while (written < size) {
+		ssize_t n = write(conn->fd, buf + written, size - written);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		written += n;
+	}
+	free(buf);
+}
+
+static int connection_handle_readable(int fd, uint32_t mask, void *data)
+{
+	struct control_connection *conn = data;
+
+	if (mask & (WL_EVENT_HANGUP | WL_EVENT_ERROR)) {
+		control_connection_destroy(conn);
+		return 0;
+	}
+
+	ssize_t n = read(fd, conn->buf + conn->len, sizeof(conn->buf) - conn->len - 1);
+	if (n < 0 && (errno == EAGAIN || errno == EINTR))
+		return 0;
+	if (n <= 0) {
+		control_connection_destroy(conn);
+		return 0;
+	}
+	conn->len += n;
+	conn->buf[conn->len] = '\0';
+
+	char *newline = strchr(conn->buf, '\n');
+	if (newline == NULL && conn->len < sizeof(conn->buf) - 1)
+		return 0;
+
+	if (newline != NULL) {
+		*newline = '\0';
+		connection_reply(conn);
+	} else {
+		static const char too_long[] = "error: request too long\n";
+		if (write(fd, too_long, sizeof(too_long) - 1) < 0)
+			wayback_log(LOG_DEBUG, "Failed to reply to control client: %s", strerror(errno));
+	}
+	control_connection_destroy(conn);
+	return 0;
+}
+
+static int control_handle_connection(int fd, uint32_t mask, void *data)
+{
+	struct wayback_control *control = data;
+
+	int conn_fd = accept(fd, NULL, NULL);
+	if (conn_fd < 0) {
+		wayback_log(LOG_WARN, "Failed to accept control connection: %s", strerror(errno));
+		return 0;
+	}
+	set_cloexec(conn_fd);
+	fcntl(conn_fd, F_SETFL, fcntl(conn_fd, F_GETFL) | O_NONBLOCK);
+
+	if (wl_list_length(&control->connections) >= CONTROL_MAX_CONNECTIONS) {
+		wayback_log(LOG_WARN, "Too many control connections, dropping one");
+		close(conn_fd);
+		return 0;
+	}
+
+	struct control_connection *conn = calloc(1, sizeof(*conn));
+	if (conn == NULL) {
+		close(conn_fd);
+		return 0;
+	}
+	conn->control = control;
+	conn->fd = conn_fd;
+	conn->source =
+		wl_event_loop_add_fd(wl_display_get_event_loop(control->server->wl_display),
+	                         conn_fd,
+	                         WL_EVENT_READABLE,
+	                         connection_handle_readable,
+	                         conn);
+	wl_list_insert(&control->connections, &conn->link);
+	return 0;
+}
+
+bool control_create(struct tinywl_server *server)
+{
+	char *path = control_socket_path(getpid());
+	if (path == NULL) {
+		wayback_log(LOG_WARN, "XDG_RUNTIME_DIR is not set, cannot create control socket");
+		return false;
+	}
+
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		wayback_log(LOG_WARN, "Control socket path %s is too long", path);
+		free(path);
+		return false;
+	}
+	strcpy(addr.sun_path, path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	if (fd < 0) {
+		wayback_log(LOG_WARN, "Failed to create control socket: %s", strerror(errno));
+		free(path);
+		return false;
+	}
+
+	/* A stale socket can only be left behind by an earlier crash. */
+	unlink(path);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 4) < 0) {
+		wayback_log(LOG_WARN, "Failed to bind control socket %s: %s", path, strerror(errno));
+		close(fd);
+		free(path);
+		return false;
+	}
+
+	struct wayback_control *control = calloc(1, sizeof(*control));
+	if (control == NULL) {
+		close(fd);
+		unlink(path);
+		free(path);
+		return false;
+	}
+	control->server = server;
+	control->fd = fd;
+	control->path = path;
+	wl_list_init(&control->connections);
+	control->source = wl_event_loop_add_fd(wl_display_get_event_loop(server->wl_display),
+	                                       fd,
+	                                       WL_EVENT_READABLE,
+	                                       control_handle_connection,
+	                                       control);
+
+	server->control = control;
+	wayback_log(LOG_INFO, "Control socket listening on %s", path);
+	return true;
+}
+
+void control_destroy(struct tinywl_server *server)
+{
+	struct wayback_control *control = server->control;
+	if (control == NULL)
+		return;
+
+	struct control_connection *conn, *tmp;
+	wl_list_for_each_safe(conn, tmp, &control->connections, link)
+	{
+		control_connection_destroy(conn);
+	}
+
+	wl_event_source_remove(control->source);
+	close(control->fd);
+	unlink(control->path);
+	free(control->path);
+	free(control);
+	server->control = NULL;
+}
@@ -0,0 +1,299 @@
+/*
+ * Damage coalescing.
+ *
+ * Xwayland passes on damage as X clients draw, and a frame of text
+ * rendering easily arrives as dozens of small rectangles a few pixels
+ * apart. Every rectangle becomes a separate texture upload, scissor and
+ * render pass in the scene output, where a somewhat larger area in fewer
+ * pieces is cheaper. So with damage-coalesce turned on (it is off by
+ * default), the damage of a commit is simplified before it is applied,
+ * according to the damage policy (see wayback-config(5)):
+ *
+ * - rectangles up to merge_distance pixels apart are merged into their
+ *   bounding box,
+ * - more than max_rects rectangles, or rectangles that fill at least
+ *   fill_percent of their bounding box, become that box,
+ * - what remains is aligned to tile_size pixel tiles.
+ *
+ * Damage only ever grows, so frames stay correct, at the cost of repainting
+ * some pixels that didn't change. The stats command shows both sides: the
+ * rectangles and pixels before and after, and the render time of frames
+ * composited with and without coalescing.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "wayback-compositor.h"
+#include "wayback_log.h"
+#include "wayback_mem.h"
+#include "wayback_metrics.h"
+
+#include <inttypes.h>
+#include <pixman.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wayland-server-core.h>
+#include <wlr/types/wlr_compositor.h>
+
+struct damage_surface
+{
+	struct wl_list link;
+	struct wayback_damage *damage;
+	struct wlr_surface *surface;
+	struct wl_listener client_commit;
+	struct wl_listener destroy;
+};
+
+struct wayback_damage
+{
+	struct tinywl_server *server;
+	struct wl_listener new_surface;
+	struct wl_list surfaces;
+
+	uint64_t commits;
+	uint64_t rects_in, rects_out;
+	uint64_t pixels_in, pixels_out;
+	/* Composited frames, indexed by whether coalescing was enabled */
+	uint64_t frames[2];
+	uint64_t render_usec[2];
+};
+
+WAYBACK_POOL(damage_surface_pool, "damage surfaces", struct damage_surface);
+
+static int64_t box_area(const pixman_box32_t *box)
+{
+	return (int64_t)(box->x2 - box->x1) * (box->y2 - box->y1);
+}
+
+static int64_t boxes_area(const pixman_box32_t *boxes, int nboxes)
+{
+	int64_t area = 0;
+	for (int i = 0; i < nboxes; i++)
+		area += box_area(&boxes[i]);
+	return area;
+}
+
+static bool boxes_near(const pixman_box32_t *a, const pixman_box32_t *b, int distance)
+{
+	return a->x1 - distance <= b->x2 && b->x1 - distance <= a->x2 &&
+	       a->y1 - distance <= b->y2 && b->y1 - distance <= a->y2;
+}
+
+/* Merges boxes until none are within distance of each other, returns how many are left */
+static int merge_boxes(pixman_box32_t *boxes, int nboxes, int distance)
+{
+	bool merged = true;
+	while (merged) {
+		merged = false;
+		for (int i = 0; i < nboxes; i++) {
+			for (int j = i + 1; j < nboxes; j++) {
+				if (!boxes_near(&boxes[i], &boxes[j], distance))
+					continue;
+				boxes[i].x1 = boxes[i].x1 < boxes[j].x1 ? boxes[i].x1 : boxes[j].x1;
+				boxes[i].y1 = boxes[i].y1 < boxes[j].y1 ? boxes[i].y1 : boxes[j].y1;
+				boxes[i].x2 = boxes[i].x2 > boxes[j].x2 ? boxes[i].x2 : boxes[j].x2;
+				boxes[i].y2 = boxes[i].y2 > boxes[j].y2 ? boxes[i].y2 : boxes[j].y2;
+				boxes[j--] = boxes[--nboxes];
+				/* The grown box may now reach ones already passed */
+				merged = true;
+			}
+		}
+	}
+	return nboxes;
+}
+
+static void align_box(pixman_box32_t *box, int tile, int width, int height)
+{
+	box->x1 -= box->x1 % tile;
+	box->y1 -= box->y1 % tile;
+	box->x2 += (tile - box->x2 % tile) % tile;
+	box->y2 += (tile - box->y2 % tile) % tile;
+	/* Damage past the edge would be clipped again when applied */
+	box->x2 = box->x2 < width ? box->x2 : width;
+	box->y2 = box->y2 < height ? box->y2 : height;
+}
+
+/* Simplifies damage within a width x height area */
+static void coalesce_region(struct wayback_damage *damage,
+                            pixman_region32_t *region,
+                            int width,
+                            int height)
+{
+	const struct damage_policy *policy = &damage->server->damage_policy;
+
+	int nrects;
+	const pixman_box32_t *rects = pixman_region32_rectangles(region, &nrects);
+	if (nrects == 0)
+		return;
+	int64_t area = boxes_area(rects, nrects);
+
+	/* max_rects is at most DAMAGE_MAX_RECTS */
+	pixman_box32_t boxes[DAMAGE_MAX_RECTS];
+	int nboxes;
+	const pixman_box32_t *extents = pixman_region32_extents(region);
+	if (nrects > policy->max_rects || area * 100 >= box_area(extents) * policy->fill_percent) {
+		boxes[0] = *extents;
+		nboxes = 1;
+	} else {
+		memcpy(boxes, rects, nrects * sizeof(*boxes));
+		nboxes = policy->merge_distance > 0 ? merge_boxes(boxes, nrects, policy->merge_distance)
+		                                    : nrects;
+	}
+	if (policy->tile_size > 1) {
+		for (int i = 0; i < nboxes; i++)
+			align_box(&boxes[i], policy->tile_size, width, height);
+	}
+
+	pixman_region32_fini(region);
+	pixman_region32_init_rects(region, boxes, nboxes);
+
+	int nrects_out;
+	const pixman_box32_t *rects_out = pixman_region32_rectangles(region, &nrects_out);
+	int64_t area_out = boxes_area(rects_out, nrects_out);
+
+	damage->rects_in += nrects;
+	damage->rects_out += nrects_out;
+	damage->pixels_in += area;
+	damage->pixels_out += area_out;
+
+	struct wayback_metrics_page *page = damage->server->metrics;
+	wayback_metrics_begin(page);
+	page->damage_rects_in += nrects;
+	page->damage_rects_out += nrects_out;
+	page->damage_pixels_in += area;
+	page->damage_pixels_out += area_out;
+	wayback_metrics_end(page);
+}
+
+static void damage_surface_client_commit(struct wl_listener *listener, void *data)
+{
+	/* Called before the new state is applied, the damage is already clipped
+	 * to the new size */
+	struct damage_surface *damage_surface =
+		wl_container_of(listener, damage_surface, client_commit);
+	struct wayback_damage *damage = damage_surface->damage;
+	struct wlr_surface_state *pending = &damage_surface->surface->pending;
+
+	if (!damage->server->damage_policy.enabled)
+		return;
+
+	damage->commits++;
+	if (pending->committed & WLR_SURFACE_STATE_SURFACE_DAMAGE)
+		coalesce_region(damage, &pending->surface_damage, pending->width, pending->height);
+	if (pending->committed & WLR_SURFACE_STATE_BUFFER_DAMAGE)
+		coalesce_region(
+			damage, &pending->buffer_damage, pending->buffer_width, pending->buffer_height);
+}
+
+static void damage_surface_free(struct damage_surface *damage_surface)
+{
+	wl_list_remove(&damage_surface->link);
+	wl_list_remove(&damage_surface->client_commit.link);
+	wl_list_remove(&damage_surface->destroy.link);
+	wayback_pool_free(&damage_surface_pool, damage_surface);
+}
+
+static void damage_surface_destroy(struct wl_listener *listener, void *data)
+{
+	struct damage_surface *damage_surface = wl_container_of(listener, damage_surface, destroy);
+	damage_surface_free(damage_surface);
+}
+
+static void damage_new_surface(struct wl_listener *listener, void *data)
+{
+	struct wayback_damage *damage = wl_container_of(listener, damage, new_surface);
+	struct wlr_surface *surface = data;
+
+	struct damage_surface *damage_surface = wayback_pool_alloc(&damage_surface_pool);
+	if (damage_surface == NULL) {
+		/* Its damage is then applied as is */
+		wayback_log(LOG_ERROR, "Failed to allocate damage tracking for a surface");
+		return;
+	}
+	damage_surface->damage = damage;
+	damage_surface->surface = surface;
+	damage_surface->client_commit.notify = damage_surface_client_commit;
+	wl_signal_add(&surface->events.client_commit, &damage_surface->client_commit);
+	damage_surface->destroy.notify = damage_surface_destroy;
+	wl_signal_add(&surface->events.destroy, &damage_surface->destroy);
+	wl_list_insert(&damage->surfaces, &damage_surface->link);
+}
+
+bool damage_create(struct tinywl_server *server, struct wlr_compositor *compositor)
+{
+	struct wayback_damage *damage = calloc(1, sizeof(*damage));
+	if (damage == NULL)
+		return false;
+	damage->server = server;
+	wl_list_init(&damage->surfaces);
+	damage->new_surface.notify = damage_new_surface;
+	wl_signal_add(&compositor->events.new_surface, &damage->new_surface);
+
+	server->damage = damage;
+	return true;
+}
+
+void damage_record_frame(struct tinywl_server *server, uint64_t render_usec)
+{
+	struct wayback_damage *damage = server->damage;
+	if (damage == NULL)
+		return;
+
+	int coalesced = server->damage_policy.enabled;
+	damage->frames[coalesced]++;
+	damage->render_usec[coalesced] += render_usec;
+}
+
+void damage_dump_stats(struct tinywl_server *server, FILE *out)
+{
+	const struct damage_policy *policy = &server->damage_policy;
+	fprintf(out, "damage coalescing %s", policy->enabled ? "on" : "off");
+	if (policy->enabled)
+		fprintf(out,
+		        ", merge within %d px, box past %d rects or %d%% filled, %d px tiles",
+		        policy->merge_distance,
+		        policy->max_rects,
+		        policy->fill_percent,
+		        policy->tile_size);
+	fprintf(out, "\n");
+
+	struct wayback_damage *damage = server->damage;
+	if (damage == NULL)
+		return;
+	if (damage->commits > 0)
+		fprintf(out,
+		        "  %" PRIu64 " commits, %" PRIu64 " rects in, %" PRIu64
+		        " out, %.1f%% more pixels\n",
+		        damage->commits,
+		        damage->rects_in,
+		        damage->rects_out,
+		        damage->pixels_in > 0
+		            ? 100.0 * (damage->pixels_out - damage->pixels_in) / damage->pixels_in
+		            : 0.0);
+	for (int coalesced = 1; coalesced >= 0; coalesced--) {
+		if (damage->frames[coalesced] > 0)
+			fprintf(out,
+			        "  render %.0f us average over %" PRIu64 " frames %s coalescing\n",
+			        (double)damage->render_usec[coalesced] / damage->frames[coalesced],
+			        damage->frames[coalesced],
+			        coalesced ? "with" : "without");
+	}
+}
+
+void damage_destroy(struct tinywl_server *server)
+{
+	struct wayback_damage *damage = server->damage;
+	if (damage == NULL)
+		return;
+
+	/* Surfaces normally went away with their clients already */
+	struct damage_surface *damage_surface, *tmp;
+	wl_list_for_each_safe(damage_surface, tmp, &damage->surfaces, link)
+	{
+		damage_surface_free(damage_surface);
+	}
+	wl_list_remove(&damage->new_surface.link);
+	free(damage);
+	server->damage = NULL;
+}
@@ -0,0 +1,211 @@
+/*
+ * Deadline based frame scheduling.
+ *
+ * Compositing right when the output signals a frame leaves Xwayland almost
+ * a full refresh cycle between drawing and its buffer reaching the screen.
+ * With the deadline policy, Xwayland gets its frame callbacks right away
+ * and compositing is delayed until shortly before the next vblank, which is
+ * predicted from the last presentation time plus the refresh period, using
+ * the slowest of the recent render times plus a safety margin. The margin
+ * doubles whenever a frame misses the vblank and slowly shrinks back while
+ * frames make it in time.
+ *
+ * Frame events only line up with vblank while frames are being presented
+ * back to back. When the output has been idle, e.g. for the first repaint
+ * after an input event, no page flip is in flight and the frame is
+ * composited right away instead of being held for a made-up vblank.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "utils.h"
+#include "wayback-compositor.h"
+#include "wayback_log.h"
+
+#include <string.h>
+#include <time.h>
+#include <wayland-server-core.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/types/wlr_scene.h>
+
+#define FRAME_MARGIN_MIN_USEC 1000
+/* Consecutive frames on time before the margin is halved again */
+#define FRAME_MARGIN_DECAY_FRAMES 120
+
+static const char *const frame_policy_names[] = {
+	[FRAME_POLICY_IMMEDIATE] = "immediate",
+	[FRAME_POLICY_DEADLINE] = "deadline",
+};
+
+const char *frame_policy_name(enum frame_policy policy)
+{
+	return frame_policy_names[policy];
+}
+
+bool frame_policy_from_name(const char *name, enum frame_policy *policy)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(frame_policy_names); i++) {
+		if (strcmp(frame_policy_names[i], name) == 0) {
+			*policy = i;
+			return true;
+		}
+	}
+	return false;
+}
+
+static int64_t timespec_diff_usec(const struct timespec *a, const struct timespec *b)
+{
+	return (a->tv_sec - b->tv_sec) * 1000000 + (a->tv_nsec - b->tv_nsec) / 1000;
+}
+
+static void timespec_add_usec(struct timespec *ts, int64_t usec)
+{
+	ts->tv_sec += usec / 1000000;
+	ts->tv_nsec += (usec % 1000000) * 1000;
+	if (ts->tv_nsec >= 1000000000) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000;
+	}
+}
+
+static uint32_t output_period_usec(const struct tinywl_output *output)
+{
+	if (output->schedule.present_period_usec != 0)
+		return output->schedule.present_period_usec;
+	/* Nested outputs and some virtual ones don't have a refresh rate */
+	int32_t refresh = output->wlr_output->refresh;
+	return refresh > 0 ? 1000000000 / refresh : 0;
+}
+
+/* The slowest recent frame, to stay clear of occasional spikes. */
+uint32_t frame_scheduler_predict_usec(const struct tinywl_output *output)
+{
+	const struct frame_scheduler *schedule = &output->schedule;
+	uint32_t predicted = 0;
+	for (size_t i = 0; i < FRAME_RENDER_SAMPLES; i++) {
+		if (schedule->render_usec[i] > predicted)
+			predicted = schedule->render_usec[i];
+	}
+	return predicted;
+}
+
+static int frame_scheduler_handle_timer(void *data)
+{
+	struct tinywl_output *output = data;
+	struct timespec now;
+
+	output->schedule.pending = false;
+	output_render(output, &now);
+	return 0;
+}
+
+static void frame_scheduler_handle_present(struct wl_listener *listener, void *data)
+{
+	struct frame_scheduler *schedule = wl_container_of(listener, schedule, present);
+	const struct wlr_output_event_present *event = data;
+
+	if (!event->presented || (event->when.tv_sec == 0 && event->when.tv_nsec == 0))
+		return;
+	schedule->last_present = event->when;
+	schedule->present_period_usec = event->refresh > 0 ? event->refresh / 1000 : 0;
+}
+
+void frame_scheduler_init(struct tinywl_output *output)
+{
+	struct frame_scheduler *schedule = &output->schedule;
+	struct wl_event_loop *loop = wl_display_get_event_loop(output->server->wl_display);
+
+	schedule->policy = output->server->frame_policy;
+	schedule->margin_usec = 2 * FRAME_MARGIN_MIN_USEC;
+	schedule->timer = wl_event_loop_add_timer(loop, frame_scheduler_handle_timer, output);
+	schedule->present.notify = frame_scheduler_handle_present;
+	wl_signal_add(&output->wlr_output->events.present, &schedule->present);
+	if (schedule->timer == NULL) {
+		wayback_log(LOG_WARN,
+		            "%s: no frame timer, compositing immediately",
+		            output->wlr_output->name);
+		schedule->policy = FRAME_POLICY_IMMEDIATE;
+	}
+}
+
+void frame_scheduler_finish(struct tinywl_output *output)
+{
+	if (output->schedule.timer != NULL)
+		wl_event_source_remove(output->schedule.timer);
+	output->schedule.timer = NULL;
+	wl_list_remove(&output->schedule.present.link);
+}
+
+void frame_scheduler_handle_frame(struct tinywl_output *output)
+{
+	struct frame_scheduler *schedule = &output->schedule;
+	struct wlr_scene_output *scene_output =
+		wlr_scene_get_scene_output(output->server->scene, output->wlr_output);
+
+	/* Damage schedules another frame event while we are still waiting for
+	 * the deadline, the pending composite will pick it up. */
+	if (schedule->pending)
+		return;
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	/* The vblank after the last presented one. If that one is a period or
+	 * more ago, the output went idle and nothing is waiting for a flip. */
+	int64_t delay_usec = 0;
+	uint32_t period_usec = output_period_usec(output);
+	schedule->has_deadline = false;
+	if (schedule->policy == FRAME_POLICY_DEADLINE && period_usec != 0 &&
+	    schedule->timer != NULL && schedule->last_present.tv_sec != 0 &&
+	    timespec_diff_usec(&now, &schedule->last_present) < period_usec) {
+		schedule->deadline = schedule->last_present;
+		timespec_add_usec(&schedule->deadline, period_usec);
+		schedule->has_deadline = true;
+		delay_usec = timespec_diff_usec(&schedule->deadline, &now) -
+		             frame_scheduler_predict_usec(output) - schedule->margin_usec;
+	}
+
+	/* Timers have millisecond resolution, not worth it below that */
+	if (delay_usec < 1000) {
+		output_render(output, &now);
+		wlr_scene_output_send_frame_done(scene_output, &now);
+		return;
+	}
+
+	/* Let Xwayland draw while we wait, so its next buffer makes it into
+	 * this frame rather than the one after. */
+	wlr_scene_output_send_frame_done(scene_output, &now);
+	schedule->pending = true;
+	wl_event_source_timer_update(schedule->timer, delay_usec / 1000);
+}
+
+void frame_scheduler_record(struct tinywl_output *output,
+                            const struct timespec *start,
+                            const struct timespec *end)
+{
+	struct frame_scheduler *schedule = &output->schedule;
+
+	schedule->render_usec[schedule->render_index++ % FRAME_RENDER_SAMPLES] =
+		timespec_diff_usec(end, start);
+
+	uint32_t period_usec = output_period_usec(output);
+	if (schedule->policy != FRAME_POLICY_DEADLINE || !schedule->has_deadline)
+		return;
+
+	if (timespec_diff_usec(end, &schedule->deadline) > 0) {
+		schedule->missed++;
+		schedule->good_frames = 0;
+		schedule->margin_usec *= 2;
+		if (schedule->margin_usec > period_usec / 2)
+			schedule->margin_usec = period_usec / 2;
+		wayback_log(LOG_DEBUG,
+		            "%s: missed frame deadline, margin now %u us",
+		            output->wlr_output->name,
+		            schedule->margin_usec);
+	} else if (++schedule->good_frames >= FRAME_MARGIN_DECAY_FRAMES) {
+		schedule->good_frames = 0;
+		schedule->margin_usec /= 2;
+		if (schedule->margin_usec < FRAME_MARGIN_MIN_USEC)
+			schedule->margin_usec = FRAME_MARGIN_MIN_USEC;
+	}
+}
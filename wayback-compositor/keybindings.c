@@ -0,0 +1,347 @@
+/*
+ * Compositor keybindings.
+ *
+ * Bindings are given as a comma separated list of
+ * "<modifier>+...+<keysym>=<action>[:<argument>]" entries, applied on top
+ * of the defaults, e.g. "ctrl+alt+t=trace,ctrl+alt+BackSpace=none". They
+ * are compiled into a table sorted by modifier mask and keysym.
+ *
+ * A binding only matches with exactly its modifiers held (lock modifiers
+ * aside), so ctrl+alt+shift+BackSpace is not ctrl+alt+BackSpace. Keys
+ * pressed with a modifier combination that no binding uses are passed on
+ * without looking up their keysyms, which covers ordinary typing.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "utils.h"
+#include "wayback-compositor.h"
+#include "wayback_log.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <wayland-server-core.h>
+#include <wlr/backend/multi.h>
+#include <wlr/backend/session.h>
+#include <wlr/types/wlr_keyboard.h>
+#include <xkbcommon/xkbcommon.h>
+
+/* Lock modifiers such as Caps Lock and Num Lock never affect bindings */
+#define KEYBINDING_MODIFIERS \
+	(WLR_MODIFIER_SHIFT | WLR_MODIFIER_CTRL | WLR_MODIFIER_ALT | WLR_MODIFIER_LOGO)
+
+enum keybinding_action
+{
+	ACTION_NONE,
+	ACTION_TERMINATE,
+	ACTION_SWITCH_VT,
+	ACTION_TOGGLE_TRACE,
+	ACTION_DUMP_STATS,
+	ACTION_FRAME_POLICY,
+};
+
+static const struct
+{
+	const char *name;
+	enum keybinding_action action;
+	bool has_arg;
+	/* Range of the argument */
+	int min_arg, max_arg;
+} actions[] = {
+	{ "none", ACTION_NONE, false, 0, 0 },
+	{ "terminate", ACTION_TERMINATE, false, 0, 0 },
+	{ "vt", ACTION_SWITCH_VT, true, 1, 12 },
+	{ "trace", ACTION_TOGGLE_TRACE, false, 0, 0 },
+	{ "stats", ACTION_DUMP_STATS, false, 0, 0 },
+	{ "frame-policy", ACTION_FRAME_POLICY, false, 0, 0 },
+};
+
+static const struct
+{
+	const char *name;
+	uint32_t mask;
+} modifier_names[] = {
+	{ "shift", WLR_MODIFIER_SHIFT }, { "ctrl", WLR_MODIFIER_CTRL },
+	{ "control", WLR_MODIFIER_CTRL }, { "alt", WLR_MODIFIER_ALT },
+	{ "mod1", WLR_MODIFIER_ALT },     { "logo", WLR_MODIFIER_LOGO },
+	{ "super", WLR_MODIFIER_LOGO },   { "mod4", WLR_MODIFIER_LOGO },
+};
+
+static const char default_bindings[] = "ctrl+alt+BackSpace=terminate,"
+                                       "ctrl+alt+XF86Switch_VT_1=vt:1,"
+                                       "ctrl+alt+XF86Switch_VT_2=vt:2,"
+                                       "ctrl+alt+XF86Switch_VT_3=vt:3,"
+                                       "ctrl+alt+XF86Switch_VT_4=vt:4,"
+                                       "ctrl+alt+XF86Switch_VT_5=vt:5,"
+                                       "ctrl+alt+XF86Switch_VT_6=vt:6,"
+                                       "ctrl+alt+XF86Switch_VT_7=vt:7,"
+                                       "ctrl+alt+XF86Switch_VT_8=vt:8,"
+                                       "ctrl+alt+XF86Switch_VT_9=vt:9,"
+                                       "ctrl+alt+XF86Switch_VT_10=vt:10,"
+                                       "ctrl+alt+XF86Switch_VT_11=vt:11,"
+                                       "ctrl+alt+XF86Switch_VT_12=vt:12";
+
+struct keybinding
+{
+	uint32_t modifiers;
+	xkb_keysym_t sym;
+	enum keybinding_action action;
+	int arg;
+};
+
+struct wayback_keybindings
+{
+	struct keybinding *bindings;
+	size_t count;
+	size_t capacity;
+	/* Indexed by modifier mask, whether any binding uses that mask */
+	bool mask_used[KEYBINDING_MODIFIERS + 1];
+};
+
+static int keybinding_compare(const void *a, const void *b)
+{
+	const struct keybinding *ka = a, *kb = b;
+
+	if (ka->modifiers != kb->modifiers)
+		return ka->modifiers < kb->modifiers ? -1 : 1;
+	if (ka->sym != kb->sym)
+		return ka->sym < kb->sym ? -1 : 1;
+	return 0;
+}
+
+static bool keybindings_add(struct wayback_keybindings *table, const struct keybinding *binding)
+{
+	/* Later entries replace earlier ones, so users can override defaults */
+	for (size_t i = 0; i < table->count; i++) {
+		if (keybinding_compare(&table->bindings[i], binding) == 0) {
+			table->bindings[i] = *binding;
+			return true;
+		}
+	}
+
+	if (table->count == table->capacity) {
+		size_t capacity = table->capacity ? table->capacity * 2 : 16;
+		struct keybinding *bindings =
+			realloc(table->bindings, capacity * sizeof(*table->bindings));
+		if (bindings == NULL)
+			return false;
+		table->bindings = bindings;
+		table->capacity = capacity;
+	}
+	table->bindings[table->count++] = *binding;
+	return true;
+}
+
+static bool keybinding_parse(const char *entry, struct keybinding *binding)
+{
+	const char *equals = strchr(entry, '=');
+	if (equals == NULL || equals == entry) {
+		wayback_log(LOG_ERROR, "Keybinding '%s' lacks an action", entry);
+		return false;
+	}
+
+	*binding = (struct keybinding){ 0 };
+	const char *start = entry;
+	for (;;) {
+		const char *plus = memchr(start, '+', equals - start);
+		if (plus == NULL) {
+			char name[64];
+			snprintf(name, sizeof(name), "%.*s", (int)(equals - start), start);
+			binding->sym = xkb_keysym_from_name(name, XKB_KEYSYM_NO_FLAGS);
+			if (binding->sym == XKB_KEY_NoSymbol)
+				binding->sym = xkb_keysym_from_name(name, XKB_KEYSYM_CASE_INSENSITIVE);
+			if (binding->sym == XKB_KEY_NoSymbol) {
+				wayback_log(LOG_ERROR, "Unknown key '%s' in keybinding '%s'", name, entry);
+				return false;
+			}
+			break;
+		}
+
+		size_t i = 0;
+		for (; i < ARRAY_SIZE(modifier_names); i++) {
+			if (strlen(modifier_names[i].name) == (size_t)(plus - start) &&
+			    strncasecmp(modifier_names[i].name, start, plus - start) == 0)
+				break;
+		}
+		if (i == ARRAY_SIZE(modifier_names)) {
+			wayback_log(LOG_ERROR,
+			            "Unknown modifier '%.*s' in keybinding '%s'",
+			            (int)(plus - start),
+			            start,
+			            entry);
+			return false;
+		}
+		binding->modifiers |= modifier_names[i].mask;
+		start = plus + 1;
+	}
+
+	const char *action = equals + 1;
+	const char *colon = strchr(action, ':');
+	size_t action_len = colon != NULL ? (size_t)(colon - action) : strlen(action);
+	for (size_t i = 0; i < ARRAY_SIZE(actions); i++) {
+		if (strlen(actions[i].name) != action_len ||
+		    strncmp(actions[i].name, action, action_len) != 0)
+			continue;
+		if (actions[i].has_arg != (colon != NULL)) {
+			wayback_log(LOG_ERROR,
+			            "Action '%s' %s an argument in keybinding '%s'",
+			            actions[i].name,
+			            actions[i].has_arg ? "requires" : "takes no",
+			            entry);
+			return false;
+		}
+		binding->action = actions[i].action;
+		if (colon != NULL) {
+			char *end;
+			errno = 0;
+			long arg = strtol(colon + 1, &end, 10);
+			if (errno || end == colon + 1 || *end != '\0' || arg < actions[i].min_arg ||
+			    arg > actions[i].max_arg) {
+				wayback_log(LOG_ERROR,
+				            "Action '%s' takes a number from %d to %d in keybinding '%s'",
+				            actions[i].name,
+				            actions[i].min_arg,
+				            actions[i].max_arg,
+				            entry);
+				return false;
+			}
+			binding->arg = arg;
+		}
+		return true;
+	}
+
+	wayback_log(LOG_ERROR, "Unknown action in keybinding '%s'", entry);
+	return false;
+}
+
+static bool keybindings_parse(struct wayback_keybindings *table, const char *spec)
+{
+	char *copy = strdup(spec);
+	if (copy == NULL)
+		return false;
+
+	bool ok = true;
+	char *saveptr = NULL;
+	for (char *entry = strtok_r(copy, ", \t\n", &saveptr); entry != NULL;
+	     entry = strtok_r(NULL, ", \t\n", &saveptr)) {
+		struct keybinding binding;
+		if (!keybinding_parse(entry, &binding) || !keybindings_add(table, &binding)) {
+			ok = false;
+			break;
+		}
+	}
+	free(copy);
+	return ok;
+}
+
+static void keybindings_free(struct wayback_keybindings *table)
+{
+	if (table == NULL)
+		return;
+	free(table->bindings);
+	free(table);
+}
+
+bool keybindings_load(struct tinywl_server *server, const char *spec)
+{
+	struct wayback_keybindings *table = calloc(1, sizeof(*table));
+	if (table == NULL)
+		return false;
+
+	if (!keybindings_parse(table, default_bindings) ||
+	    (spec != NULL && !keybindings_parse(table, spec))) {
+		/* Keep whatever was loaded before */
+		keybindings_free(table);
+		return false;
+	}
+
+	/* "none" only exists to drop a binding */
+	size_t count = 0;
+	for (size_t i = 0; i < table->count; i++) {
+		if (table->bindings[i].action != ACTION_NONE)
+			table->bindings[count++] = table->bindings[i];
+	}
+	table->count = count;
+
+	qsort(table->bindings, table->count, sizeof(*table->bindings), keybinding_compare);
+	for (size_t i = 0; i < table->count; i++)
+		table->mask_used[table->bindings[i].modifiers] = true;
+
+	keybindings_free(server->keybindings);
+	server->keybindings = table;
+	wayback_log(LOG_DEBUG, "Loaded %zu keybindings", table->count);
+	return true;
+}
+
+void keybindings_destroy(struct tinywl_server *server)
+{
+	keybindings_free(server->keybindings);
+	server->keybindings = NULL;
+}
+
+static void keybinding_run(struct tinywl_server *server, const struct keybinding *binding)
+{
+	switch (binding->action) {
+		case ACTION_NONE:
+			break;
+		case ACTION_TERMINATE:
+			server_terminate(server);
+			break;
+		case ACTION_SWITCH_VT:
+			if (wlr_backend_is_multi(server->backend) && server->session)
+				wlr_session_change_vt(server->session, binding->arg);
+			break;
+		case ACTION_TOGGLE_TRACE:
+			server->trace = !server->trace;
+			wayback_log(LOG_INFO, "Tracing %s", server->trace ? "enabled" : "disabled");
+			break;
+		case ACTION_DUMP_STATS:
+			control_dump_stats(server, stderr);
+			break;
+		case ACTION_FRAME_POLICY:
+			/* Toggles every output, based on the default policy */
+			server->frame_policy = server->frame_policy == FRAME_POLICY_DEADLINE
+			                           ? FRAME_POLICY_IMMEDIATE
+			                           : FRAME_POLICY_DEADLINE;
+			struct tinywl_output *output;
+			wl_list_for_each(output, &server->outputs, link)
+				output->schedule.policy = server->frame_policy;
+			wayback_log(LOG_INFO,
+			            "Switched to %s frame policy",
+			            frame_policy_name(server->frame_policy));
+			break;
+	}
+}
+
+/*
+ * Runs the binding for a key that was just pressed, if any. Returns
+ * whether the key was consumed.
+ */
+bool keybindings_handle_key(struct tinywl_keyboard *keyboard, uint32_t keycode)
+{
+	struct tinywl_server *server = keyboard->server;
+	struct wayback_keybindings *table = server->keybindings;
+	if (table == NULL)
+		return false;
+
+	struct keybinding key = { .modifiers = keyboard->modifier_mask & KEYBINDING_MODIFIERS };
+	if (!table->mask_used[key.modifiers])
+		return false;
+
+	/* Translate libinput keycode -> xkbcommon */
+	const xkb_keysym_t *syms;
+	int nsyms = xkb_state_key_get_syms(keyboard->wlr_keyboard->xkb_state, keycode + 8, &syms);
+	for (int i = 0; i < nsyms; i++) {
+		key.sym = syms[i];
+		const struct keybinding *binding =
+			bsearch(&key, table->bindings, table->count, sizeof(key), keybinding_compare);
+		if (binding != NULL) {
+			keybinding_run(server, binding);
+			return true;
+		}
+	}
+	return false;
+}
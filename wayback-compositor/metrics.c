@@ -0,0 +1,161 @@
+/*
+ * Publishes compositor counters in a shared memory page, see
+ * wayback_metrics.h for the layout and the reader side.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "utils.h"
+#include "wayback-compositor.h"
+#include "wayback_log.h"
+#include "wayback_metrics.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <grp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <wlr/render/dmabuf.h>
+#include <wlr/types/wlr_buffer.h>
+#include <wlr/types/wlr_compositor.h>
+
+static char metrics_shm_name[64];
+
+static void metrics_page_init(struct wayback_metrics_page *page)
+{
+	page->magic = WAYBACK_METRICS_MAGIC;
+	page->version = WAYBACK_METRICS_VERSION;
+	page->size = sizeof(*page);
+	page->pid = getpid();
+}
+
+static struct wayback_metrics_page *metrics_map_shm(void)
+{
+	snprintf(
+		metrics_shm_name, sizeof(metrics_shm_name), WAYBACK_METRICS_SHM_PREFIX "%d", (int)getpid());
+
+	/* Input counters give away keystroke timing, so only we may read them,
+	 * or a group that is explicitly allowed to. The name is predictable: a
+	 * page someone else created could be truncated under us, so it has to
+	 * be a new one. Only a stale page of an earlier process with our pid
+	 * is removed first. */
+	shm_unlink(metrics_shm_name);
+	int fd = shm_open(metrics_shm_name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+	if (fd < 0) {
+		wayback_log(LOG_WARN, "Failed to create metrics page: %s", strerror(errno));
+		return NULL;
+	}
+
+	const char *group_name = getenv("WAYBACK_METRICS_GROUP");
+	if (group_name != NULL && group_name[0] != '\0') {
+		struct group *group = getgrnam(group_name);
+		if (group == NULL)
+			wayback_log(LOG_WARN, "Unknown metrics group %s", group_name);
+		else if (fchown(fd, -1, group->gr_gid) < 0 || fchmod(fd, 0640) < 0)
+			wayback_log(LOG_WARN,
+			            "Failed to share the metrics page with %s: %s",
+			            group_name,
+			            strerror(errno));
+	}
+
+	if (ftruncate(fd, sizeof(struct wayback_metrics_page)) < 0) {
+		wayback_log(LOG_WARN, "Failed to size metrics page: %s", strerror(errno));
+		close(fd);
+		shm_unlink(metrics_shm_name);
+		return NULL;
+	}
+
+	struct wayback_metrics_page *page =
+		mmap(NULL, sizeof(*page), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (page == MAP_FAILED) {
+		wayback_log(LOG_WARN, "Failed to map metrics page: %s", strerror(errno));
+		shm_unlink(metrics_shm_name);
+		return NULL;
+	}
+	return page;
+}
+
+void metrics_create(struct tinywl_server *server)
+{
+	struct wayback_metrics_page *page = metrics_map_shm();
+	if (page == NULL) {
+		/* Keep counting privately so update sites never need to check. */
+		metrics_shm_name[0] = '\0';
+		page = calloc(1, sizeof(*page));
+		if (page == NULL) {
+			wayback_log(LOG_ERROR, "Failed to allocate metrics page");
+			exit(EXIT_FAILURE);
+		}
+	} else {
+		wayback_log(LOG_DEBUG, "Publishing metrics in /dev/shm%s", metrics_shm_name);
+	}
+
+	metrics_page_init(page);
+	server->metrics = page;
+}
+
+void metrics_destroy(struct tinywl_server *server)
+{
+	if (server->metrics == NULL)
+		return;
+
+	if (metrics_shm_name[0] != '\0') {
+		munmap(server->metrics, sizeof(*server->metrics));
+		shm_unlink(metrics_shm_name);
+	} else {
+		free(server->metrics);
+	}
+	server->metrics = NULL;
+}
+
+void metrics_record_commit(struct tinywl_server *server,
+                           bool committed,
+                           bool scanout,
+                           uint64_t latency_usec)
+{
+	struct wayback_metrics_page *page = server->metrics;
+
+	int bucket = 0;
+	while (latency_usec > 1 && bucket < WAYBACK_METRICS_LATENCY_BUCKETS - 1) {
+		latency_usec >>= 1;
+		bucket++;
+	}
+
+	wayback_metrics_begin(page);
+	if (committed) {
+		page->frames_committed++;
+		if (scanout)
+			page->scanout_frames++;
+		page->commit_latency[bucket]++;
+	} else {
+		page->frames_failed++;
+	}
+	wayback_metrics_end(page);
+}
+
+void metrics_record_surface_state(struct tinywl_server *server,
+                                  const struct wlr_surface_state *state)
+{
+	struct wayback_metrics_page *page = server->metrics;
+
+	wayback_metrics_begin(page);
+	page->surface_commits++;
+	if ((state->committed & WLR_SURFACE_STATE_BUFFER) && state->buffer != NULL) {
+		struct wlr_shm_attributes shm;
+		struct wlr_dmabuf_attributes dmabuf;
+		if (wlr_buffer_get_shm(state->buffer, &shm)) {
+			page->shm_buffers++;
+			page->shm_buffer_bytes += (uint64_t)shm.stride * shm.height;
+		} else if (wlr_buffer_get_dmabuf(state->buffer, &dmabuf)) {
+			page->dmabuf_buffers++;
+		} else {
+			page->other_buffers++;
+		}
+	}
+	wayback_metrics_end(page);
+}
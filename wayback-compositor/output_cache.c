@@ -0,0 +1,134 @@
+/*
+ * Output state remembered across sessions, see wayback_output_cache.h.
+ *
+ * A monitor that was seen before gets the mode, scale and transform it had
+ * last time in a single commit, and goes back to its old place in the
+ * layout, rather than starting from the preferred mode and being adjusted
+ * from there. Outputs of the Wayland backend are left out, their size is
+ * up to the parent compositor.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "wayback-compositor.h"
+#include "wayback_log.h"
+#include "wayback_output_cache.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <wayland-server-core.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/types/wlr_output_layout.h>
+
+static uint64_t output_cache_key(const struct wlr_output *wlr_output)
+{
+	return wayback_output_cache_key(
+		wlr_output->make, wlr_output->model, wlr_output->serial, wlr_output->name);
+}
+
+const struct wayback_output_cache_entry *output_cache_apply(struct tinywl_server *server,
+                                                            struct wlr_output *wlr_output)
+{
+	const struct wayback_output_cache_entry *entry =
+		wayback_output_cache_find(server->output_cache, output_cache_key(wlr_output));
+	if (entry == NULL || entry->width <= 0 || entry->height <= 0 || entry->scale <= 0)
+		return NULL;
+
+	struct wlr_output_state state;
+	wlr_output_state_init(&state);
+	wlr_output_state_set_enabled(&state, true);
+	if (wl_list_empty(&wlr_output->modes)) {
+		wlr_output_state_set_custom_mode(&state, entry->width, entry->height, entry->refresh_mhz);
+	} else {
+		struct wlr_output_mode *mode, *match = NULL;
+		wl_list_for_each(mode, &wlr_output->modes, link)
+		{
+			if (mode->width == entry->width && mode->height == entry->height &&
+			    mode->refresh == entry->refresh_mhz) {
+				match = mode;
+				break;
+			}
+		}
+		/* The monitor no longer offers it, start over */
+		if (match == NULL) {
+			wlr_output_state_finish(&state);
+			return NULL;
+		}
+		/* Already there, e.g. set by the boot splash, don't modeset */
+		if (match != wlr_output->current_mode || !wlr_output->enabled)
+			wlr_output_state_set_mode(&state, match);
+	}
+	wlr_output_state_set_scale(&state, entry->scale);
+	wlr_output_state_set_transform(&state, entry->transform);
+
+	bool ok = wlr_output_commit_state(wlr_output, &state);
+	wlr_output_state_finish(&state);
+	if (!ok) {
+		wayback_log(LOG_WARN, "%s: failed to restore the previous mode", wlr_output->name);
+		return NULL;
+	}
+
+	wayback_log(LOG_INFO,
+	            "%s: restored %dx%d@%.3fHz, scale %.2f at %d,%d",
+	            wlr_output->name,
+	            entry->width,
+	            entry->height,
+	            entry->refresh_mhz / 1000.0,
+	            entry->scale,
+	            entry->x,
+	            entry->y);
+	return entry;
+}
+
+static bool output_cache_entry_equal(const struct wayback_output_cache_entry *a,
+                                     const struct wayback_output_cache_entry *b)
+{
+	return a->width == b->width && a->height == b->height && a->refresh_mhz == b->refresh_mhz &&
+	       a->transform == b->transform && a->scale == b->scale && a->x == b->x && a->y == b->y &&
+	       a->x_width == b->x_width && a->x_height == b->x_height &&
+	       strncmp(a->make, b->make, sizeof(a->make)) == 0 &&
+	       strncmp(a->model, b->model, sizeof(a->model)) == 0 &&
+	       strncmp(a->name, b->name, sizeof(a->name)) == 0;
+}
+
+/* Called whenever an output was set up or changed its mode */
+void output_cache_save(struct tinywl_output *output)
+{
+	struct tinywl_server *server = output->server;
+	struct wlr_output *wlr_output = output->wlr_output;
+	if (output->nested || !wlr_output->enabled)
+		return;
+
+	struct wlr_box box;
+	wlr_output_layout_get_box(server->output_layout, wlr_output, &box);
+	if (wlr_box_empty(&box))
+		return;
+
+	struct wayback_output_cache_entry entry = {
+		.key = output_cache_key(wlr_output),
+		.width = wlr_output->width,
+		.height = wlr_output->height,
+		.refresh_mhz = wlr_output->refresh,
+		.transform = wlr_output->transform,
+		.scale = wlr_output->scale,
+		.x = box.x,
+		.y = box.y,
+	};
+	wlr_output_effective_resolution(wlr_output, &entry.x_width, &entry.x_height);
+	snprintf(entry.make, sizeof(entry.make), "%s", wlr_output->make ? wlr_output->make : "");
+	snprintf(entry.model, sizeof(entry.model), "%s", wlr_output->model ? wlr_output->model : "");
+	snprintf(entry.name, sizeof(entry.name), "%s", wlr_output->name);
+
+	/* Most starts find the monitor as it was, leave the file alone then */
+	const struct wayback_output_cache_entry *cached =
+		wayback_output_cache_find(server->output_cache, entry.key);
+	if (cached != NULL && output_cache_entry_equal(cached, &entry))
+		return;
+
+	if (!wayback_output_cache_store(&entry))
+		return;
+
+	/* The old mapping still shows the file as it was */
+	wayback_output_cache_unmap(server->output_cache);
+	server->output_cache = wayback_output_cache_map();
+}
@@ -0,0 +1,391 @@
+/*
+ * Opt-in Wayland protocol traffic profiler. Counts requests and events,
+ * and their approximate wire size, per client and per message.
+ *
+ * Enabled at startup with WAYBACK_PROTOCOL_PROFILE=<seconds>, which also
+ * logs a summary at that interval (0 disables the periodic summary), or
+ * at runtime through the control socket.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "utils.h"
+#include "wayback-compositor.h"
+#include "wayback_log.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wayland-server-core.h>
+#include <wayland-util.h>
+
+/* Clients beyond this, e.g. short-lived ones in a long session, share one entry */
+#define PROFILER_MAX_CLIENTS 64
+
+struct profiler_client
+{
+	struct wl_list link;
+	struct protocol_profiler *profiler;
+	struct wl_client *client;
+	char name[32];
+	struct wl_listener destroy;
+};
+
+struct profiler_entry
+{
+	/* Both static in the protocol library, so the pointer identifies the message. */
+	const struct wl_message *message;
+	const char *interface;
+	const struct profiler_client *client;
+	enum wl_protocol_logger_type direction;
+	uint64_t count, bytes;
+	uint64_t last_count, last_bytes;
+};
+
+struct protocol_profiler
+{
+	struct tinywl_server *server;
+	struct wl_protocol_logger *logger;
+	struct wl_event_source *timer;
+	uint32_t interval_msec;
+	uint32_t last_dump_msec;
+
+	/* Open addressing hash table, capacity is a power of two */
+	struct profiler_entry *entries;
+	size_t capacity, used;
+
+	struct wl_list clients;
+	size_t nclients;
+	uint32_t next_client_id;
+	struct profiler_client *other;
+};
+
+static void profiler_client_destroy(struct wl_listener *listener, void *data)
+{
+	struct profiler_client *pclient = wl_container_of(listener, pclient, destroy);
+
+	/* Keep the entry around, its counters still refer to it. */
+	wl_list_remove(&pclient->destroy.link);
+	wl_list_init(&pclient->destroy.link);
+	pclient->client = NULL;
+}
+
+static struct profiler_client *profiler_client_get(struct protocol_profiler *profiler,
+                                                   struct wl_client *client)
+{
+	/* Found through the client itself rather than by searching on every message */
+	struct wl_listener *listener = wl_client_get_destroy_listener(client, profiler_client_destroy);
+	if (listener != NULL) {
+		struct profiler_client *pclient = wl_container_of(listener, pclient, destroy);
+		return pclient;
+	}
+	if (profiler->nclients >= PROFILER_MAX_CLIENTS && profiler->other != NULL)
+		return profiler->other;
+
+	struct profiler_client *pclient = calloc(1, sizeof(*pclient));
+	if (pclient == NULL)
+		return NULL;
+	pclient->profiler = profiler;
+	wl_list_insert(profiler->clients.prev, &pclient->link);
+	if (++profiler->nclients > PROFILER_MAX_CLIENTS) {
+		snprintf(pclient->name, sizeof(pclient->name), "other");
+		wl_list_init(&pclient->destroy.link);
+		profiler->other = pclient;
+		return pclient;
+	}
+
+	pclient->client = client;
+	if (client == profiler->server->xwayland_client)
+		snprintf(pclient->name, sizeof(pclient->name), "xwayland");
+	else if (client == profiler->server->xwayback_client)
+		snprintf(pclient->name, sizeof(pclient->name), "xwayback");
+	else
+		snprintf(pclient->name, sizeof(pclient->name), "client-%u", profiler->next_client_id++);
+	pclient->destroy.notify = profiler_client_destroy;
+	wl_client_add_destroy_listener(client, &pclient->destroy);
+	return pclient;
+}
+
+static size_t entry_hash(const struct wl_message *message, const struct profiler_client *client)
+{
+	uintptr_t key = (uintptr_t)message ^ ((uintptr_t)client >> 4);
+	key ^= key >> 17;
+	key *= 0xed5ad4bbU;
+	key ^= key >> 11;
+	return key;
+}
+
+static bool profiler_grow(struct protocol_profiler *profiler)
+{
+	size_t capacity = profiler->capacity ? profiler->capacity * 2 : 256;
+	struct profiler_entry *entries = calloc(capacity, sizeof(*entries));
+	if (entries == NULL)
+		return false;
+
+	for (size_t i = 0; i < profiler->capacity; i++) {
+		struct profiler_entry *old = &profiler->entries[i];
+		if (old->message == NULL)
+			continue;
+		size_t j = entry_hash(old->message, old->client) & (capacity - 1);
+		while (entries[j].message != NULL)
+			j = (j + 1) & (capacity - 1);
+		entries[j] = *old;
+	}
+
+	free(profiler->entries);
+	profiler->entries = entries;
+	profiler->capacity = capacity;
+	return true;
+}
+
+static struct profiler_entry *profiler_lookup(struct protocol_profiler *profiler,
+                                              const struct wl_message *message,
+                                              const struct profiler_client *client)
+{
+	if (profiler->used * 2 >= profiler->capacity && !profiler_grow(profiler))
+		return NULL;
+
+	size_t mask = profiler->capacity - 1;
+	size_t i = entry_hash(message, client) & mask;
+	while (profiler->entries[i].message != NULL) {
+		struct profiler_entry *entry = &profiler->entries[i];
+		if (entry->message == message && entry->client == client)
+			return entry;
+		i = (i + 1) & mask;
+	}
+
+	profiler->used++;
+	profiler->entries[i].message = message;
+	profiler->entries[i].client = client;
+	return &profiler->entries[i];
+}
+
+/* Size of the message on the wire, not counting file descriptors. */
+uint32_t protocol_message_size(const struct wl_protocol_logger_message *message)
+{
+	uint32_t size = 8; /* object id, opcode and size */
+	int arg = 0;
+	for (const char *c = message->message->signature; *c != '\0' && arg < message->arguments_count;
+	     c++) {
+		const union wl_argument *value = &message->arguments[arg];
+		switch (*c) {
+			case 'i':
+			case 'u':
+			case 'f':
+			case 'o':
+			case 'n':
+				size += 4;
+				arg++;
+				break;
+			case 's':
+				size += 4 + (value->s != NULL ? (strlen(value->s) + 1 + 3) & ~3u : 0);
+				arg++;
+				break;
+			case 'a':
+				size += 4 + (value->a != NULL ? (value->a->size + 3) & ~3u : 0);
+				arg++;
+				break;
+			case 'h':
+				arg++;
+				break;
+			default: /* version and nullability markers */
+				break;
+		}
+	}
+	return size;
+}
+
+static void profiler_log_message(void *user_data,
+                                 enum wl_protocol_logger_type direction,
+                                 const struct wl_protocol_logger_message *message)
+{
+	struct protocol_profiler *profiler = user_data;
+
+	struct profiler_client *pclient =
+		profiler_client_get(profiler, wl_resource_get_client(message->resource));
+	if (pclient == NULL)
+		return;
+
+	struct profiler_entry *entry = profiler_lookup(profiler, message->message, pclient);
+	if (entry == NULL)
+		return;
+
+	if (entry->interface == NULL) {
+		entry->interface = wl_resource_get_class(message->resource);
+		entry->direction = direction;
+	}
+	entry->count++;
+	entry->bytes += protocol_message_size(message);
+}
+
+static int compare_entries(const void *a, const void *b)
+{
+	const struct profiler_entry *const *ea = a, *const *eb = b;
+	if ((*ea)->count != (*eb)->count)
+		return (*ea)->count < (*eb)->count ? 1 : -1;
+	return 0;
+}
+
+void profiler_dump(struct tinywl_server *server, FILE *out)
+{
+	struct protocol_profiler *profiler = server->profiler;
+	if (profiler == NULL || profiler->used == 0) {
+		fprintf(out, "no protocol traffic recorded\n");
+		return;
+	}
+
+	uint32_t now = get_time_msec();
+	float elapsed = (now - profiler->last_dump_msec) / 1000.0f;
+	profiler->last_dump_msec = now;
+
+	struct profiler_entry **sorted = calloc(profiler->used, sizeof(*sorted));
+	if (sorted == NULL)
+		return;
+	size_t n = 0;
+	for (size_t i = 0; i < profiler->capacity; i++) {
+		if (profiler->entries[i].message != NULL)
+			sorted[n++] = &profiler->entries[i];
+	}
+	qsort(sorted, n, sizeof(*sorted), compare_entries);
+
+	fprintf(out,
+	        "%-10s %-34s %10s %12s %9s %11s\n",
+	        "client",
+	        "message",
+	        "count",
+	        "bytes",
+	        "/s",
+	        "bytes/s");
+	for (size_t i = 0; i < n; i++) {
+		struct profiler_entry *entry = sorted[i];
+		char name[128];
+		snprintf(name,
+		         sizeof(name),
+		         "%s%s%s",
+		         entry->interface,
+		         entry->direction == WL_PROTOCOL_LOGGER_REQUEST ? "." : "->",
+		         entry->message->name);
+		fprintf(out,
+		        "%-10s %-34s %10" PRIu64 " %12" PRIu64 " %9.1f %11.0f\n",
+		        entry->client->name,
+		        name,
+		        entry->count,
+		        entry->bytes,
+		        elapsed > 0 ? (entry->count - entry->last_count) / elapsed : 0.0f,
+		        elapsed > 0 ? (entry->bytes - entry->last_bytes) / elapsed : 0.0f);
+		entry->last_count = entry->count;
+		entry->last_bytes = entry->bytes;
+	}
+	free(sorted);
+}
+
+static int profiler_handle_timer(void *data)
+{
+	struct protocol_profiler *profiler = data;
+
+	char *buf = NULL;
+	size_t size = 0;
+	FILE *out = open_memstream(&buf, &size);
+	if (out != NULL) {
+		profiler_dump(profiler->server, out);
+		fclose(out);
+
+		char *saveptr = NULL;
+		for (char *line = strtok_r(buf, "\n", &saveptr); line != NULL;
+		     line = strtok_r(NULL, "\n", &saveptr))
+			wayback_log(LOG_INFO, "protocol: %s", line);
+		free(buf);
+	}
+
+	wl_event_source_timer_update(profiler->timer, profiler->interval_msec);
+	return 0;
+}
+
+void profiler_reset(struct tinywl_server *server)
+{
+	struct protocol_profiler *profiler = server->profiler;
+	if (profiler == NULL)
+		return;
+	free(profiler->entries);
+	profiler->entries = NULL;
+	profiler->capacity = 0;
+	profiler->used = 0;
+	profiler->last_dump_msec = get_time_msec();
+}
+
+uint32_t profiler_interval(struct tinywl_server *server)
+{
+	return server->profiler != NULL ? server->profiler->interval_msec : 0;
+}
+
+bool profiler_enable(struct tinywl_server *server, uint32_t interval_msec)
+{
+	struct protocol_profiler *profiler = server->profiler;
+	if (profiler == NULL) {
+		profiler = calloc(1, sizeof(*profiler));
+		if (profiler == NULL)
+			return false;
+		profiler->server = server;
+		wl_list_init(&profiler->clients);
+		server->profiler = profiler;
+	}
+
+	if (profiler->logger == NULL) {
+		profiler->logger =
+			wl_display_add_protocol_logger(server->wl_display, profiler_log_message, profiler);
+		profiler->last_dump_msec = get_time_msec();
+	}
+
+	profiler->interval_msec = interval_msec;
+	if (interval_msec > 0 && profiler->timer == NULL)
+		profiler->timer = wl_event_loop_add_timer(
+			wl_display_get_event_loop(server->wl_display), profiler_handle_timer, profiler);
+	if (profiler->timer != NULL)
+		wl_event_source_timer_update(profiler->timer, interval_msec);
+
+	return profiler->logger != NULL;
+}
+
+void profiler_disable(struct tinywl_server *server)
+{
+	struct protocol_profiler *profiler = server->profiler;
+	if (profiler == NULL)
+		return;
+
+	/* Counters are kept so they can still be dumped afterwards. */
+	if (profiler->logger != NULL) {
+		wl_protocol_logger_destroy(profiler->logger);
+		profiler->logger = NULL;
+	}
+	if (profiler->timer != NULL)
+		wl_event_source_timer_update(profiler->timer, 0);
+}
+
+bool profiler_is_enabled(struct tinywl_server *server)
+{
+	return server->profiler != NULL && server->profiler->logger != NULL;
+}
+
+void profiler_destroy(struct tinywl_server *server)
+{
+	struct protocol_profiler *profiler = server->profiler;
+	if (profiler == NULL)
+		return;
+
+	profiler_disable(server);
+	if (profiler->timer != NULL)
+		wl_event_source_remove(profiler->timer);
+
+	struct profiler_client *pclient, *tmp;
+	wl_list_for_each_safe(pclient, tmp, &profiler->clients, link)
+	{
+		wl_list_remove(&pclient->destroy.link);
+		wl_list_remove(&pclient->link);
+		free(pclient);
+	}
+
+	free(profiler->entries);
+	free(profiler);
+	server->profiler = NULL;
+}
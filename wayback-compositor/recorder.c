@@ -0,0 +1,284 @@
+/*
+ * Records the protocol traffic between Xwayland and the compositor, along
+ * with the shm buffers it submits, so that wayback-replay can play the
+ * session back later. See wayback_record.h for the file format.
+ *
+ * Enabled with WAYBACK_RECORD=<path>. Buffer pixels are stored in full by
+ * default, WAYBACK_RECORD_BUFFERS=hash only keeps a hash of each buffer.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "utils.h"
+#include "wayback-compositor.h"
+#include "wayback_log.h"
+#include "wayback_record.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <wayland-server-core.h>
+#include <wlr/types/wlr_buffer.h>
+#include <wlr/types/wlr_compositor.h>
+
+struct wayback_recorder
+{
+	struct tinywl_server *server;
+	FILE *file;
+	struct wl_protocol_logger *logger;
+	struct timespec start;
+	bool full_buffers;
+	/* Set once writing failed, the logger can't be removed from its own callback */
+	bool failed;
+	uint64_t messages, buffers;
+
+	/* Payload of the record being assembled */
+	char *buf;
+	size_t len, cap;
+};
+
+static bool recorder_reserve(struct wayback_recorder *recorder, size_t len)
+{
+	if (recorder->len + len <= recorder->cap)
+		return true;
+	size_t cap = recorder->cap ? recorder->cap : 4096;
+	while (cap < recorder->len + len)
+		cap *= 2;
+	char *buf = realloc(recorder->buf, cap);
+	if (buf == NULL)
+		return false;
+	recorder->buf = buf;
+	recorder->cap = cap;
+	return true;
+}
+
+static void recorder_put(struct wayback_recorder *recorder, const void *data, size_t len)
+{
+	size_t padded = (len + 3) & ~(size_t)3;
+	if (recorder->failed)
+		return;
+	/* A record missing a field would throw off the replay of everything after it */
+	if (!recorder_reserve(recorder, padded)) {
+		wayback_log(LOG_WARN, "Out of memory for a %zu byte record, stopping the recording", len);
+		recorder->failed = true;
+		return;
+	}
+	memcpy(recorder->buf + recorder->len, data, len);
+	memset(recorder->buf + recorder->len + len, 0, padded - len);
+	recorder->len += padded;
+}
+
+static void recorder_put_u32(struct wayback_recorder *recorder, uint32_t value)
+{
+	recorder_put(recorder, &value, sizeof(value));
+}
+
+static void recorder_put_bytes(struct wayback_recorder *recorder, const void *data, uint32_t len)
+{
+	recorder_put_u32(recorder, len);
+	if (len > 0)
+		recorder_put(recorder, data, len);
+}
+
+static uint64_t recorder_time(struct wayback_recorder *recorder)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - recorder->start.tv_sec) * 1000000 +
+	       (now.tv_nsec - recorder->start.tv_nsec) / 1000;
+}
+
+static void recorder_flush_record(struct wayback_recorder *recorder,
+                                  enum wayback_record_type type,
+                                  uint64_t time_usec)
+{
+	struct wayback_record_header header = {
+		.type = type,
+		.size = recorder->len,
+		.time_usec = time_usec,
+	};
+	if (recorder->failed) {
+		recorder->len = 0;
+		return;
+	}
+	if (fwrite(&header, sizeof(header), 1, recorder->file) != 1 ||
+	    fwrite(recorder->buf, 1, recorder->len, recorder->file) != recorder->len) {
+		wayback_log(LOG_ERROR, "Failed to write recording, stopping: %s", strerror(errno));
+		recorder->failed = true;
+	}
+	recorder->len = 0;
+}
+
+static void recorder_capture_buffer(struct wayback_recorder *recorder,
+                                    struct wl_resource *surface_resource,
+                                    uint64_t time_usec)
+{
+	struct wlr_surface *surface = wlr_surface_from_resource(surface_resource);
+	struct wlr_buffer *buffer = surface->pending.buffer;
+	if (!(surface->pending.committed & WLR_SURFACE_STATE_BUFFER) || buffer == NULL)
+		return;
+
+	void *data;
+	uint32_t format;
+	size_t stride;
+	if (!wlr_buffer_begin_data_ptr_access(
+			buffer, WLR_BUFFER_DATA_PTR_ACCESS_READ, &data, &format, &stride)) {
+		/* dmabufs can't be read back cheaply, the replay keeps the old pixels. */
+		return;
+	}
+
+	size_t size = stride * buffer->height;
+	recorder_put_u32(recorder, wl_resource_get_id(surface_resource));
+	recorder_put_u32(recorder, buffer->width);
+	recorder_put_u32(recorder, buffer->height);
+	recorder_put_u32(recorder, stride);
+	recorder_put_u32(recorder, format);
+	if (recorder->full_buffers) {
+		recorder_put(recorder, data, size);
+	} else {
+		uint64_t hash = wayback_record_hash(data, size);
+		recorder_put(recorder, &hash, sizeof(hash));
+	}
+	wlr_buffer_end_data_ptr_access(buffer);
+
+	recorder_flush_record(recorder,
+	                      recorder->full_buffers ? WAYBACK_RECORD_BUFFER : WAYBACK_RECORD_BUFFER_HASH,
+	                      time_usec);
+	recorder->buffers++;
+}
+
+static void recorder_log_message(void *user_data,
+                                 enum wl_protocol_logger_type direction,
+                                 const struct wl_protocol_logger_message *message)
+{
+	struct wayback_recorder *recorder = user_data;
+	struct wl_resource *resource = message->resource;
+
+	if (recorder->failed || wl_resource_get_client(resource) != recorder->server->xwayland_client)
+		return;
+
+	uint64_t time_usec = recorder_time(recorder);
+	const char *interface = wl_resource_get_class(resource);
+
+	/* Requests are logged before they are handled, so the buffer that is
+	 * about to be committed is still pending on the surface. */
+	if (direction == WL_PROTOCOL_LOGGER_REQUEST && strcmp(interface, "wl_surface") == 0 &&
+	    strcmp(message->message->name, "commit") == 0)
+		recorder_capture_buffer(recorder, resource, time_usec);
+
+	if (recorder->failed)
+		return;
+
+	recorder_put_u32(recorder, wl_resource_get_id(resource));
+	recorder_put_u32(recorder, message->message_opcode);
+	recorder_put_bytes(recorder, interface, strlen(interface) + 1);
+
+	int arg = 0;
+	for (const char *c = message->message->signature; *c != '\0' && arg < message->arguments_count;
+	     c++) {
+		const union wl_argument *value = &message->arguments[arg];
+		switch (*c) {
+			case 'i':
+				recorder_put_u32(recorder, (uint32_t)value->i);
+				arg++;
+				break;
+			case 'u':
+				recorder_put_u32(recorder, value->u);
+				arg++;
+				break;
+			case 'f':
+				recorder_put_u32(recorder, (uint32_t)value->f);
+				arg++;
+				break;
+			case 'o':
+				recorder_put_u32(
+					recorder,
+					value->o != NULL ? wl_resource_get_id((struct wl_resource *)value->o) : 0);
+				arg++;
+				break;
+			case 'n':
+				recorder_put_u32(recorder, value->n);
+				arg++;
+				break;
+			case 's':
+				recorder_put_bytes(
+					recorder, value->s, value->s != NULL ? strlen(value->s) + 1 : 0);
+				arg++;
+				break;
+			case 'a':
+				recorder_put_bytes(recorder,
+				                   value->a != NULL ? value->a->data : NULL,
+				                   value->a != NULL ? value->a->size : 0);
+				arg++;
+				break;
+			case 'h':
+				arg++;
+				break;
+			default: /* version and nullability markers */
+				break;
+		}
+	}
+
+	recorder_flush_record(recorder,
+	                      direction == WL_PROTOCOL_LOGGER_REQUEST ? WAYBACK_RECORD_REQUEST
+	                                                              : WAYBACK_RECORD_EVENT,
+	                      time_usec);
+	recorder->messages++;
+}
+
+bool recorder_create(struct tinywl_server *server, const char *path)
+{
+	struct wayback_recorder *recorder = calloc(1, sizeof(*recorder));
+	if (recorder == NULL)
+		return false;
+
+	recorder->file = fopen(path, "we");
+	if (recorder->file == NULL) {
+		wayback_log(LOG_ERROR, "Failed to open recording %s: %s", path, strerror(errno));
+		free(recorder);
+		return false;
+	}
+	setvbuf(recorder->file, NULL, _IOFBF, 1 << 20);
+
+	const char *buffers = getenv("WAYBACK_RECORD_BUFFERS");
+	recorder->full_buffers = buffers == NULL || strcmp(buffers, "hash") != 0;
+
+	struct wayback_record_file_header header = {
+		.magic = WAYBACK_RECORD_MAGIC,
+		.version = WAYBACK_RECORD_VERSION,
+	};
+	fwrite(&header, sizeof(header), 1, recorder->file);
+
+	recorder->server = server;
+	clock_gettime(CLOCK_MONOTONIC, &recorder->start);
+	recorder->logger =
+		wl_display_add_protocol_logger(server->wl_display, recorder_log_message, recorder);
+
+	server->recorder = recorder;
+	wayback_log(LOG_INFO,
+	            "Recording Xwayland session to %s (%s buffers)",
+	            path,
+	            recorder->full_buffers ? "full" : "hashed");
+	return true;
+}
+
+void recorder_destroy(struct tinywl_server *server)
+{
+	struct wayback_recorder *recorder = server->recorder;
+	if (recorder == NULL)
+		return;
+
+	wl_protocol_logger_destroy(recorder->logger);
+	fclose(recorder->file);
+	wayback_log(LOG_INFO,
+	            "Recorded %" PRIu64 " messages and %" PRIu64 " buffers",
+	            recorder->messages,
+	            recorder->buffers);
+
+	free(recorder->buf);
+	free(recorder);
+	server->recorder = NULL;
+}
@@ -0,0 +1,295 @@
+/*
+ * Huge page backed render buffers for the Pixman renderer.
+ *
+ * Without a GPU, every frame is composited by the CPU into shared memory
+ * buffers of the output's size, 33 MB each at 4K, and the TLB misses of
+ * walking them in 4 KiB pages add up. With WAYBACK_HUGE_PAGES set, output
+ * buffers come from this allocator instead of wlroots' own one. It backs
+ * them with a hugetlbfs memfd if huge pages are reserved
+ * (/proc/sys/vm/nr_hugepages), and otherwise with a regular memfd that is
+ * advised to use transparent huge pages, which only takes effect if
+ * /sys/kernel/mm/transparent_hugepage/shmem_enabled allows it. Either way
+ * the buffers stay shared memory, so that they can still be handed to a
+ * parent compositor when running nested.
+ *
+ * Backends that need DMA-BUFs (DRM) and the GPU renderers keep using the
+ * allocator wlroots picks.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "utils.h"
+#include "wayback-compositor.h"
+#include "wayback_log.h"
+#include "wayback_mem.h"
+
+#include <assert.h>
+#include <drm_fourcc.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <wlr/backend.h>
+#include <wlr/interfaces/wlr_buffer.h>
+#include <wlr/render/allocator.h>
+#include <wlr/render/drm_format_set.h>
+#include <wlr/render/pixman.h>
+
+/* When /proc/meminfo doesn't say */
+#define DEFAULT_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+enum render_buffer_backing
+{
+	BACKING_HUGETLB,
+	BACKING_THP,
+	BACKING_SMALL_PAGES,
+	BACKING_COUNT,
+};
+
+static const char *const backing_names[BACKING_COUNT] = {
+	[BACKING_HUGETLB] = "hugetlbfs",
+	[BACKING_THP] = "transparent huge pages",
+	[BACKING_SMALL_PAGES] = "small pages",
+};
+
+struct render_buffer
+{
+	struct wlr_buffer base;
+	struct wlr_shm_attributes shm;
+	enum render_buffer_backing backing;
+	void *data;
+	size_t size;
+};
+
+struct render_allocator
+{
+	struct wlr_allocator base;
+	size_t huge_page_size;
+	/* Cleared once hugetlbfs ran out, so as not to retry for every buffer */
+	bool hugetlb;
+};
+
+/* Live buffers per backing and their size, for the memory command */
+static size_t backing_buffers[BACKING_COUNT];
+static size_t backing_bytes[BACKING_COUNT];
+
+WAYBACK_POOL(render_buffer_pool, "render buffers", struct render_buffer);
+
+static const struct wlr_buffer_impl render_buffer_impl;
+
+static struct render_buffer *render_buffer_from_buffer(struct wlr_buffer *wlr_buffer)
+{
+	assert(wlr_buffer->impl == &render_buffer_impl);
+	struct render_buffer *buffer = wl_container_of(wlr_buffer, buffer, base);
+	return buffer;
+}
+
+static void render_buffer_destroy(struct wlr_buffer *wlr_buffer)
+{
+	struct render_buffer *buffer = render_buffer_from_buffer(wlr_buffer);
+
+	wlr_buffer_finish(&buffer->base);
+	munmap(buffer->data, buffer->size);
+	close(buffer->shm.fd);
+	backing_buffers[buffer->backing]--;
+	backing_bytes[buffer->backing] -= buffer->size;
+	wayback_pool_free(&render_buffer_pool, buffer);
+}
+
+static bool render_buffer_get_shm(struct wlr_buffer *wlr_buffer, struct wlr_shm_attributes *shm)
+{
+	struct render_buffer *buffer = render_buffer_from_buffer(wlr_buffer);
+	*shm = buffer->shm;
+	return true;
+}
+
+static bool render_buffer_begin_data_ptr_access(struct wlr_buffer *wlr_buffer,
+                                                uint32_t flags,
+                                                void **data,
+                                                uint32_t *format,
+                                                size_t *stride)
+{
+	struct render_buffer *buffer = render_buffer_from_buffer(wlr_buffer);
+	*data = buffer->data;
+	*format = buffer->shm.format;
+	*stride = buffer->shm.stride;
+	return true;
+}
+
+static void render_buffer_end_data_ptr_access(struct wlr_buffer *wlr_buffer)
+{
+}
+
+static const struct wlr_buffer_impl render_buffer_impl = {
+	.destroy = render_buffer_destroy,
+	.get_shm = render_buffer_get_shm,
+	.begin_data_ptr_access = render_buffer_begin_data_ptr_access,
+	.end_data_ptr_access = render_buffer_end_data_ptr_access,
+};
+
+/* Everything Pixman renders to is 32 bits per pixel */
+static bool format_is_32bpp(uint32_t format)
+{
+	static const uint32_t formats[] = {
+		DRM_FORMAT_XRGB8888,    DRM_FORMAT_ARGB8888,    DRM_FORMAT_XBGR8888,
+		DRM_FORMAT_ABGR8888,    DRM_FORMAT_RGBX8888,    DRM_FORMAT_RGBA8888,
+		DRM_FORMAT_BGRX8888,    DRM_FORMAT_BGRA8888,    DRM_FORMAT_XRGB2101010,
+		DRM_FORMAT_ARGB2101010, DRM_FORMAT_XBGR2101010, DRM_FORMAT_ABGR2101010,
+	};
+	for (size_t i = 0; i < ARRAY_SIZE(formats); i++) {
+		if (formats[i] == format)
+			return true;
+	}
+	return false;
+}
+
+/* Returns the mapping of a new memfd of the given size, or MAP_FAILED */
+static void *map_memfd(unsigned int flags, size_t size, int *fd)
+{
+	*fd = memfd_create("wayback-render-buffer", MFD_CLOEXEC | flags);
+	if (*fd < 0)
+		return MAP_FAILED;
+
+	void *data = MAP_FAILED;
+	if (ftruncate(*fd, size) == 0)
+		data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0);
+	if (data == MAP_FAILED) {
+		close(*fd);
+		*fd = -1;
+	}
+	return data;
+}
+
+static struct wlr_buffer *render_allocator_create_buffer(struct wlr_allocator *wlr_allocator,
+                                                         int width,
+                                                         int height,
+                                                         const struct wlr_drm_format *format)
+{
+	struct render_allocator *allocator = wl_container_of(wlr_allocator, allocator, base);
+
+	if (!format_is_32bpp(format->format)) {
+		wayback_log(LOG_ERROR, "Unsupported render buffer format 0x%08" PRIx32, format->format);
+		return NULL;
+	}
+
+	struct render_buffer *buffer = wayback_pool_alloc(&render_buffer_pool);
+	if (buffer == NULL)
+		return NULL;
+
+	int stride = width * 4;
+	buffer->size = (size_t)stride * height;
+	/* hugetlbfs only comes in whole pages, and THP only covers them */
+	size_t page_mask = allocator->huge_page_size - 1;
+	buffer->size = (buffer->size + page_mask) & ~page_mask;
+
+	int fd = -1;
+	buffer->data = MAP_FAILED;
+	if (allocator->hugetlb) {
+		buffer->data = map_memfd(MFD_HUGETLB, buffer->size, &fd);
+		buffer->backing = BACKING_HUGETLB;
+		if (buffer->data == MAP_FAILED) {
+			wayback_log(LOG_INFO,
+			            "No huge pages reserved for %zu KiB render buffers, using THP",
+			            buffer->size / 1024);
+			allocator->hugetlb = false;
+		}
+	}
+	if (buffer->data == MAP_FAILED) {
+		buffer->data = map_memfd(0, buffer->size, &fd);
+		buffer->backing = BACKING_THP;
+		if (buffer->data != MAP_FAILED && madvise(buffer->data, buffer->size, MADV_HUGEPAGE) != 0)
+			buffer->backing = BACKING_SMALL_PAGES;
+	}
+	if (buffer->data == MAP_FAILED) {
+		wayback_log(LOG_ERROR, "Failed to allocate a %dx%d render buffer", width, height);
+		wayback_pool_free(&render_buffer_pool, buffer);
+		return NULL;
+	}
+
+	wlr_buffer_init(&buffer->base, &render_buffer_impl, width, height);
+	buffer->shm = (struct wlr_shm_attributes){
+		.fd = fd,
+		.format = format->format,
+		.width = width,
+		.height = height,
+		.stride = stride,
+		.offset = 0,
+	};
+	backing_buffers[buffer->backing]++;
+	backing_bytes[buffer->backing] += buffer->size;
+	wayback_log(LOG_DEBUG,
+	            "Allocated a %dx%d render buffer in %s",
+	            width,
+	            height,
+	            backing_names[buffer->backing]);
+	return &buffer->base;
+}
+
+static void render_allocator_destroy(struct wlr_allocator *wlr_allocator)
+{
+	struct render_allocator *allocator = wl_container_of(wlr_allocator, allocator, base);
+	free(allocator);
+}
+
+static const struct wlr_allocator_interface render_allocator_impl = {
+	.create_buffer = render_allocator_create_buffer,
+	.destroy = render_allocator_destroy,
+};
+
+static size_t huge_page_size(void)
+{
+	size_t size = DEFAULT_HUGE_PAGE_SIZE;
+	FILE *meminfo = fopen("/proc/meminfo", "r");
+	if (meminfo == NULL)
+		return size;
+
+	char line[128];
+	unsigned long kib;
+	while (fgets(line, sizeof(line), meminfo) != NULL) {
+		if (sscanf(line, "Hugepagesize: %lu kB", &kib) == 1) {
+			size = kib * 1024;
+			break;
+		}
+	}
+	fclose(meminfo);
+	return size;
+}
+
+struct wlr_allocator *render_allocator_create(struct wlr_backend *backend,
+                                              struct wlr_renderer *renderer)
+{
+	if (!wlr_renderer_is_pixman(renderer)) {
+		wayback_log(LOG_INFO, "Huge page render buffers are only used with the Pixman renderer");
+		return NULL;
+	}
+	uint32_t caps = WLR_BUFFER_CAP_DATA_PTR | WLR_BUFFER_CAP_SHM;
+	if ((backend->buffer_caps & caps) == 0) {
+		wayback_log(LOG_INFO, "The backend can't take huge page render buffers");
+		return NULL;
+	}
+
+	struct render_allocator *allocator = calloc(1, sizeof(*allocator));
+	if (allocator == NULL)
+		return NULL;
+	wlr_allocator_init(&allocator->base, &render_allocator_impl, caps);
+	allocator->huge_page_size = huge_page_size();
+	allocator->hugetlb = true;
+	wayback_log(LOG_INFO,
+	            "Using %zu KiB pages for render buffers",
+	            allocator->huge_page_size / 1024);
+	return &allocator->base;
+}
+
+void render_buffers_report(FILE *out)
+{
+	for (int i = 0; i < BACKING_COUNT; i++) {
+		if (backing_buffers[i] > 0)
+			fprintf(out,
+			        "render buffers in %s: %zu, %zu KiB\n",
+			        backing_names[i],
+			        backing_buffers[i],
+			        backing_bytes[i] / 1024);
+	}
+}
@@ -0,0 +1,317 @@
+/*
+ * Touchscreens.
+ *
+ * Touch devices are attached to wlr_cursor, which maps them to their
+ * output, and their events go straight to the surface under the finger
+ * through wl_touch, with the timestamps they came with. Every wl_touch
+ * frame is forwarded as is, the events of a frame reach the client
+ * together as libwayland only flushes client buffers once per event loop
+ * iteration.
+ *
+ * X clients that don't handle touch themselves get emulated pointer events
+ * from Xwayland, unless Xwayback was started with -noTouchPointerEmulation.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "wayback-compositor.h"
+#include "wayback_log.h"
+#include "wayback_mem.h"
+#include "wayback_metrics.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <wayland-server-core.h>
+#include <wlr/types/wlr_cursor.h>
+#include <wlr/types/wlr_input_device.h>
+#include <wlr/types/wlr_seat.h>
+#include <wlr/types/wlr_touch.h>
+
+/* Fingers tracked at once, more than any touchscreen reports */
+#define TOUCH_MAX_POINTS 16
+
+struct touch_device
+{
+	struct wl_list link;
+	struct wayback_touch *touch;
+	struct wl_listener destroy;
+};
+
+struct touch_point
+{
+	bool active;
+	int32_t id;
+	/* Layout position of the surface the point went down on */
+	double origin_x, origin_y;
+};
+
+struct wayback_touch
+{
+	struct tinywl_server *server;
+	struct wl_list devices;
+	struct touch_point points[TOUCH_MAX_POINTS];
+
+	struct wl_listener down;
+	struct wl_listener up;
+	struct wl_listener motion;
+	struct wl_listener cancel;
+	struct wl_listener frame;
+
+	/* From the event timestamp until it was passed on */
+	uint64_t events;
+	uint64_t latency_msec_total;
+	uint32_t latency_msec_max;
+};
+
+WAYBACK_POOL(touch_device_pool, "touch devices", struct touch_device);
+
+static struct touch_point *touch_point_find(struct wayback_touch *touch, int32_t id)
+{
+	for (int i = 0; i < TOUCH_MAX_POINTS; i++) {
+		if (touch->points[i].active && touch->points[i].id == id)
+			return &touch->points[i];
+	}
+	return NULL;
+}
+
+/* Counts the event and returns how long it took to get here */
+static uint32_t touch_account(struct wayback_touch *touch, uint32_t time_msec)
+{
+	struct tinywl_server *server = touch->server;
+	uint32_t latency = get_time_msec() - time_msec;
+
+	wayback_rate_tick(&server->input_rate, time_msec);
+	WAYBACK_METRICS_ADD(server->metrics, touch_events, 1);
+	touch->events++;
+	touch->latency_msec_total += latency;
+	if (latency > touch->latency_msec_max)
+		touch->latency_msec_max = latency;
+	return latency;
+}
+
+static void touch_down(struct wl_listener *listener, void *data)
+{
+	struct wayback_touch *touch = wl_container_of(listener, touch, down);
+	struct tinywl_server *server = touch->server;
+	struct wlr_touch_down_event *event = data;
+
+	double lx, ly;
+	wlr_cursor_absolute_to_layout_coords(
+		server->cursor, &event->touch->base, event->x, event->y, &lx, &ly);
+
+	uint32_t latency = touch_account(touch, event->time_msec);
+	if (server->trace)
+		wayback_log(LOG_INFO,
+		            "trace: touch %d down at %.2f,%.2f at %u, %u ms late",
+		            event->touch_id,
+		            lx,
+		            ly,
+		            event->time_msec,
+		            latency);
+
+	double sx, sy;
+	struct wlr_surface *surface = NULL;
+	struct tinywl_toplevel *toplevel = desktop_toplevel_at(server, lx, ly, &surface, &sx, &sy);
+	if (surface == NULL || !wlr_surface_accepts_touch(surface, server->seat))
+		return;
+
+	struct touch_point *point = touch_point_find(touch, event->touch_id);
+	for (int i = 0; point == NULL && i < TOUCH_MAX_POINTS; i++) {
+		if (!touch->points[i].active)
+			point = &touch->points[i];
+	}
+	if (point == NULL)
+		return;
+	*point = (struct touch_point){
+		.active = true,
+		.id = event->touch_id,
+		.origin_x = lx - sx,
+		.origin_y = ly - sy,
+	};
+
+	wlr_seat_touch_notify_down(server->seat, surface, event->time_msec, event->touch_id, sx, sy);
+	focus_toplevel(toplevel);
+}
+
+static void touch_motion(struct wl_listener *listener, void *data)
+{
+	struct wayback_touch *touch = wl_container_of(listener, touch, motion);
+	struct tinywl_server *server = touch->server;
+	struct wlr_touch_motion_event *event = data;
+
+	double lx, ly;
+	wlr_cursor_absolute_to_layout_coords(
+		server->cursor, &event->touch->base, event->x, event->y, &lx, &ly);
+
+	uint32_t latency = touch_account(touch, event->time_msec);
+	if (server->trace)
+		wayback_log(LOG_INFO,
+		            "trace: touch %d motion to %.2f,%.2f at %u, %u ms late",
+		            event->touch_id,
+		            lx,
+		            ly,
+		            event->time_msec,
+		            latency);
+
+	/* Stays with the surface it went down on, even outside of it */
+	struct touch_point *point = touch_point_find(touch, event->touch_id);
+	if (point != NULL)
+		wlr_seat_touch_notify_motion(server->seat,
+		                             event->time_msec,
+		                             event->touch_id,
+		                             lx - point->origin_x,
+		                             ly - point->origin_y);
+}
+
+static void touch_up(struct wl_listener *listener, void *data)
+{
+	struct wayback_touch *touch = wl_container_of(listener, touch, up);
+	struct tinywl_server *server = touch->server;
+	struct wlr_touch_up_event *event = data;
+
+	uint32_t latency = touch_account(touch, event->time_msec);
+	if (server->trace)
+		wayback_log(LOG_INFO,
+		            "trace: touch %d up at %u, %u ms late",
+		            event->touch_id,
+		            event->time_msec,
+		            latency);
+
+	struct touch_point *point = touch_point_find(touch, event->touch_id);
+	if (point == NULL)
+		return;
+	point->active = false;
+	wlr_seat_touch_notify_up(server->seat, event->time_msec, event->touch_id);
+}
+
+static void touch_cancel(struct wl_listener *listener, void *data)
+{
+	struct wayback_touch *touch = wl_container_of(listener, touch, cancel);
+	struct tinywl_server *server = touch->server;
+	struct wlr_touch_cancel_event *event = data;
+
+	touch_account(touch, event->time_msec);
+	if (server->trace)
+		wayback_log(LOG_INFO, "trace: touch %d cancelled at %u", event->touch_id, event->time_msec);
+
+	struct touch_point *point = touch_point_find(touch, event->touch_id);
+	if (point == NULL)
+		return;
+	point->active = false;
+
+	/*
+	 * wl_touch can only cancel all points of a client at once, so the other
+	 * fingers on that client go too and their later events are dropped
+	 */
+	struct wlr_touch_point *seat_point = wlr_seat_touch_get_point(server->seat, event->touch_id);
+	if (seat_point == NULL || seat_point->client == NULL)
+		return;
+	for (int i = 0; i < TOUCH_MAX_POINTS; i++) {
+		if (!touch->points[i].active)
+			continue;
+		struct wlr_touch_point *other =
+			wlr_seat_touch_get_point(server->seat, touch->points[i].id);
+		if (other != NULL && other->client == seat_point->client)
+			touch->points[i].active = false;
+	}
+	wlr_seat_touch_notify_cancel(server->seat, seat_point->client);
+}
+
+static void touch_frame(struct wl_listener *listener, void *data)
+{
+	struct wayback_touch *touch = wl_container_of(listener, touch, frame);
+	struct tinywl_server *server = touch->server;
+
+	WAYBACK_METRICS_ADD(server->metrics, touch_frames, 1);
+	wlr_seat_touch_notify_frame(server->seat);
+}
+
+bool touch_create(struct tinywl_server *server)
+{
+	struct wayback_touch *touch = calloc(1, sizeof(*touch));
+	if (touch == NULL)
+		return false;
+	touch->server = server;
+	wl_list_init(&touch->devices);
+
+	touch->down.notify = touch_down;
+	wl_signal_add(&server->cursor->events.touch_down, &touch->down);
+	touch->up.notify = touch_up;
+	wl_signal_add(&server->cursor->events.touch_up, &touch->up);
+	touch->motion.notify = touch_motion;
+	wl_signal_add(&server->cursor->events.touch_motion, &touch->motion);
+	touch->cancel.notify = touch_cancel;
+	wl_signal_add(&server->cursor->events.touch_cancel, &touch->cancel);
+	touch->frame.notify = touch_frame;
+	wl_signal_add(&server->cursor->events.touch_frame, &touch->frame);
+
+	server->touch = touch;
+	return true;
+}
+
+static void touch_device_destroy(struct wl_listener *listener, void *data)
+{
+	struct touch_device *device = wl_container_of(listener, device, destroy);
+	struct tinywl_server *server = device->touch->server;
+
+	wl_list_remove(&device->destroy.link);
+	wl_list_remove(&device->link);
+	wayback_pool_free(&touch_device_pool, device);
+	server_update_capabilities(server);
+}
+
+void touch_add_device(struct tinywl_server *server, struct wlr_input_device *device)
+{
+	if (server->touch == NULL)
+		return;
+
+	struct touch_device *touch_device = wayback_pool_alloc(&touch_device_pool);
+	touch_device->touch = server->touch;
+	touch_device->destroy.notify = touch_device_destroy;
+	wl_signal_add(&device->events.destroy, &touch_device->destroy);
+	wl_list_insert(&server->touch->devices, &touch_device->link);
+
+	/* Maps the device to its output, touch events come out of the cursor */
+	wlr_cursor_attach_input_device(server->cursor, device);
+}
+
+bool touch_has_devices(struct tinywl_server *server)
+{
+	return server->touch != NULL && !wl_list_empty(&server->touch->devices);
+}
+
+void touch_dump_stats(struct tinywl_server *server, FILE *out)
+{
+	struct wayback_touch *touch = server->touch;
+	if (touch == NULL || touch->events == 0)
+		return;
+
+	fprintf(out,
+	        "touch: %" PRIu64 " events, latency %.1f ms average, %u ms max\n",
+	        touch->events,
+	        (double)touch->latency_msec_total / touch->events,
+	        touch->latency_msec_max);
+}
+
+void touch_destroy(struct tinywl_server *server)
+{
+	struct wayback_touch *touch = server->touch;
+	if (touch == NULL)
+		return;
+
+	struct touch_device *device, *tmp;
+	wl_list_for_each_safe(device, tmp, &touch->devices, link)
+	{
+		wl_list_remove(&device->destroy.link);
+		wl_list_remove(&device->link);
+		wayback_pool_free(&touch_device_pool, device);
+	}
+	wl_list_remove(&touch->down.link);
+	wl_list_remove(&touch->up.link);
+	wl_list_remove(&touch->motion.link);
+	wl_list_remove(&touch->cancel.link);
+	wl_list_remove(&touch->frame.link);
+	free(touch);
+	server->touch = NULL;
+}
@@ -0,0 +1,115 @@
+/*
+ * Virtual pointer and keyboard for automated input latency benchmarks.
+ *
+ * Only offered when the compositor is started with
+ * WAYBACK_VIRTUAL_INPUT_FD=<fd>, a connected socket that becomes a
+ * privileged Wayland client. The globals are hidden from every other
+ * client, so Xwayland and its X clients can't inject input.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "utils.h"
+#include "wayback-compositor.h"
+#include "wayback_log.h"
+#include "wayback_metrics.h"
+
+#include <stdlib.h>
+#include <wayland-server-core.h>
+#include <wlr/types/wlr_virtual_keyboard_v1.h>
+#include <wlr/types/wlr_virtual_pointer_v1.h>
+
+struct wayback_virtual_input
+{
+	struct tinywl_server *server;
+	struct wl_client *client;
+	struct wlr_virtual_pointer_manager_v1 *pointer_manager;
+	struct wlr_virtual_keyboard_manager_v1 *keyboard_manager;
+
+	struct wl_listener new_pointer;
+	struct wl_listener new_keyboard;
+	struct wl_listener client_destroy;
+};
+
+static void virtual_input_new_pointer(struct wl_listener *listener, void *data)
+{
+	struct wayback_virtual_input *vinput = wl_container_of(listener, vinput, new_pointer);
+	struct wlr_virtual_pointer_v1_new_pointer_event *event = data;
+
+	server_add_input(vinput->server, &event->new_pointer->pointer.base);
+}
+
+static void virtual_input_new_keyboard(struct wl_listener *listener, void *data)
+{
+	struct wayback_virtual_input *vinput = wl_container_of(listener, vinput, new_keyboard);
+	struct wlr_virtual_keyboard_v1 *keyboard = data;
+
+	server_add_input(vinput->server, &keyboard->keyboard.base);
+}
+
+static void virtual_input_client_destroy(struct wl_listener *listener, void *data)
+{
+	struct wayback_virtual_input *vinput = wl_container_of(listener, vinput, client_destroy);
+
+	/* Unlike Xwayland going away, the session carries on without it. */
+	wl_list_remove(&vinput->client_destroy.link);
+	wl_list_init(&vinput->client_destroy.link);
+	vinput->client = NULL;
+	WAYBACK_METRICS_ADD(vinput->server->metrics, clients, -1);
+}
+
+bool virtual_input_create(struct tinywl_server *server, int fd)
+{
+	struct wayback_virtual_input *vinput = calloc(1, sizeof(*vinput));
+	if (vinput == NULL)
+		return false;
+	vinput->server = server;
+
+	set_cloexec(fd);
+	vinput->client = wl_client_create(server->wl_display, fd);
+	if (vinput->client == NULL) {
+		wayback_log(LOG_ERROR, "Failed to connect to virtual input client");
+		free(vinput);
+		return false;
+	}
+	vinput->client_destroy.notify = virtual_input_client_destroy;
+	wl_client_add_destroy_listener(vinput->client, &vinput->client_destroy);
+	WAYBACK_METRICS_ADD(server->metrics, clients, 1);
+
+	vinput->pointer_manager = wlr_virtual_pointer_manager_v1_create(server->wl_display);
+	vinput->keyboard_manager = wlr_virtual_keyboard_manager_v1_create(server->wl_display);
+	vinput->new_pointer.notify = virtual_input_new_pointer;
+	wl_signal_add(&vinput->pointer_manager->events.new_virtual_pointer, &vinput->new_pointer);
+	vinput->new_keyboard.notify = virtual_input_new_keyboard;
+	wl_signal_add(&vinput->keyboard_manager->events.new_virtual_keyboard, &vinput->new_keyboard);
+
+	server->virtual_input = vinput;
+	wayback_log(LOG_INFO, "Virtual input enabled for benchmark client");
+	return true;
+}
+
+bool virtual_input_global_visible(struct tinywl_server *server,
+                                  const struct wl_client *client,
+                                  const struct wl_global *global)
+{
+	struct wayback_virtual_input *vinput = server->virtual_input;
+
+	if (vinput == NULL)
+		return true;
+	if (global == vinput->pointer_manager->global || global == vinput->keyboard_manager->global)
+		return client == vinput->client;
+	return true;
+}
+
+void virtual_input_destroy(struct tinywl_server *server)
+{
+	struct wayback_virtual_input *vinput = server->virtual_input;
+	if (vinput == NULL)
+		return;
+
+	wl_list_remove(&vinput->new_pointer.link);
+	wl_list_remove(&vinput->new_keyboard.link);
+	wl_list_remove(&vinput->client_destroy.link);
+	free(vinput);
+	server->virtual_input = NULL;
+}
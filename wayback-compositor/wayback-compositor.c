@@ -6,28 +6,37 @@
  */
 
 #include "utils.h"
+#include "wayback-compositor.h"
 #include "wayback_log.h"
+#include "wayback_mem.h"
+#include "wayback_metrics.h"
+#include "wayback_output_cache.h"
 
 #include <assert.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
 #include <wayland-server-core.h>
 #include <wlr/backend.h>
-#include <wlr/backend/multi.h>
 #include <wlr/backend/session.h>
+#include <wlr/backend/wayland.h>
 #include <wlr/render/allocator.h>
+#include <wlr/render/swapchain.h>
 #include <wlr/render/wlr_renderer.h>
 #include <wlr/types/wlr_compositor.h>
 #include <wlr/types/wlr_cursor.h>
 #include <wlr/types/wlr_data_device.h>
 #include <wlr/types/wlr_input_device.h>
 #include <wlr/types/wlr_keyboard.h>
+#include <wlr/types/wlr_linux_dmabuf_v1.h>
 #include <wlr/types/wlr_output.h>
 #include <wlr/types/wlr_output_layout.h>
 #include <wlr/types/wlr_pointer.h>
@@ -38,98 +47,11 @@
 #include <wlr/types/wlr_xdg_output_v1.h>
 #include <wlr/types/wlr_xdg_shell.h>
 #include <wlr/util/log.h>
-#include <xkbcommon/xkbcommon.h>
 
-/* For brevity's sake, struct members are annotated where they are used. */
-struct tinywl_server
-{
-	struct wl_display *wl_display;
-	struct wlr_backend *backend;
-	struct wlr_renderer *renderer;
-	struct wlr_allocator *allocator;
-	struct wlr_session *session;
-	struct wlr_scene *scene;
-	struct wlr_scene_output_layout *scene_layout;
-
-	struct wlr_xdg_shell *xdg_shell;
-	struct wl_listener new_xdg_toplevel;
-	struct wl_listener new_xdg_popup;
-	struct wl_list toplevels;
-
-	struct wlr_xdg_output_manager_v1 *xdg_output_manager_v1;
-
-	struct wlr_cursor *cursor;
-	struct wlr_xcursor_manager *cursor_mgr;
-	struct wl_listener cursor_motion;
-	struct wl_listener cursor_motion_absolute;
-	struct wl_listener cursor_button;
-	struct wl_listener cursor_axis;
-	struct wl_listener cursor_frame;
-
-	struct wlr_seat *seat;
-	struct wl_listener new_input;
-	struct wl_listener request_cursor;
-	struct wl_listener request_set_selection;
-	struct wl_list keyboards;
-	struct tinywl_toplevel *grabbed_toplevel;
-	double grab_x, grab_y;
-	struct wlr_box grab_geobox;
-	uint32_t resize_edges;
-
-	struct wlr_output_layout *output_layout;
-	struct wl_list outputs;
-	struct wl_listener new_output;
-
-	int width, height;
-};
-
-struct tinywl_output
-{
-	struct wl_list link;
-	struct tinywl_server *server;
-	struct wlr_output *wlr_output;
-	struct wl_listener frame;
-	struct wl_listener request_state;
-	struct wl_listener destroy;
-};
-
-struct tinywl_toplevel
-{
-	struct wl_list link;
-	struct tinywl_server *server;
-	struct wlr_xdg_toplevel *xdg_toplevel;
-	struct wlr_scene_tree *scene_tree;
-	struct wl_listener map;
-	struct wl_listener unmap;
-	struct wl_listener commit;
-	struct wl_listener destroy;
-	struct wl_listener request_maximize;
-	struct wl_listener request_fullscreen;
-};
-
-struct tinywl_popup
-{
-	struct wlr_xdg_popup *xdg_popup;
-	struct wl_listener commit;
-	struct wl_listener destroy;
-};
-
-struct tinywl_keyboard
-{
-	struct wl_list link;
-	struct tinywl_server *server;
-	struct wlr_keyboard *wlr_keyboard;
-
-	struct wl_listener modifiers;
-	struct wl_listener key;
-	struct wl_listener destroy;
-};
-
-struct wayback_client
-{
-	struct tinywl_server *server;
-	struct wl_listener destroy;
-};
+WAYBACK_POOL(keyboard_pool, "keyboards", struct tinywl_keyboard);
+WAYBACK_POOL(output_pool, "outputs", struct tinywl_output);
+WAYBACK_POOL(toplevel_pool, "toplevels", struct tinywl_toplevel);
+WAYBACK_POOL(popup_pool, "popups", struct tinywl_popup);
 
 static void keyboard_handle_modifiers(struct wl_listener *listener, void *data)
 {
@@ -143,32 +65,11 @@ static void keyboard_handle_modifiers(struct wl_listener *listener, void *data)
 	 * wlr_seat handles this transparently.
 	 */
 	wlr_seat_set_keyboard(keyboard->server->seat, keyboard->wlr_keyboard);
+	keyboard->modifier_mask = wlr_keyboard_get_modifiers(keyboard->wlr_keyboard);
 	/* Send modifiers to the client. */
 	wlr_seat_keyboard_notify_modifiers(keyboard->server->seat, &keyboard->wlr_keyboard->modifiers);
 }
 
-static bool handle_keybinding(struct tinywl_server *server, xkb_keysym_t sym)
-{
-	/*
-	 * Here we handle compositor keybindings. This is when the compositor is
-	 * processing keys, rather than passing them on to the client for its own
-	 * processing.
-	 *
-	 * This function assumes Ctrl and Alt are held down.
-	 */
-	if (sym == XKB_KEY_BackSpace) {
-		wl_display_terminate(server->wl_display);
-	} else if (sym >= XKB_KEY_XF86Switch_VT_1 && sym <= XKB_KEY_XF86Switch_VT_12) {
-		if (wlr_backend_is_multi(server->backend) && server->session) {
-			unsigned int vt = sym - XKB_KEY_XF86Switch_VT_1 + 1;
-			wlr_session_change_vt(server->session, vt);
-		}
-	} else {
-		return false;
-	}
-	return true;
-}
-
 static void keyboard_handle_key(struct wl_listener *listener, void *data)
 {
 	/* This event is raised when a key is pressed or released. */
@@ -177,24 +78,19 @@ static void keyboard_handle_key(struct wl_listener *listener, void *data)
 	struct wlr_keyboard_key_event *event = data;
 	struct wlr_seat *seat = server->seat;
 
-	/* Translate libinput keycode -> xkbcommon */
-	uint32_t keycode = event->keycode + 8;
-	/* Get a list of keysyms based on the keymap for this keyboard */
-	const xkb_keysym_t *syms;
-	int nsyms = xkb_state_key_get_syms(keyboard->wlr_keyboard->xkb_state, keycode, &syms);
-
-	bool handled = false;
-	uint32_t modifiers = wlr_keyboard_get_modifiers(keyboard->wlr_keyboard);
-	if ((modifiers & WLR_MODIFIER_ALT && modifiers & WLR_MODIFIER_CTRL) &&
-	    event->state == WL_KEYBOARD_KEY_STATE_PRESSED) {
-		/* If alt is held down and this button was _pressed_, we attempt to
-		 * process it as a compositor keybinding. */
-		for (int i = 0; i < nsyms; i++) {
-			handled = handle_keybinding(server, syms[i]);
-			if (handled)
-				break;
-		}
-	}
+	wayback_rate_tick(&server->input_rate, event->time_msec);
+	WAYBACK_METRICS_ADD(server->metrics, key_events, 1);
+	if (server->trace)
+		wayback_log(LOG_INFO,
+		            "trace: key %u %s at %u",
+		            event->keycode,
+		            event->state == WL_KEYBOARD_KEY_STATE_PRESSED ? "pressed" : "released",
+		            event->time_msec);
+
+	/* If this button was _pressed_, we attempt to process it as a
+	 * compositor keybinding. */
+	bool handled = event->state == WL_KEYBOARD_KEY_STATE_PRESSED &&
+	               keybindings_handle_key(keyboard, event->keycode);
 
 	if (!handled) {
 		/* Otherwise, we pass it along to the client. */
@@ -214,27 +110,20 @@ static void keyboard_handle_destroy(struct wl_listener *listener, void *data)
 	wl_list_remove(&keyboard->key.link);
 	wl_list_remove(&keyboard->destroy.link);
 	wl_list_remove(&keyboard->link);
-	free(keyboard);
+	wayback_pool_free(&keyboard_pool, keyboard);
 }
 
 static void server_new_keyboard(struct tinywl_server *server, struct wlr_input_device *device)
 {
 	struct wlr_keyboard *wlr_keyboard = wlr_keyboard_from_input_device(device);
 
-	struct tinywl_keyboard *keyboard = calloc(1, sizeof(*keyboard));
+	struct tinywl_keyboard *keyboard = wayback_pool_alloc(&keyboard_pool);
 	keyboard->server = server;
 	keyboard->wlr_keyboard = wlr_keyboard;
 
-	/* We need to prepare an XKB keymap and assign it to the keyboard. This
-	 * assumes the defaults (e.g. layout = "us"). */
-	struct xkb_context *context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
-	struct xkb_keymap *keymap =
-		xkb_keymap_new_from_names(context, NULL, XKB_KEYMAP_COMPILE_NO_FLAGS);
-
-	wlr_keyboard_set_keymap(wlr_keyboard, keymap);
-	xkb_keymap_unref(keymap);
-	xkb_context_unref(context);
-	wlr_keyboard_set_repeat_info(wlr_keyboard, 25, 600);
+	/* We need to prepare an XKB keymap and assign it to the keyboard, along
+	 * with the repeat rate. Both come from the configuration file. */
+	config_apply_keyboard(server, wlr_keyboard);
 
 	/* Here we set up listeners for keyboard events. */
 	keyboard->modifiers.notify = keyboard_handle_modifiers;
@@ -259,12 +148,8 @@ static void server_new_pointer(struct tinywl_server *server, struct wlr_input_de
 	wlr_cursor_attach_input_device(server->cursor, device);
 }
 
-static void server_new_input(struct wl_listener *listener, void *data)
+void server_add_input(struct tinywl_server *server, struct wlr_input_device *device)
 {
-	/* This event is raised by the backend when a new input device becomes
-	 * available. */
-	struct tinywl_server *server = wl_container_of(listener, server, new_input);
-	struct wlr_input_device *device = data;
 	switch (device->type) {
 		case WLR_INPUT_DEVICE_KEYBOARD:
 			server_new_keyboard(server, device);
@@ -272,9 +157,17 @@ static void server_new_input(struct wl_listener *listener, void *data)
 		case WLR_INPUT_DEVICE_POINTER:
 			server_new_pointer(server, device);
 			break;
+		case WLR_INPUT_DEVICE_TOUCH:
+			touch_add_device(server, device);
+			break;
 		default:
 			break;
 	}
+	server_update_capabilities(server);
+}
+
+void server_update_capabilities(struct tinywl_server *server)
+{
 	/* We need to let the wlr_seat know what our capabilities are, which is
 	 * communiciated to the client. In TinyWL we always have a cursor, even if
 	 * there are no pointer devices, so we always include that capability. */
@@ -282,9 +175,20 @@ static void server_new_input(struct wl_listener *listener, void *data)
 	if (!wl_list_empty(&server->keyboards)) {
 		caps |= WL_SEAT_CAPABILITY_KEYBOARD;
 	}
+	if (touch_has_devices(server)) {
+		caps |= WL_SEAT_CAPABILITY_TOUCH;
+	}
 	wlr_seat_set_capabilities(server->seat, caps);
 }
 
+static void server_new_input(struct wl_listener *listener, void *data)
+{
+	/* This event is raised by the backend when a new input device becomes
+	 * available. */
+	struct tinywl_server *server = wl_container_of(listener, server, new_input);
+	server_add_input(server, data);
+}
+
 static void seat_request_cursor(struct wl_listener *listener, void *data)
 {
 	struct tinywl_server *server = wl_container_of(listener, server, request_cursor);
@@ -317,15 +221,38 @@ static void client_destroy(struct wl_listener *listener, void *data)
 {
 	struct wayback_client *client = wl_container_of(listener, client, destroy);
 
-	wl_display_terminate(client->server->wl_display);
+	WAYBACK_METRICS_ADD(client->server->metrics, clients, -1);
+	connection_remove(client);
+	server_terminate(client->server);
+}
+
+void server_terminate(struct tinywl_server *server)
+{
+	wl_display_terminate(server->wl_display);
+}
+
+/* Hides privileged globals from the clients they are not meant for. */
+static bool server_global_filter(const struct wl_client *client,
+                                 const struct wl_global *global,
+                                 void *data)
+{
+	struct tinywl_server *server = data;
+
+	if (!virtual_input_global_visible(server, client, global))
+		return false;
+#ifdef WAYBACK_HAVE_ROOTLESS
+	if (!xwm_global_visible(server, client, global))
+		return false;
+#endif
+	return true;
 }
 
-static struct tinywl_toplevel *desktop_toplevel_at(struct tinywl_server *server,
-                                                   double lx,
-                                                   double ly,
-                                                   struct wlr_surface **surface,
-                                                   double *sx,
-                                                   double *sy)
+struct tinywl_toplevel *desktop_toplevel_at(struct tinywl_server *server,
+                                            double lx,
+                                            double ly,
+                                            struct wlr_surface **surface,
+                                            double *sx,
+                                            double *sy)
 {
 	/* This returns the topmost node in the scene at the given layout coords.
 	 * We only care about surface nodes as we are specifically looking for a
@@ -347,11 +274,20 @@ static struct tinywl_toplevel *desktop_toplevel_at(struct tinywl_server *server,
 	while (tree != NULL && tree->node.data == NULL) {
 		tree = tree->node.parent;
 	}
-	return tree->node.data;
+	return tree != NULL ? tree->node.data : NULL;
 }
 
 static void process_cursor_motion(struct tinywl_server *server, uint32_t time)
 {
+	wayback_rate_tick(&server->input_rate, time);
+	WAYBACK_METRICS_ADD(server->metrics, pointer_motion_events, 1);
+	if (server->trace)
+		wayback_log(LOG_INFO,
+		            "trace: pointer motion to %.2f,%.2f at %u",
+		            server->cursor->x,
+		            server->cursor->y,
+		            time);
+
 	/* Otherwise, find the toplevel under the pointer and send the event along. */
 	double sx, sy;
 	struct wlr_seat *seat = server->seat;
@@ -420,8 +356,24 @@ static void server_cursor_button(struct wl_listener *listener, void *data)
 	 * event. */
 	struct tinywl_server *server = wl_container_of(listener, server, cursor_button);
 	struct wlr_pointer_button_event *event = data;
+	wayback_rate_tick(&server->input_rate, event->time_msec);
+	WAYBACK_METRICS_ADD(server->metrics, pointer_button_events, 1);
+	if (server->trace)
+		wayback_log(LOG_INFO,
+		            "trace: button %u %s at %u",
+		            event->button,
+		            event->state == WL_POINTER_BUTTON_STATE_PRESSED ? "pressed" : "released",
+		            event->time_msec);
 	/* Notify the client with pointer focus that a button press has occurred */
 	wlr_seat_pointer_notify_button(server->seat, event->time_msec, event->button, event->state);
+	if (event->state == WL_POINTER_BUTTON_STATE_PRESSED) {
+		/* Focus the client if the button was _pressed_ */
+		double sx, sy;
+		struct wlr_surface *surface = NULL;
+		struct tinywl_toplevel *toplevel =
+			desktop_toplevel_at(server, server->cursor->x, server->cursor->y, &surface, &sx, &sy);
+		focus_toplevel(toplevel);
+	}
 }
 
 static void server_cursor_axis(struct wl_listener *listener, void *data)
@@ -430,6 +382,10 @@ static void server_cursor_axis(struct wl_listener *listener, void *data)
 	 * for example when you move the scroll wheel. */
 	struct tinywl_server *server = wl_container_of(listener, server, cursor_axis);
 	struct wlr_pointer_axis_event *event = data;
+	wayback_rate_tick(&server->input_rate, event->time_msec);
+	WAYBACK_METRICS_ADD(server->metrics, pointer_axis_events, 1);
+	if (server->trace)
+		wayback_log(LOG_INFO, "trace: axis %.2f at %u", event->delta, event->time_msec);
 	/* Notify the client with pointer focus of the axis event. */
 	wlr_seat_pointer_notify_axis(server->seat,
 	                             event->time_msec,
@@ -451,21 +407,113 @@ static void server_cursor_frame(struct wl_listener *listener, void *data)
 	wlr_seat_pointer_notify_frame(server->seat);
 }
 
+/* Composites and commits a frame, or skips it if nothing changed. Returns
+ * the time it was done in now. */
+void output_render(struct tinywl_output *output, struct timespec *now)
+{
+	struct wlr_scene *scene = output->server->scene;
+
+	struct wlr_scene_output *scene_output = wlr_scene_get_scene_output(scene, output->wlr_output);
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	/* Render the scene if needed and commit the output. This is what
+	 * wlr_scene_output_commit() does, but we want to know whether the
+	 * frame was skipped, composited or scanned out directly.
+	 *
+	 * Until Xwayland has mapped a surface there is nothing to show but the
+	 * background, so leave the boot splash or whatever else is on screen. */
+	if (output->server->have_content && wlr_scene_output_needs_frame(scene_output)) {
+		struct wlr_output_state state;
+		wlr_output_state_init(&state);
+		bool committed = wlr_scene_output_build_state(scene_output, &state, NULL) &&
+		                 wlr_output_commit_state(output->wlr_output, &state);
+		bool scanout = committed && (state.committed & WLR_OUTPUT_STATE_BUFFER) &&
+		               output->wlr_output->swapchain != NULL &&
+		               !wlr_swapchain_has_buffer(output->wlr_output->swapchain, state.buffer);
+		wlr_output_state_finish(&state);
+
+		if (committed && output->nested && scanout != output->passthrough) {
+			output->passthrough = scanout;
+			wayback_log(LOG_DEBUG,
+			            scanout ? "%s: passing Xwayland buffers through to the parent compositor"
+			                    : "%s: compositing Xwayland buffers",
+			            output->wlr_output->name);
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, now);
+		uint64_t latency_usec =
+			(now->tv_sec - start.tv_sec) * 1000000 + (now->tv_nsec - start.tv_nsec) / 1000;
+		metrics_record_commit(output->server, committed, scanout, latency_usec);
+		if (committed)
+			frame_scheduler_record(output, &start, now);
+		if (committed && !scanout)
+			damage_record_frame(output->server, latency_usec);
+		if (committed && output->server->ready_fd >= 0 && wl_list_empty(&output->present.link))
+			wl_signal_add(&output->wlr_output->events.present, &output->present);
+	} else {
+		*now = start;
+		WAYBACK_METRICS_ADD(output->server->metrics, frames_skipped, 1);
+	}
+
+	uint32_t now_msec = now->tv_sec * 1000 + now->tv_nsec / 1000000;
+	wayback_rate_tick(&output->frame_rate, now_msec);
+	if (output->server->trace)
+		wayback_log(LOG_INFO, "trace: frame on %s at %u", output->wlr_output->name, now_msec);
+}
+
 static void output_frame(struct wl_listener *listener, void *data)
 {
 	/* This function is called every time an output is ready to display a frame,
 	 * generally at the output's refresh rate (e.g. 60Hz). */
 	struct tinywl_output *output = wl_container_of(listener, output, frame);
-	struct wlr_scene *scene = output->server->scene;
 
-	struct wlr_scene_output *scene_output = wlr_scene_get_scene_output(scene, output->wlr_output);
+	frame_scheduler_handle_frame(output);
+}
 
-	/* Render the scene if needed and commit the output */
-	wlr_scene_output_commit(scene_output, NULL);
+/*
+ * Switches to an advertised mode, the closest one in refresh rate if none
+ * was given, or to a custom mode on backends without a list of modes.
+ */
+bool output_set_mode(struct tinywl_output *output, int width, int height, int32_t refresh_mhz)
+{
+	struct wlr_output *wlr_output = output->wlr_output;
+
+	struct wlr_output_mode *mode, *best = NULL;
+	wl_list_for_each(mode, &wlr_output->modes, link)
+	{
+		if (mode->width != width || mode->height != height)
+			continue;
+		if (refresh_mhz > 0 && abs(mode->refresh - refresh_mhz) > 500)
+			continue;
+		if (best == NULL || (refresh_mhz <= 0 && mode->preferred) ||
+		    (refresh_mhz <= 0 && !best->preferred && mode->refresh > best->refresh))
+			best = mode;
+	}
 
-	struct timespec now;
-	clock_gettime(CLOCK_MONOTONIC, &now);
-	wlr_scene_output_send_frame_done(scene_output, &now);
+	struct wlr_output_state state;
+	wlr_output_state_init(&state);
+	if (best != NULL) {
+		/* Already there, e.g. set by the boot splash, don't modeset */
+		if (best == wlr_output->current_mode && wlr_output->enabled) {
+			wlr_output_state_finish(&state);
+			return true;
+		}
+		wlr_output_state_set_mode(&state, best);
+	} else if (wl_list_empty(&wlr_output->modes)) {
+		wlr_output_state_set_custom_mode(&state, width, height, refresh_mhz);
+	} else {
+		wlr_output_state_finish(&state);
+		return false;
+	}
+	wlr_output_state_set_enabled(&state, true);
+
+	bool ok = wlr_output_commit_state(wlr_output, &state);
+	wlr_output_state_finish(&state);
+	if (ok)
+		output_cache_save(output);
+	return ok;
 }
 
 static void output_request_state(struct wl_listener *listener, void *data)
@@ -478,15 +526,44 @@ static void output_request_state(struct wl_listener *listener, void *data)
 	wlr_output_commit_state(output->wlr_output, event->state);
 }
 
+/*
+ * Tells whoever started us (see WAYBACK_READY_FD) that X clients can be
+ * shown now, e.g. so that wayback-session launches the desktop.
+ */
+void server_signal_ready(struct tinywl_server *server)
+{
+	if (server->ready_fd < 0)
+		return;
+	if (write(server->ready_fd, "ready\n", 6) != 6)
+		wayback_log(LOG_WARN, "Failed to signal readiness: %s", strerror(errno));
+	close(server->ready_fd);
+	server->ready_fd = -1;
+	wayback_log(LOG_DEBUG, "Signalled readiness");
+}
+
+static void output_present(struct wl_listener *listener, void *data)
+{
+	struct tinywl_output *output = wl_container_of(listener, output, present);
+	const struct wlr_output_event_present *event = data;
+
+	wl_list_remove(&output->present.link);
+	wl_list_init(&output->present.link);
+	/* A discarded frame doesn't count, the next commit listens again */
+	if (event->presented)
+		server_signal_ready(output->server);
+}
+
 static void output_destroy(struct wl_listener *listener, void *data)
 {
 	struct tinywl_output *output = wl_container_of(listener, output, destroy);
 
+	frame_scheduler_finish(output);
+	wl_list_remove(&output->present.link);
 	wl_list_remove(&output->frame.link);
 	wl_list_remove(&output->request_state.link);
 	wl_list_remove(&output->destroy.link);
 	wl_list_remove(&output->link);
-	free(output);
+	wayback_pool_free(&output_pool, output);
 }
 
 static void server_new_output(struct wl_listener *listener, void *data)
@@ -500,29 +577,63 @@ static void server_new_output(struct wl_listener *listener, void *data)
 	 * and our renderer. Must be done once, before commiting the output */
 	wlr_output_init_render(wlr_output, server->allocator, server->renderer);
 
-	/* The output may be disabled, switch it on. */
-	struct wlr_output_state state;
-	wlr_output_state_init(&state);
-	wlr_output_state_set_enabled(&state, true);
+	/* A monitor seen before gets what it had last time, unless the
+	 * configuration file says otherwise */
+	const struct wayback_output_cache_entry *cached = NULL;
+	if (!wlr_output_is_wl(wlr_output) && !config_output_has_mode(server, wlr_output))
+		cached = output_cache_apply(server, wlr_output);
+
+	/* The DRM backend picks up whatever the CRTC is already driving, e.g. a
+	 * mode set by the boot splash or the previous session. Keeping it avoids
+	 * a full modeset, which blanks the screen for a noticeable moment. */
+	struct wlr_output_mode *active = wlr_output->current_mode;
+	bool kept_mode = false;
+	if (cached != NULL) {
+		/* Set up already */
+	} else if (wlr_output->enabled && active != NULL) {
+		kept_mode = true;
+		wayback_log(LOG_INFO,
+		            "%s: keeping active mode %dx%d@%.3fHz",
+		            wlr_output->name,
+		            active->width,
+		            active->height,
+		            active->refresh / 1000.0);
+	} else {
+		/* The output may be disabled, switch it on. */
+		struct wlr_output_state state;
+		wlr_output_state_init(&state);
+		wlr_output_state_set_enabled(&state, true);
+
+		/* Some backends don't have modes. DRM+KMS does, and we need to set a mode
+		 * before we can use the output. The mode is a tuple of (width, height,
+		 * refresh rate), and each monitor supports only a specific set of modes. We
+		 * just pick the monitor's preferred mode, a more sophisticated compositor
+		 * would let the user configure it. */
+		struct wlr_output_mode *mode = wlr_output_preferred_mode(wlr_output);
+		if (mode != NULL) {
+			wlr_output_state_set_mode(&state, mode);
+		}
 
-	/* Some backends don't have modes. DRM+KMS does, and we need to set a mode
-	 * before we can use the output. The mode is a tuple of (width, height,
-	 * refresh rate), and each monitor supports only a specific set of modes. We
-	 * just pick the monitor's preferred mode, a more sophisticated compositor
-	 * would let the user configure it. */
-	struct wlr_output_mode *mode = wlr_output_preferred_mode(wlr_output);
-	if (mode != NULL) {
-		wlr_output_state_set_mode(&state, mode);
+		/* Atomically applies the new output state. */
+		wlr_output_commit_state(wlr_output, &state);
+		wlr_output_state_finish(&state);
 	}
 
-	/* Atomically applies the new output state. */
-	wlr_output_commit_state(wlr_output, &state);
-	wlr_output_state_finish(&state);
-
 	/* Allocates and configures our state for this output */
-	struct tinywl_output *output = calloc(1, sizeof(*output));
+	struct tinywl_output *output = wayback_pool_alloc(&output_pool);
 	output->wlr_output = wlr_output;
 	output->server = server;
+	output->kept_mode = kept_mode;
+
+	/* When nested, a frame that is a single buffer covering the output is
+	 * attached to the parent's surface as is (shm or dmabuf) instead of being
+	 * composited into one of our own buffers first. wlr_scene takes care of
+	 * that as long as nothing else is drawn on top of the rootful surface. */
+	output->nested = wlr_output_is_wl(wlr_output);
+	frame_scheduler_init(output);
+	output->present.notify = output_present;
+	wl_list_init(&output->present.link);
+	config_apply_output(server, output);
 
 	/* Sets up a listener for the frame event. */
 	output->frame.notify = output_frame;
@@ -548,7 +659,9 @@ static void server_new_output(struct wl_listener *listener, void *data)
 	 * output (such as DPI, scale factor, manufacturer, etc).
 	 */
 	struct wlr_output_layout_output *l_output =
-		wlr_output_layout_add_auto(server->output_layout, wlr_output);
+		cached != NULL
+			? wlr_output_layout_add(server->output_layout, wlr_output, cached->x, cached->y)
+			: wlr_output_layout_add_auto(server->output_layout, wlr_output);
 	struct wlr_scene_output *scene_output = wlr_scene_output_create(server->scene, wlr_output);
 	wlr_scene_output_layout_add_output(server->scene_layout, l_output, scene_output);
 
@@ -558,18 +671,35 @@ static void server_new_output(struct wl_listener *listener, void *data)
 	/* XXX: this is definitely wrong, but whatever, it's good enough for now */
 	server->width += width;
 	server->height += height;
+
+	output_cache_save(output);
 }
 
-static void focus_toplevel(struct tinywl_toplevel *toplevel)
+static struct wlr_surface *toplevel_surface(struct tinywl_toplevel *toplevel)
+{
+#ifdef WAYBACK_HAVE_ROOTLESS
+	if (toplevel->xwindow != NULL)
+		return xwm_surface(toplevel);
+#endif
+	return toplevel->xdg_toplevel->base->surface;
+}
+
+void focus_toplevel(struct tinywl_toplevel *toplevel)
 {
 	/* Note: this function only deals with keyboard focus. */
 	if (toplevel == NULL) {
 		return;
 	}
+#ifdef WAYBACK_HAVE_ROOTLESS
+	/* Menus and tooltips must not steal focus from their owner */
+	if (toplevel->xwindow != NULL && !xwm_wants_focus(toplevel)) {
+		return;
+	}
+#endif
 	struct tinywl_server *server = toplevel->server;
 	struct wlr_seat *seat = server->seat;
 	struct wlr_surface *prev_surface = seat->keyboard_state.focused_surface;
-	struct wlr_surface *surface = toplevel->xdg_toplevel->base->surface;
+	struct wlr_surface *surface = toplevel_surface(toplevel);
 	if (prev_surface == surface) {
 		/* Don't re-focus an already focused surface. */
 		return;
@@ -592,7 +722,12 @@ static void focus_toplevel(struct tinywl_toplevel *toplevel)
 	wl_list_remove(&toplevel->link);
 	wl_list_insert(&server->toplevels, &toplevel->link);
 	/* Activate the new surface */
-	wlr_xdg_toplevel_set_activated(toplevel->xdg_toplevel, true);
+#ifdef WAYBACK_HAVE_ROOTLESS
+	if (toplevel->xwindow != NULL)
+		xwm_activate(toplevel);
+	else
+#endif
+		wlr_xdg_toplevel_set_activated(toplevel->xdg_toplevel, true);
 	/*
 	 * Tell the seat to have the keyboard enter this surface. wlroots will keep
 	 * track of this and automatically send key events to the appropriate
@@ -610,6 +745,7 @@ static void xdg_toplevel_map(struct wl_listener *listener, void *data)
 	struct tinywl_toplevel *toplevel = wl_container_of(listener, toplevel, map);
 
 	wl_list_insert(&toplevel->server->toplevels, &toplevel->link);
+	toplevel->server->have_content = true;
 
 	focus_toplevel(toplevel);
 }
@@ -630,11 +766,32 @@ static void xdg_toplevel_commit(struct wl_listener *listener, void *data)
 		/* When an xdg_surface performs an initial commit, the compositor must
 		 * reply with a configure so the client can map the surface. tinywl
 		 * configures the xdg_toplevel with 0,0 size to let the client pick the
-		 * dimensions itself. */
-		wlr_xdg_toplevel_set_size(toplevel->xdg_toplevel, 0, 0);
+		 * dimensions itself.
+		 *
+		 * When Xwayback started Xwayland with a guessed -geometry (see
+		 * WAYBACK_SPECULATIVE_SPAWN), its rootful window is sized to the
+		 * output Xwayback settled on instead. That is the first one it was
+		 * told about, i.e. the oldest output, or the only one left with
+		 * WAYBACK_OUTPUT. Otherwise Xwayland already has the right size. */
+		struct tinywl_server *server = toplevel->server;
+		int width = 0, height = 0;
+		if (server->speculative_spawn && !wl_list_empty(&server->outputs) &&
+		    wl_resource_get_client(toplevel->xdg_toplevel->resource) == server->xwayland_client) {
+			struct tinywl_output *output = wl_container_of(server->outputs.prev, output, link);
+			wlr_output_effective_resolution(output->wlr_output, &width, &height);
+		}
+		wlr_xdg_toplevel_set_size(toplevel->xdg_toplevel, width, height);
 	}
 }
 
+static void xdg_toplevel_client_commit(struct wl_listener *listener, void *data)
+{
+	/* Called when the client requests a commit, before the new state is applied. */
+	struct tinywl_toplevel *toplevel = wl_container_of(listener, toplevel, client_commit);
+
+	metrics_record_surface_state(toplevel->server, &toplevel->xdg_toplevel->base->surface->pending);
+}
+
 static void xdg_toplevel_destroy(struct wl_listener *listener, void *data)
 {
 	/* Called when the xdg_toplevel is destroyed. */
@@ -643,11 +800,12 @@ static void xdg_toplevel_destroy(struct wl_listener *listener, void *data)
 	wl_list_remove(&toplevel->map.link);
 	wl_list_remove(&toplevel->unmap.link);
 	wl_list_remove(&toplevel->commit.link);
+	wl_list_remove(&toplevel->client_commit.link);
 	wl_list_remove(&toplevel->destroy.link);
 	wl_list_remove(&toplevel->request_maximize.link);
 	wl_list_remove(&toplevel->request_fullscreen.link);
 
-	free(toplevel);
+	wayback_pool_free(&toplevel_pool, toplevel);
 }
 
 static void xdg_toplevel_request_maximize(struct wl_listener *listener, void *data)
@@ -681,7 +839,7 @@ static void server_new_xdg_toplevel(struct wl_listener *listener, void *data)
 	struct wlr_xdg_toplevel *xdg_toplevel = data;
 
 	/* Allocate a tinywl_toplevel for this surface */
-	struct tinywl_toplevel *toplevel = calloc(1, sizeof(*toplevel));
+	struct tinywl_toplevel *toplevel = wayback_pool_alloc(&toplevel_pool);
 	toplevel->server = server;
 	toplevel->xdg_toplevel = xdg_toplevel;
 	toplevel->scene_tree =
@@ -696,6 +854,8 @@ static void server_new_xdg_toplevel(struct wl_listener *listener, void *data)
 	wl_signal_add(&xdg_toplevel->base->surface->events.unmap, &toplevel->unmap);
 	toplevel->commit.notify = xdg_toplevel_commit;
 	wl_signal_add(&xdg_toplevel->base->surface->events.commit, &toplevel->commit);
+	toplevel->client_commit.notify = xdg_toplevel_client_commit;
+	wl_signal_add(&xdg_toplevel->base->surface->events.client_commit, &toplevel->client_commit);
 
 	toplevel->destroy.notify = xdg_toplevel_destroy;
 	wl_signal_add(&xdg_toplevel->events.destroy, &toplevel->destroy);
@@ -730,7 +890,7 @@ static void xdg_popup_destroy(struct wl_listener *listener, void *data)
 	wl_list_remove(&popup->commit.link);
 	wl_list_remove(&popup->destroy.link);
 
-	free(popup);
+	wayback_pool_free(&popup_pool, popup);
 }
 
 static void server_new_xdg_popup(struct wl_listener *listener, void *data)
@@ -738,7 +898,7 @@ static void server_new_xdg_popup(struct wl_listener *listener, void *data)
 	/* This event is raised when a client creates a new popup. */
 	struct wlr_xdg_popup *xdg_popup = data;
 
-	struct tinywl_popup *popup = calloc(1, sizeof(*popup));
+	struct tinywl_popup *popup = wayback_pool_alloc(&popup_pool);
 	popup->xdg_popup = xdg_popup;
 
 	/* We must add xdg popups to the scene graph so they get rendered. The
@@ -758,6 +918,13 @@ static void server_new_xdg_popup(struct wl_listener *listener, void *data)
 	wl_signal_add(&xdg_popup->events.destroy, &popup->destroy);
 }
 
+uint32_t get_time_msec(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
 int set_cloexec(int fd)
 {
 	int flags = fcntl(fd, F_GETFD);
@@ -775,6 +942,9 @@ static void wayback_wlr_vlog(enum wayback_log_level verbosity, const char *fmt,
 		[LOG_DEBUG] = WLR_DEBUG,
 	};
 
+	if (!wayback_log_enabled(verbosity))
+		return;
+
 	enum wayback_log_level verbosity_clamped = verbosity < LOG_LAST ? verbosity : LOG_LAST - 1;
 	enum wlr_log_importance importance = importance_map[verbosity_clamped];
 
@@ -825,6 +995,12 @@ int main(int argc, char *argv[])
 				break;
 		}
 	}
+	/* wlroots formats its messages before calling the log handler, so keep
+	 * it from doing so for levels that are compiled out here. */
+	if (WAYBACK_LOG_MAX_LEVEL < LOG_DEBUG && wlr_log_verb > WLR_INFO)
+		wlr_log_verb = WLR_INFO;
+	if (WAYBACK_LOG_MAX_LEVEL < LOG_INFO)
+		wlr_log_verb = WLR_ERROR;
 	wlr_log_init(wlr_log_verb, NULL);
 	wayback_log_init("wayback-compositor", wayback_log_verb, wayback_wlr_vlog);
 
@@ -843,6 +1019,8 @@ int main(int argc, char *argv[])
 	/* The Wayland display is managed by libwayland. It handles accepting
 	 * clients from the Unix socket, manging Wayland globals, and so on. */
 	server.wl_display = wl_display_create();
+	/* Parses the configuration file and starts watching it for changes */
+	config_create(&server);
 	/* The backend is a wlroots feature which abstracts the underlying input and
 	 * output hardware. The autocreate option will choose the most suitable
 	 * backend based on the current environment, such as opening an X11 window
@@ -864,13 +1042,24 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
-	wlr_renderer_init_wl_display(server.renderer, server.wl_display);
+	/* Like wlr_renderer_init_wl_display(), but keeping the linux-dmabuf global
+	 * so the scene can send per-surface feedback, see below. */
+	wlr_renderer_init_wl_shm(server.renderer, server.wl_display);
+	if (wlr_renderer_get_texture_formats(server.renderer, WLR_BUFFER_CAP_DMABUF) != NULL) {
+		server.linux_dmabuf_v1 =
+			wlr_linux_dmabuf_v1_create_with_renderer(server.wl_display, 4, server.renderer);
+	}
 
 	/* Autocreates an allocator for us.
 	 * The allocator is the bridge between the renderer and the backend. It
 	 * handles the buffer creation, allowing wlroots to render onto the
-	 * screen */
-	server.allocator = wlr_allocator_autocreate(server.backend, server.renderer);
+	 * screen. Without a GPU, huge pages make compositing into large buffers
+	 * cheaper, see render_buffers.c. */
+	const char *huge_pages = getenv("WAYBACK_HUGE_PAGES");
+	if (huge_pages != NULL && strcmp(huge_pages, "0") != 0)
+		server.allocator = render_allocator_create(server.backend, server.renderer);
+	if (server.allocator == NULL)
+		server.allocator = wlr_allocator_autocreate(server.backend, server.renderer);
 	if (server.allocator == NULL) {
 		wlr_log(WLR_ERROR, "failed to create wlr_allocator");
 		return 1;
@@ -883,8 +1072,12 @@ int main(int argc, char *argv[])
 	 * to dig your fingers in and play with their behavior if you want. Note that
 	 * the clients cannot set the selection directly without compositor approval,
 	 * see the handling of the request_set_selection event below.*/
-	wlr_compositor_create(server.wl_display, 5, server.renderer);
+	struct wlr_compositor *compositor =
+		wlr_compositor_create(server.wl_display, 5, server.renderer);
 	wlr_subcompositor_create(server.wl_display);
+	server.damage_policy = config_damage_policy(&server);
+	if (!damage_create(&server, compositor))
+		wayback_log(LOG_WARN, "Damage is not coalesced");
 	wlr_data_device_manager_create(server.wl_display);
 
 	/* Creates an output layout, which a wlroots utility for working with an
@@ -894,6 +1087,7 @@ int main(int argc, char *argv[])
 	/* Configure a listener to be notified when new outputs are available on the
 	 * backend. */
 	wl_list_init(&server.outputs);
+	server.output_cache = wayback_output_cache_map();
 	server.new_output.notify = server_new_output;
 	wl_signal_add(&server.backend->events.new_output, &server.new_output);
 
@@ -906,6 +1100,12 @@ int main(int argc, char *argv[])
 	server.scene = wlr_scene_create();
 	server.scene_layout = wlr_scene_attach_output_layout(server.scene, server.output_layout);
 
+	/* Tell Xwayland which formats and modifiers the output can take as is.
+	 * Nested, those are the ones the parent compositor accepts, so the
+	 * rootful surface's buffers can be handed to it without compositing. */
+	if (server.linux_dmabuf_v1 != NULL)
+		wlr_scene_set_linux_dmabuf_v1(server.scene, server.linux_dmabuf_v1);
+
 	/* Set up xdg-shell version 3. The xdg-shell is a Wayland protocol which is
 	 * used for application windows. For more detail on shells, refer to
 	 * https://drewdevault.com/2018/07/29/Wayland-shells.html.
@@ -932,7 +1132,7 @@ int main(int argc, char *argv[])
 	 * Xcursor themes to source cursor images from and makes sure that cursor
 	 * images are available at all scale factors on the screen (necessary for
 	 * HiDPI support). */
-	server.cursor_mgr = wlr_xcursor_manager_create(NULL, 24);
+	config_apply_cursor(&server);
 
 	/*
 	 * wlr_cursor *only* displays an image on screen. It does not move around
@@ -954,6 +1154,8 @@ int main(int argc, char *argv[])
 	wl_signal_add(&server.cursor->events.axis, &server.cursor_axis);
 	server.cursor_frame.notify = server_cursor_frame;
 	wl_signal_add(&server.cursor->events.frame, &server.cursor_frame);
+	if (!touch_create(&server))
+		wayback_log(LOG_WARN, "Touchscreens are not supported");
 
 	/*
 	 * Configures a seat, which is a single "seat" at which a user sits and
@@ -962,6 +1164,7 @@ int main(int argc, char *argv[])
 	 * let us know when new input devices are available on the backend.
 	 */
 	wl_list_init(&server.keyboards);
+	wl_list_init(&server.clients);
 	server.new_input.notify = server_new_input;
 	wl_signal_add(&server.backend->events.new_input, &server.new_input);
 	server.seat = wlr_seat_create(server.wl_display, "seat0");
@@ -970,6 +1173,43 @@ int main(int argc, char *argv[])
 	server.request_set_selection.notify = seat_request_set_selection;
 	wl_signal_add(&server.seat->events.request_set_selection, &server.request_set_selection);
 
+	metrics_create(&server);
+
+	const char *keybindings = getenv("WAYBACK_KEYBINDINGS");
+	if (keybindings != NULL) {
+		if (!keybindings_load(&server, keybindings))
+			exit(EXIT_FAILURE);
+	} else if (!keybindings_load(&server, config_keybindings(&server))) {
+		wayback_log(LOG_WARN, "Using the default keybindings");
+		keybindings_load(&server, NULL);
+	}
+
+	server.frame_policy = config_frame_policy(&server);
+	const char *frame_policy = getenv("WAYBACK_FRAME_POLICY");
+	if (frame_policy != NULL && !frame_policy_from_name(frame_policy, &server.frame_policy)) {
+		wayback_log(LOG_ERROR, "Unknown frame policy %s", frame_policy);
+		exit(EXIT_FAILURE);
+	}
+
+	const char *profile = getenv("WAYBACK_PROTOCOL_PROFILE");
+	if (profile != NULL) {
+		long interval = strtol(profile, NULL, 10);
+		if (interval < 0)
+			interval = 0;
+		/* The profiler takes milliseconds in 32 bits, about 49 days at most */
+		if (interval > UINT32_MAX / 1000) {
+			wayback_log(LOG_WARN, "Protocol profile interval %ld too long, using %u seconds",
+			            interval, UINT32_MAX / 1000);
+			interval = UINT32_MAX / 1000;
+		}
+		if (!profiler_enable(&server, (uint32_t)interval * 1000))
+			wayback_log(LOG_WARN, "Failed to enable protocol profiler");
+	}
+
+	const char *record = getenv("WAYBACK_RECORD");
+	if (record != NULL && !recorder_create(&server, record))
+		exit(EXIT_FAILURE);
+
 	/* Add a Unix socket to the Wayland display. */
 	set_cloexec(xwayback_session_socket);
 	struct wl_client *xwayback_client =
@@ -981,9 +1221,11 @@ int main(int argc, char *argv[])
 	}
 
 	struct wayback_client xwayback = { 0 };
-	xwayback.server = &server;
+	connection_add(&server, &xwayback, xwayback_client, "xwayback");
 	xwayback.destroy.notify = client_destroy;
 	wl_client_add_destroy_listener(xwayback_client, &xwayback.destroy);
+	server.xwayback_client = xwayback_client;
+	WAYBACK_METRICS_ADD(server.metrics, clients, 1);
 
 	set_cloexec(xwayland_session_socket);
 	struct wl_client *xwayland_client =
@@ -994,9 +1236,54 @@ int main(int argc, char *argv[])
 	}
 
 	struct wayback_client xwayland = { 0 };
-	xwayland.server = &server;
+	connection_add(&server, &xwayland, xwayland_client, "xwayland");
 	xwayland.destroy.notify = client_destroy;
 	wl_client_add_destroy_listener(xwayland_client, &xwayland.destroy);
+	server.xwayland_client = xwayland_client;
+	WAYBACK_METRICS_ADD(server.metrics, clients, 1);
+
+	const char *virtual_input_fd = getenv("WAYBACK_VIRTUAL_INPUT_FD");
+	if (virtual_input_fd != NULL &&
+	    !virtual_input_create(&server, strtol(virtual_input_fd, NULL, 10)))
+		exit(EXIT_FAILURE);
+
+	/* Inherited from Xwayback */
+	server.speculative_spawn = getenv("WAYBACK_SPECULATIVE_SPAWN") != NULL;
+
+	server.ready_fd = -1;
+	const char *ready_fd = getenv("WAYBACK_READY_FD");
+	if (ready_fd != NULL) {
+		server.ready_fd = strtol(ready_fd, NULL, 10);
+		set_cloexec(server.ready_fd);
+	}
+
+	const char *xwm_fd = getenv("WAYBACK_XWM_FD");
+	if (xwm_fd != NULL) {
+#ifdef WAYBACK_HAVE_ROOTLESS
+		if (!xwm_create(&server, strtol(xwm_fd, NULL, 10)))
+			exit(EXIT_FAILURE);
+#else
+		wayback_log(LOG_ERROR, "Rootless mode is not supported by this build");
+		exit(EXIT_FAILURE);
+#endif
+	}
+
+	wl_display_set_global_filter(server.wl_display, server_global_filter, &server);
+
+	/* Debug aid: lets any client connect, e.g. for scene stress tests with
+	 * wayback-bench-scene-load. Empty picks a free wayland-N name. */
+	const char *debug_socket = getenv("WAYBACK_DEBUG_SOCKET");
+	if (debug_socket != NULL) {
+		if (*debug_socket == '\0')
+			debug_socket = wl_display_add_socket_auto(server.wl_display);
+		else if (wl_display_add_socket(server.wl_display, debug_socket) != 0)
+			debug_socket = NULL;
+		if (debug_socket == NULL) {
+			wayback_log(LOG_ERROR, "Unable to add debug socket");
+			exit(EXIT_FAILURE);
+		}
+		wayback_log(LOG_INFO, "Accepting any client on %s", debug_socket);
+	}
 
 	/* Start the backend. This will enumerate outputs and inputs, become the DRM
 	 * master, etc */
@@ -1015,6 +1302,7 @@ int main(int argc, char *argv[])
 			asprintf_or_exit(
 				&output_make_model, "%s %s", out->wlr_output->make, out->wlr_output->model);
 			bool enabled = (strcmp(output_make_model, output) == 0) || (strcmp(out->wlr_output->name, output) == 0);
+			free(output_make_model);
 			if (!enabled)
 				wlr_output_destroy(out->wlr_output);
 			else
@@ -1027,6 +1315,10 @@ int main(int argc, char *argv[])
 		exit(EXIT_FAILURE);
 	}
 
+	/* The control socket is a diagnostic aid, carry on without it. */
+	if (!control_create(&server))
+		wayback_log(LOG_WARN, "Runtime control socket is unavailable");
+
 	/* Run the Wayland event loop. This does not return until you exit the
 	 * compositor. Starting the backend rigged up all of the necessary event
 	 * loop configuration to listen to libinput events, DRM events, generate
@@ -1036,6 +1328,18 @@ int main(int argc, char *argv[])
 	/* Once wl_display_run returns, we destroy all clients then shut down the
 	 * server. */
 	wl_display_destroy_clients(server.wl_display);
+	connection_destroy(&server);
+	control_destroy(&server);
+	profiler_destroy(&server);
+	recorder_destroy(&server);
+	virtual_input_destroy(&server);
+	keybindings_destroy(&server);
+	touch_destroy(&server);
+	damage_destroy(&server);
+	config_destroy(&server);
+#ifdef WAYBACK_HAVE_ROOTLESS
+	xwm_destroy(&server);
+#endif
 
 	wl_list_remove(&server.cursor_motion.link);
 	wl_list_remove(&server.cursor_motion_absolute.link);
@@ -1059,6 +1363,11 @@ int main(int argc, char *argv[])
 	wlr_renderer_destroy(server.renderer);
 	wlr_backend_destroy(server.backend);
 	wl_display_destroy(server.wl_display);
+	wayback_output_cache_unmap(server.output_cache);
+	metrics_destroy(&server);
+	/* Leaks fail the exit status when checking, see wayback-bench-startup -check */
+	if (!wayback_mem_finish() && getenv("WAYBACK_LEAK_CHECK") != NULL)
+		return EXIT_FAILURE;
 
 	return 0;
 }
@@ -0,0 +1,404 @@
+/*
+ * Shared state of wayback-compositor.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef WAYBACK_COMPOSITOR_IMPORTED
+#define WAYBACK_COMPOSITOR_IMPORTED
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <wayland-server-core.h>
+#include <wlr/util/box.h>
+
+/*
+ * Event rate over a sliding window of roughly one second, fed with the
+ * millisecond timestamps that come with input and frame events.
+ */
+struct wayback_rate
+{
+	uint64_t total;
+	uint32_t window_start_msec;
+	uint32_t window_count;
+	float rate;
+};
+
+static inline void wayback_rate_tick(struct wayback_rate *rate, uint32_t time_msec)
+{
+	uint32_t elapsed = time_msec - rate->window_start_msec;
+	if (elapsed >= 1000) {
+		rate->rate = rate->window_start_msec != 0 ? rate->window_count * 1000.0f / elapsed : 0.0f;
+		rate->window_start_msec = time_msec;
+		rate->window_count = 0;
+	}
+	rate->window_count++;
+	rate->total++;
+}
+
+/* Returns the last measured rate, or 0 if no events arrived for a while. */
+static inline float wayback_rate_get(const struct wayback_rate *rate, uint32_t now_msec)
+{
+	if (now_msec - rate->window_start_msec >= 2000)
+		return 0.0f;
+	return rate->rate;
+}
+
+#include <stdio.h>
+#include <time.h>
+
+enum frame_policy
+{
+	/* Composite as soon as the output is ready for a new frame */
+	FRAME_POLICY_IMMEDIATE,
+	/* Composite as late as the measured render time allows */
+	FRAME_POLICY_DEADLINE,
+};
+
+#define FRAME_RENDER_SAMPLES 16
+
+/* Per output state of the frame scheduler, see frame_scheduler.c */
+struct frame_scheduler
+{
+	enum frame_policy policy;
+	struct wl_event_source *timer;
+	/* Latest presentation of a frame, and the refresh period it reported */
+	struct wl_listener present;
+	struct timespec last_present;
+	uint32_t present_period_usec;
+	/* Predicted vblank of the frame being composited, if delayed for it */
+	struct timespec deadline;
+	bool has_deadline;
+	bool pending;
+
+	uint32_t render_usec[FRAME_RENDER_SAMPLES];
+	uint32_t render_index;
+	/* Safety margin before the predicted vblank, grows on misses */
+	uint32_t margin_usec;
+	uint32_t good_frames;
+	uint64_t missed;
+};
+
+/* Limit of damage-max-rects, they are merged on the stack */
+#define DAMAGE_MAX_RECTS 64
+
+/* How surface damage is simplified, see damage.c */
+struct damage_policy
+{
+	bool enabled;
+	/* Rectangles closer than this are merged, 0 to not merge */
+	int merge_distance;
+	/* Past this many rectangles the bounding box is used */
+	int max_rects;
+	/* Or once they cover this much of their bounding box */
+	int fill_percent;
+	/* Tile size to align to, 0 or 1 to not align */
+	int tile_size;
+};
+
+struct wayback_metrics_page;
+struct wayback_output_cache;
+struct wayback_output_cache_entry;
+struct wlr_allocator;
+struct wlr_backend;
+struct wlr_compositor;
+struct wlr_input_device;
+struct wlr_keyboard;
+struct wlr_output;
+struct wlr_renderer;
+struct wlr_surface;
+struct wlr_surface_state;
+
+uint32_t get_time_msec(void);
+int set_cloexec(int fd);
+
+/* For brevity's sake, struct members are annotated where they are used. */
+struct tinywl_server
+{
+	struct wl_display *wl_display;
+	struct wlr_backend *backend;
+	struct wlr_renderer *renderer;
+	struct wlr_allocator *allocator;
+	struct wlr_session *session;
+	struct wlr_scene *scene;
+	struct wlr_scene_output_layout *scene_layout;
+
+	struct wlr_xdg_shell *xdg_shell;
+	struct wl_listener new_xdg_toplevel;
+	struct wl_listener new_xdg_popup;
+	struct wl_list toplevels;
+
+	struct wlr_xdg_output_manager_v1 *xdg_output_manager_v1;
+	struct wlr_linux_dmabuf_v1 *linux_dmabuf_v1;
+
+	struct wlr_cursor *cursor;
+	struct wlr_xcursor_manager *cursor_mgr;
+	struct wl_listener cursor_motion;
+	struct wl_listener cursor_motion_absolute;
+	struct wl_listener cursor_button;
+	struct wl_listener cursor_axis;
+	struct wl_listener cursor_frame;
+
+	struct wlr_seat *seat;
+	struct wl_listener new_input;
+	struct wl_listener request_cursor;
+	struct wl_listener request_set_selection;
+	struct wl_list keyboards;
+	struct tinywl_toplevel *grabbed_toplevel;
+	double grab_x, grab_y;
+	struct wlr_box grab_geobox;
+	uint32_t resize_edges;
+
+	struct wlr_output_layout *output_layout;
+	struct wl_list outputs;
+	struct wl_listener new_output;
+	/* What monitors were set to last time, see output_cache.c */
+	const struct wayback_output_cache *output_cache;
+
+	int width, height;
+
+	/* Set once Xwayland mapped a surface, nothing is composited before */
+	bool have_content;
+	/* Xwayland was started with a guessed screen size, see WAYBACK_SPECULATIVE_SPAWN */
+	bool speculative_spawn;
+	/* Readiness notification, see server_signal_ready() */
+	int ready_fd;
+
+	/* Policy of new outputs, from WAYBACK_FRAME_POLICY */
+	enum frame_policy frame_policy;
+	/* Damage coalescing, see damage.c */
+	struct damage_policy damage_policy;
+	struct wayback_damage *damage;
+
+	/* Configuration file, see config.c */
+	struct wayback_config *config;
+	/* Runtime control socket, see control.c */
+	struct wayback_control *control;
+	/* Log every frame and input event, toggled at runtime */
+	bool trace;
+	struct wayback_rate input_rate;
+	/* Shared memory counters, see metrics.c */
+	struct wayback_metrics_page *metrics;
+	/* Opt-in protocol traffic profiler, see protocol_profiler.c */
+	struct protocol_profiler *profiler;
+	/* Protocol session recording, see recorder.c */
+	struct wayback_recorder *recorder;
+	/* Compositor shortcuts, see keybindings.c */
+	struct wayback_keybindings *keybindings;
+	/* Input injection for benchmarks, see virtual_input.c */
+	struct wayback_virtual_input *virtual_input;
+	/* Touchscreens, see touch.c */
+	struct wayback_touch *touch;
+	/* Rootless window manager, see xwm.c */
+	struct wayback_xwm *xwm;
+
+	struct wl_client *xwayback_client;
+	struct wl_client *xwayland_client;
+	/* struct wayback_client, see connection.c */
+	struct wl_list clients;
+	size_t client_buffer_size;
+	struct wl_protocol_logger *client_logger;
+};
+
+struct tinywl_output
+{
+	struct wl_list link;
+	struct tinywl_server *server;
+	struct wlr_output *wlr_output;
+	struct wl_listener frame;
+	struct wl_listener request_state;
+	struct wl_listener destroy;
+
+	struct wayback_rate frame_rate;
+	/* Output of the Wayland backend, i.e. running nested */
+	bool nested;
+	/* Whether the last frame was handed to the parent compositor as is */
+	bool passthrough;
+	/* Came up with the mode the CRTC was already driving, see server_new_output() */
+	bool kept_mode;
+
+	struct frame_scheduler schedule;
+	/* Waits for the first frame to reach the screen, see WAYBACK_READY_FD */
+	struct wl_listener present;
+};
+
+struct tinywl_toplevel
+{
+	struct wl_list link;
+	struct tinywl_server *server;
+	struct wlr_xdg_toplevel *xdg_toplevel;
+	/* Set instead of xdg_toplevel for rootless X11 windows */
+	struct wayback_xwindow *xwindow;
+	struct wlr_scene_tree *scene_tree;
+	struct wl_listener map;
+	struct wl_listener unmap;
+	struct wl_listener commit;
+	struct wl_listener client_commit;
+	struct wl_listener destroy;
+	struct wl_listener request_maximize;
+	struct wl_listener request_fullscreen;
+};
+
+struct tinywl_popup
+{
+	struct wlr_xdg_popup *xdg_popup;
+	struct wl_listener commit;
+	struct wl_listener destroy;
+};
+
+struct tinywl_keyboard
+{
+	struct wl_list link;
+	struct tinywl_server *server;
+	struct wlr_keyboard *wlr_keyboard;
+	/* WLR_MODIFIER_* mask, updated on every modifiers event */
+	uint32_t modifier_mask;
+
+	struct wl_listener modifiers;
+	struct wl_listener key;
+	struct wl_listener destroy;
+};
+
+struct wayback_client
+{
+	struct wl_list link;
+	struct tinywl_server *server;
+	struct wl_client *client;
+	const char *name;
+	struct wl_listener destroy;
+
+	uint64_t bytes_queued;
+	/* Bytes queued since the socket was last sampled */
+	uint32_t unsampled;
+	/* Most bytes seen unread in the socket, of socket_size */
+	uint32_t max_backlog;
+	uint32_t socket_size;
+	uint64_t near_overflows;
+};
+
+/* wayback-compositor.c */
+void server_add_input(struct tinywl_server *server, struct wlr_input_device *device);
+void server_update_capabilities(struct tinywl_server *server);
+struct tinywl_toplevel *desktop_toplevel_at(struct tinywl_server *server,
+                                            double lx,
+                                            double ly,
+                                            struct wlr_surface **surface,
+                                            double *sx,
+                                            double *sy);
+void output_render(struct tinywl_output *output, struct timespec *now);
+void server_signal_ready(struct tinywl_server *server);
+void server_terminate(struct tinywl_server *server);
+bool output_set_mode(struct tinywl_output *output, int width, int height, int32_t refresh_mhz);
+
+/* config.c */
+void config_create(struct tinywl_server *server);
+void config_destroy(struct tinywl_server *server);
+void config_apply_keyboard(struct tinywl_server *server, struct wlr_keyboard *wlr_keyboard);
+void config_apply_output(struct tinywl_server *server, struct tinywl_output *output);
+bool config_output_has_mode(struct tinywl_server *server, const struct wlr_output *wlr_output);
+void config_apply_cursor(struct tinywl_server *server);
+const char *config_keybindings(struct tinywl_server *server);
+enum frame_policy config_frame_policy(struct tinywl_server *server);
+struct damage_policy config_damage_policy(struct tinywl_server *server);
+void focus_toplevel(struct tinywl_toplevel *toplevel);
+
+/* connection.c */
+void connection_add(struct tinywl_server *server,
+                    struct wayback_client *client,
+                    struct wl_client *wl_client,
+                    const char *name);
+void connection_remove(struct wayback_client *client);
+/* Counting queued events and sampling socket backlogs, off by default */
+bool connection_stats_enable(struct tinywl_server *server);
+void connection_stats_disable(struct tinywl_server *server);
+bool connection_stats_enabled(struct tinywl_server *server);
+void connection_destroy(struct tinywl_server *server);
+
+/* control.c */
+bool control_create(struct tinywl_server *server);
+void control_destroy(struct tinywl_server *server);
+void control_dump_stats(struct tinywl_server *server, FILE *out);
+
+/* damage.c */
+bool damage_create(struct tinywl_server *server, struct wlr_compositor *compositor);
+void damage_record_frame(struct tinywl_server *server, uint64_t render_usec);
+void damage_dump_stats(struct tinywl_server *server, FILE *out);
+void damage_destroy(struct tinywl_server *server);
+
+/* frame_scheduler.c */
+void frame_scheduler_init(struct tinywl_output *output);
+void frame_scheduler_finish(struct tinywl_output *output);
+void frame_scheduler_handle_frame(struct tinywl_output *output);
+void frame_scheduler_record(struct tinywl_output *output,
+                            const struct timespec *start,
+                            const struct timespec *end);
+uint32_t frame_scheduler_predict_usec(const struct tinywl_output *output);
+const char *frame_policy_name(enum frame_policy policy);
+bool frame_policy_from_name(const char *name, enum frame_policy *policy);
+
+/* keybindings.c */
+bool keybindings_load(struct tinywl_server *server, const char *spec);
+bool keybindings_handle_key(struct tinywl_keyboard *keyboard, uint32_t keycode);
+void keybindings_destroy(struct tinywl_server *server);
+
+/* metrics.c */
+void metrics_create(struct tinywl_server *server);
+void metrics_destroy(struct tinywl_server *server);
+void metrics_record_commit(struct tinywl_server *server,
+                           bool committed,
+                           bool scanout,
+                           uint64_t latency_usec);
+void metrics_record_surface_state(struct tinywl_server *server,
+                                  const struct wlr_surface_state *state);
+
+/* output_cache.c */
+const struct wayback_output_cache_entry *output_cache_apply(struct tinywl_server *server,
+                                                            struct wlr_output *wlr_output);
+void output_cache_save(struct tinywl_output *output);
+
+/* protocol_profiler.c */
+bool profiler_enable(struct tinywl_server *server, uint32_t interval_msec);
+uint32_t profiler_interval(struct tinywl_server *server);
+void profiler_disable(struct tinywl_server *server);
+bool profiler_is_enabled(struct tinywl_server *server);
+void profiler_reset(struct tinywl_server *server);
+void profiler_dump(struct tinywl_server *server, FILE *out);
+void profiler_destroy(struct tinywl_server *server);
+uint32_t protocol_message_size(const struct wl_protocol_logger_message *message);
+
+/* recorder.c */
+bool recorder_create(struct tinywl_server *server, const char *path);
+void recorder_destroy(struct tinywl_server *server);
+
+/* render_buffers.c */
+struct wlr_allocator *render_allocator_create(struct wlr_backend *backend,
+                                              struct wlr_renderer *renderer);
+void render_buffers_report(FILE *out);
+
+/* touch.c */
+bool touch_create(struct tinywl_server *server);
+void touch_add_device(struct tinywl_server *server, struct wlr_input_device *device);
+bool touch_has_devices(struct tinywl_server *server);
+void touch_dump_stats(struct tinywl_server *server, FILE *out);
+void touch_destroy(struct tinywl_server *server);
+
+/* virtual_input.c */
+bool virtual_input_create(struct tinywl_server *server, int fd);
+bool virtual_input_global_visible(struct tinywl_server *server,
+                                  const struct wl_client *client,
+                                  const struct wl_global *global);
+void virtual_input_destroy(struct tinywl_server *server);
+
+#ifdef WAYBACK_HAVE_ROOTLESS
+/* xwm.c */
+bool xwm_create(struct tinywl_server *server, int wm_fd);
+void xwm_destroy(struct tinywl_server *server);
+bool xwm_global_visible(struct tinywl_server *server,
+                        const struct wl_client *client,
+                        const struct wl_global *global);
+struct wlr_surface *xwm_surface(struct tinywl_toplevel *toplevel);
+bool xwm_wants_focus(struct tinywl_toplevel *toplevel);
+void xwm_activate(struct tinywl_toplevel *toplevel);
+#endif
+
+#endif
@@ -0,0 +1,543 @@
+/*
+ * Minimal X11 window manager for rootless mode.
+ *
+ * With -rootless, Xwayland gives every X11 toplevel its own wl_surface and
+ * tells the window manager which one through xwayland-shell-v1 serials.
+ * Each paired window becomes a tinywl_toplevel with its own scene tree, so
+ * damage tracking, occlusion and direct scanout work per window instead of
+ * on one root-sized surface.
+ *
+ * Xwayback hands over the window manager connection (Xwayland's -wm) with
+ * WAYBACK_XWM_FD.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "utils.h"
+#include "wayback-compositor.h"
+#include "wayback_log.h"
+#include "wayback_mem.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <wayland-server-core.h>
+#include <wlr/types/wlr_compositor.h>
+#include <wlr/types/wlr_scene.h>
+#include <wlr/types/wlr_seat.h>
+#include <wlr/xwayland/shell.h>
+#include <xcb/xcb.h>
+
+enum xwm_atom
+{
+	ATOM_WL_SURFACE_SERIAL,
+	ATOM_WM_STATE,
+	ATOM_COUNT,
+};
+
+static const char *const atom_names[ATOM_COUNT] = {
+	[ATOM_WL_SURFACE_SERIAL] = "WL_SURFACE_SERIAL",
+	[ATOM_WM_STATE] = "WM_STATE",
+};
+
+/* ICCCM WM_STATE values */
+enum
+{
+	WM_STATE_WITHDRAWN = 0,
+	WM_STATE_NORMAL = 1,
+};
+
+struct wayback_xwm
+{
+	struct tinywl_server *server;
+	int wm_fd;
+	xcb_connection_t *conn;
+	xcb_screen_t *screen;
+	xcb_atom_t atoms[ATOM_COUNT];
+	struct wl_event_source *x_source;
+
+	/* xcb_connect_to_fd() blocks until Xwayland serves clients, which only
+	 * happens after it finished talking to us, so it runs on a thread. */
+	pthread_t connect_thread;
+	bool connecting;
+	int ready_pipe[2];
+	struct wl_event_source *ready_source;
+
+	struct wlr_xwayland_shell_v1 *shell;
+	struct wl_listener shell_new_surface;
+
+	struct wl_list windows;
+};
+
+struct wayback_xwindow
+{
+	struct wl_list link;
+	struct wayback_xwm *xwm;
+	xcb_window_t id;
+	int16_t x, y;
+	uint16_t width, height;
+	bool override_redirect;
+	bool mapped;
+
+	uint64_t serial;
+	struct wlr_surface *surface;
+	struct wl_listener surface_destroy;
+
+	/* Shared with xdg toplevels for focus and pointer lookup */
+	struct tinywl_toplevel toplevel;
+	bool visible;
+};
+
+WAYBACK_POOL(xwindow_pool, "X windows", struct wayback_xwindow);
+
+static struct wayback_xwindow *xwindow_lookup(struct wayback_xwm *xwm, xcb_window_t id)
+{
+	struct wayback_xwindow *xwindow;
+	wl_list_for_each(xwindow, &xwm->windows, link)
+	{
+		if (xwindow->id == id)
+			return xwindow;
+	}
+	return NULL;
+}
+
+static void xwindow_set_wm_state(struct wayback_xwindow *xwindow, uint32_t state)
+{
+	struct wayback_xwm *xwm = xwindow->xwm;
+	uint32_t data[] = { state, XCB_WINDOW_NONE };
+	xcb_change_property(xwm->conn,
+	                    XCB_PROP_MODE_REPLACE,
+	                    xwindow->id,
+	                    xwm->atoms[ATOM_WM_STATE],
+	                    xwm->atoms[ATOM_WM_STATE],
+	                    32,
+	                    ARRAY_SIZE(data),
+	                    data);
+}
+
+/* Shows the window once it is both mapped on the X side and has a surface. */
+static void xwindow_update_visibility(struct wayback_xwindow *xwindow)
+{
+	struct tinywl_server *server = xwindow->xwm->server;
+	struct tinywl_toplevel *toplevel = &xwindow->toplevel;
+	bool visible = xwindow->mapped && xwindow->surface != NULL;
+	if (visible == xwindow->visible)
+		return;
+	xwindow->visible = visible;
+
+	wlr_scene_node_set_enabled(&toplevel->scene_tree->node, visible);
+	if (visible) {
+		wl_list_insert(&server->toplevels, &toplevel->link);
+		wlr_scene_node_raise_to_top(&toplevel->scene_tree->node);
+		focus_toplevel(toplevel);
+		return;
+	}
+
+	/* Hand focus back to the topmost window that takes it */
+
+	wl_list_remove(&toplevel->link);
+	if (server->seat->keyboard_state.focused_surface == xwindow->surface) {
+		wlr_seat_keyboard_notify_clear_focus(server->seat);
+		struct tinywl_toplevel *next;
+		wl_list_for_each(next, &server->toplevels, link)
+		{
+			if (next->xwindow == NULL || xwm_wants_focus(next)) {
+				focus_toplevel(next);
+				break;
+			}
+		}
+	}
+}
+
+static void xwindow_dissociate(struct wayback_xwindow *xwindow)
+{
+	if (xwindow->surface == NULL)
+		return;
+
+	bool was_mapped = xwindow->mapped;
+	xwindow->mapped = false;
+	xwindow_update_visibility(xwindow);
+	xwindow->mapped = was_mapped;
+
+	wl_list_remove(&xwindow->surface_destroy.link);
+	wlr_scene_node_destroy(&xwindow->toplevel.scene_tree->node);
+	xwindow->toplevel.scene_tree = NULL;
+	xwindow->surface = NULL;
+}
+
+static void xwindow_handle_surface_destroy(struct wl_listener *listener, void *data)
+{
+	struct wayback_xwindow *xwindow = wl_container_of(listener, xwindow, surface_destroy);
+	xwindow_dissociate(xwindow);
+}
+
+static void xwindow_associate(struct wayback_xwindow *xwindow, struct wlr_surface *surface)
+{
+	struct tinywl_server *server = xwindow->xwm->server;
+	if (xwindow->surface != NULL)
+		return;
+
+	xwindow->surface = surface;
+	xwindow->surface_destroy.notify = xwindow_handle_surface_destroy;
+	wl_signal_add(&surface->events.destroy, &xwindow->surface_destroy);
+
+	struct tinywl_toplevel *toplevel = &xwindow->toplevel;
+	toplevel->scene_tree = wlr_scene_subsurface_tree_create(&server->scene->tree, surface);
+	toplevel->scene_tree->node.data = toplevel;
+	wlr_scene_node_set_position(&toplevel->scene_tree->node, xwindow->x, xwindow->y);
+	wlr_scene_node_set_enabled(&toplevel->scene_tree->node, false);
+
+	xwindow_update_visibility(xwindow);
+}
+
+static void xwindow_destroy(struct wayback_xwindow *xwindow)
+{
+	xwindow_dissociate(xwindow);
+	wl_list_remove(&xwindow->link);
+	wayback_pool_free(&xwindow_pool, xwindow);
+}
+
+static void xwm_handle_create_notify(struct wayback_xwm *xwm, xcb_create_notify_event_t *ev)
+{
+	struct wayback_xwindow *xwindow = wayback_pool_alloc(&xwindow_pool);
+	if (xwindow == NULL)
+		return;
+	xwindow->xwm = xwm;
+	xwindow->id = ev->window;
+	xwindow->x = ev->x;
+	xwindow->y = ev->y;
+	xwindow->width = ev->width;
+	xwindow->height = ev->height;
+	xwindow->override_redirect = ev->override_redirect;
+	xwindow->toplevel.server = xwm->server;
+	xwindow->toplevel.xwindow = xwindow;
+	wl_list_insert(&xwm->windows, &xwindow->link);
+}
+
+static void xwm_handle_configure_request(struct wayback_xwm *xwm, xcb_configure_request_event_t *ev)
+{
+	/* No tiling or placement policy, windows go where they ask to go. */
+	uint16_t mask = ev->value_mask & (XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y |
+	                                  XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT);
+	uint32_t values[4];
+	int n = 0;
+	if (mask & XCB_CONFIG_WINDOW_X)
+		values[n++] = ev->x;
+	if (mask & XCB_CONFIG_WINDOW_Y)
+		values[n++] = ev->y;
+	if (mask & XCB_CONFIG_WINDOW_WIDTH)
+		values[n++] = ev->width;
+	if (mask & XCB_CONFIG_WINDOW_HEIGHT)
+		values[n++] = ev->height;
+	xcb_configure_window(xwm->conn, ev->window, mask, values);
+}
+
+static void xwm_handle_configure_notify(struct wayback_xwm *xwm, xcb_configure_notify_event_t *ev)
+{
+	struct wayback_xwindow *xwindow = xwindow_lookup(xwm, ev->window);
+	if (xwindow == NULL)
+		return;
+
+	xwindow->x = ev->x;
+	xwindow->y = ev->y;
+	xwindow->width = ev->width;
+	xwindow->height = ev->height;
+	xwindow->override_redirect = ev->override_redirect;
+	if (xwindow->toplevel.scene_tree != NULL)
+		wlr_scene_node_set_position(&xwindow->toplevel.scene_tree->node, ev->x, ev->y);
+}
+
+static void xwm_handle_client_message(struct wayback_xwm *xwm, xcb_client_message_event_t *ev)
+{
+	if (ev->type != xwm->atoms[ATOM_WL_SURFACE_SERIAL])
+		return;
+
+	struct wayback_xwindow *xwindow = xwindow_lookup(xwm, ev->window);
+	if (xwindow == NULL)
+		return;
+
+	xwindow->serial = ev->data.data32[0] | (uint64_t)ev->data.data32[1] << 32;
+	struct wlr_surface *surface =
+		wlr_xwayland_shell_v1_surface_from_serial(xwm->shell, xwindow->serial);
+	if (surface != NULL)
+		xwindow_associate(xwindow, surface);
+	/* Otherwise the surface is not committed yet, see xwm_handle_shell_new_surface() */
+}
+
+static void xwm_handle_event(struct wayback_xwm *xwm, xcb_generic_event_t *event)
+{
+	struct wayback_xwindow *xwindow;
+
+	switch (event->response_type & ~0x80) {
+		case XCB_CREATE_NOTIFY:
+			xwm_handle_create_notify(xwm, (xcb_create_notify_event_t *)event);
+			break;
+		case XCB_DESTROY_NOTIFY:
+			xwindow = xwindow_lookup(xwm, ((xcb_destroy_notify_event_t *)event)->window);
+			if (xwindow != NULL)
+				xwindow_destroy(xwindow);
+			break;
+		case XCB_MAP_REQUEST:
+			xwindow = xwindow_lookup(xwm, ((xcb_map_request_event_t *)event)->window);
+			if (xwindow != NULL) {
+				xwindow_set_wm_state(xwindow, WM_STATE_NORMAL);
+				xcb_map_window(xwm->conn, xwindow->id);
+			}
+			break;
+		case XCB_MAP_NOTIFY:
+			xwindow = xwindow_lookup(xwm, ((xcb_map_notify_event_t *)event)->window);
+			if (xwindow != NULL) {
+				xwindow->mapped = true;
+				xwindow_update_visibility(xwindow);
+			}
+			break;
+		case XCB_UNMAP_NOTIFY:
+			xwindow = xwindow_lookup(xwm, ((xcb_unmap_notify_event_t *)event)->window);
+			if (xwindow != NULL) {
+				xwindow->mapped = false;
+				xwindow_update_visibility(xwindow);
+				if (!xwindow->override_redirect)
+					xwindow_set_wm_state(xwindow, WM_STATE_WITHDRAWN);
+			}
+			break;
+		case XCB_CONFIGURE_REQUEST:
+			xwm_handle_configure_request(xwm, (xcb_configure_request_event_t *)event);
+			break;
+		case XCB_CONFIGURE_NOTIFY:
+			xwm_handle_configure_notify(xwm, (xcb_configure_notify_event_t *)event);
+			break;
+		case XCB_CLIENT_MESSAGE:
+			xwm_handle_client_message(xwm, (xcb_client_message_event_t *)event);
+			break;
+		default:
+			break;
+	}
+}
+
+static int xwm_handle_x_events(int fd, uint32_t mask, void *data)
+{
+	struct wayback_xwm *xwm = data;
+
+	if (mask & (WL_EVENT_HANGUP | WL_EVENT_ERROR)) {
+		wayback_log(LOG_ERROR, "Lost the window manager connection to Xwayland");
+		wl_event_source_remove(xwm->x_source);
+		xwm->x_source = NULL;
+		return 0;
+	}
+
+	xcb_generic_event_t *event;
+	while ((event = xcb_poll_for_event(xwm->conn)) != NULL) {
+		xwm_handle_event(xwm, event);
+		free(event);
+	}
+	xcb_flush(xwm->conn);
+	return 0;
+}
+
+static void xwm_handle_shell_new_surface(struct wl_listener *listener, void *data)
+{
+	struct wayback_xwm *xwm = wl_container_of(listener, xwm, shell_new_surface);
+	struct wlr_xwayland_surface_v1 *shell_surface = data;
+
+	struct wayback_xwindow *xwindow;
+	wl_list_for_each(xwindow, &xwm->windows, link)
+	{
+		if (xwindow->serial != 0 && xwindow->serial == shell_surface->serial) {
+			xwindow_associate(xwindow, shell_surface->surface);
+			return;
+		}
+	}
+}
+
+static bool xwm_init(struct wayback_xwm *xwm)
+{
+	if (xwm->conn == NULL || xcb_connection_has_error(xwm->conn)) {
+		wayback_log(LOG_ERROR, "Failed to connect to Xwayland as window manager");
+		return false;
+	}
+	xwm->screen = xcb_setup_roots_iterator(xcb_get_setup(xwm->conn)).data;
+
+	xcb_intern_atom_cookie_t cookies[ATOM_COUNT];
+	for (int i = 0; i < ATOM_COUNT; i++)
+		cookies[i] = xcb_intern_atom(xwm->conn, 0, strlen(atom_names[i]), atom_names[i]);
+	for (int i = 0; i < ATOM_COUNT; i++) {
+		xcb_intern_atom_reply_t *reply = xcb_intern_atom_reply(xwm->conn, cookies[i], NULL);
+		xwm->atoms[i] = reply != NULL ? reply->atom : XCB_ATOM_NONE;
+		free(reply);
+	}
+
+	uint32_t events = XCB_EVENT_MASK_SUBSTRUCTURE_NOTIFY | XCB_EVENT_MASK_SUBSTRUCTURE_REDIRECT;
+	xcb_void_cookie_t cookie = xcb_change_window_attributes_checked(
+		xwm->conn, xwm->screen->root, XCB_CW_EVENT_MASK, &events);
+	xcb_generic_error_t *error = xcb_request_check(xwm->conn, cookie);
+	if (error != NULL) {
+		wayback_log(LOG_ERROR, "Another window manager is already running on the X server");
+		free(error);
+		return false;
+	}
+
+	xwm->x_source = wl_event_loop_add_fd(wl_display_get_event_loop(xwm->server->wl_display),
+	                                     xcb_get_file_descriptor(xwm->conn),
+	                                     WL_EVENT_READABLE,
+	                                     xwm_handle_x_events,
+	                                     xwm);
+	wl_event_source_check(xwm->x_source);
+	wayback_log(LOG_INFO, "Managing rootless X11 windows");
+
+	/* There is no root window to wait for, windows only show up once the
+	 * session is running. */
+	xwm->server->have_content = true;
+	server_signal_ready(xwm->server);
+	return true;
+}
+
+static void *xwm_connect_thread(void *data)
+{
+	struct wayback_xwm *xwm = data;
+	xwm->conn = xcb_connect_to_fd(xwm->wm_fd, NULL);
+	/* The main loop only learns that we are done through the pipe */
+	while (write(xwm->ready_pipe[1], "", 1) != 1) {
+		if (errno != EINTR) {
+			wayback_log(LOG_ERROR, "Failed to signal the X connection: %s", strerror(errno));
+			break;
+		}
+	}
+	return NULL;
+}
+
+static int xwm_handle_ready(int fd, uint32_t mask, void *data)
+{
+	struct wayback_xwm *xwm = data;
+	char byte;
+	ssize_t n = read(fd, &byte, 1);
+	if (n < 0 && (errno == EINTR || errno == EAGAIN))
+		return 0;
+	/* The thread only makes the pipe readable once it is done */
+	if (n < 0)
+		wayback_log(LOG_WARN, "Failed to read from the X connection thread: %s", strerror(errno));
+
+	pthread_join(xwm->connect_thread, NULL);
+	xwm->connecting = false;
+	wl_event_source_remove(xwm->ready_source);
+	xwm->ready_source = NULL;
+
+	/* Without a window manager nothing would ever show up, give up. */
+	if (!xwm_init(xwm))
+		server_terminate(xwm->server);
+	return 0;
+}
+
+bool xwm_create(struct tinywl_server *server, int wm_fd)
+{
+	struct wayback_xwm *xwm = calloc(1, sizeof(*xwm));
+	if (xwm == NULL)
+		return false;
+	xwm->server = server;
+	xwm->wm_fd = wm_fd;
+	xwm->ready_pipe[0] = xwm->ready_pipe[1] = -1;
+	wl_list_init(&xwm->windows);
+	server->xwm = xwm;
+
+	/* Only Xwayland may pair its surfaces with X11 windows. */
+	xwm->shell = wlr_xwayland_shell_v1_create(server->wl_display, 1);
+	if (xwm->shell == NULL)
+		goto error;
+	wlr_xwayland_shell_v1_set_client(xwm->shell, server->xwayland_client);
+	xwm->shell_new_surface.notify = xwm_handle_shell_new_surface;
+	wl_signal_add(&xwm->shell->events.new_surface, &xwm->shell_new_surface);
+
+	set_cloexec(wm_fd);
+	if (pipe(xwm->ready_pipe) < 0)
+		goto error;
+	set_cloexec(xwm->ready_pipe[0]);
+	set_cloexec(xwm->ready_pipe[1]);
+	xwm->ready_source = wl_event_loop_add_fd(wl_display_get_event_loop(server->wl_display),
+	                                         xwm->ready_pipe[0],
+	                                         WL_EVENT_READABLE,
+	                                         xwm_handle_ready,
+	                                         xwm);
+	if (xwm->ready_source == NULL ||
+	    pthread_create(&xwm->connect_thread, NULL, xwm_connect_thread, xwm) != 0)
+		goto error;
+	xwm->connecting = true;
+	return true;
+
+error:
+	wayback_log(LOG_ERROR, "Failed to set up the rootless window manager");
+	xwm_destroy(server);
+	return false;
+}
+
+void xwm_destroy(struct tinywl_server *server)
+{
+	struct wayback_xwm *xwm = server->xwm;
+	if (xwm == NULL)
+		return;
+
+	if (xwm->connecting) {
+		/* Unblocks the handshake if Xwayland never answered. */
+		shutdown(xwm->wm_fd, SHUT_RDWR);
+		pthread_join(xwm->connect_thread, NULL);
+	}
+	if (xwm->ready_source != NULL)
+		wl_event_source_remove(xwm->ready_source);
+	if (xwm->ready_pipe[0] >= 0) {
+		close(xwm->ready_pipe[0]);
+		close(xwm->ready_pipe[1]);
+	}
+	if (xwm->x_source != NULL)
+		wl_event_source_remove(xwm->x_source);
+
+	struct wayback_xwindow *xwindow, *tmp;
+	wl_list_for_each_safe(xwindow, tmp, &xwm->windows, link)
+		xwindow_destroy(xwindow);
+
+	if (xwm->shell != NULL) {
+		wl_list_remove(&xwm->shell_new_surface.link);
+		wlr_xwayland_shell_v1_destroy(xwm->shell);
+	}
+	/* Also closes wm_fd */
+	if (xwm->conn != NULL)
+		xcb_disconnect(xwm->conn);
+	else
+		close(xwm->wm_fd);
+
+	free(xwm);
+	server->xwm = NULL;
+}
+
+bool xwm_global_visible(struct tinywl_server *server,
+                        const struct wl_client *client,
+                        const struct wl_global *global)
+{
+	struct wayback_xwm *xwm = server->xwm;
+
+	if (xwm == NULL || global != xwm->shell->global)
+		return true;
+	return client == server->xwayland_client;
+}
+
+struct wlr_surface *xwm_surface(struct tinywl_toplevel *toplevel)
+{
+	return toplevel->xwindow->surface;
+}
+
+bool xwm_wants_focus(struct tinywl_toplevel *toplevel)
+{
+	return !toplevel->xwindow->override_redirect;
+}
+
+void xwm_activate(struct tinywl_toplevel *toplevel)
+{
+	struct wayback_xwindow *xwindow = toplevel->xwindow;
+	struct wayback_xwm *xwm = xwindow->xwm;
+
+	uint32_t stack_mode = XCB_STACK_MODE_ABOVE;
+	xcb_configure_window(xwm->conn, xwindow->id, XCB_CONFIG_WINDOW_STACK_MODE, &stack_mode);
+	xcb_set_input_focus(
+		xwm->conn, XCB_INPUT_FOCUS_POINTER_ROOT, xwindow->id, XCB_CURRENT_TIME);
+	xcb_flush(xwm->conn);
+}
@@ -0,0 +1,266 @@
+/*
+ * wayback-ctl queries and reconfigures a running wayback-compositor
+ * through its control socket.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "optparse.h"
+#include "utils.h"
+#include "wayback_control.h"
+#include "wayback_log.h"
+#include "wayback_metrics.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/* Picks the control socket if exactly one compositor is running. */
+static char *find_control_socket(void)
+{
+	if (getenv("WAYBACK_CONTROL_SOCKET") != NULL)
+		return control_socket_path(0);
+
+	const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+	if (runtime_dir == NULL) {
+		wayback_log(LOG_ERROR, "XDG_RUNTIME_DIR is not set");
+		exit(EXIT_FAILURE);
+	}
+
+	DIR *dir = opendir(runtime_dir);
+	if (dir == NULL) {
+		wayback_log(LOG_ERROR, "Unable to open %s: %s", runtime_dir, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	char *path = NULL;
+	int found = 0;
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != NULL) {
+		if (strncmp(entry->d_name,
+		            WAYBACK_CONTROL_SOCKET_PREFIX,
+		            strlen(WAYBACK_CONTROL_SOCKET_PREFIX)) != 0)
+			continue;
+		if (found++ == 0) {
+			asprintf_or_exit(&path, "%s/%s", runtime_dir, entry->d_name);
+		} else {
+			if (found == 2)
+				wayback_log(LOG_ERROR, "Several compositors are running, pick one with -pid:");
+			wayback_log(LOG_ERROR, "\t%s", entry->d_name + strlen(WAYBACK_CONTROL_SOCKET_PREFIX));
+		}
+	}
+	closedir(dir);
+
+	if (found == 0) {
+		wayback_log(LOG_ERROR, "No running wayback-compositor found in %s", runtime_dir);
+		exit(EXIT_FAILURE);
+	} else if (found > 1) {
+		wayback_log(LOG_ERROR,
+		            "\t%s",
+		            strrchr(path, '/') + 1 + strlen(WAYBACK_CONTROL_SOCKET_PREFIX));
+		exit(EXIT_FAILURE);
+	}
+	return path;
+}
+
+/* Reads the shared metrics page directly, without waking the compositor. */
+static int print_metrics(pid_t pid)
+{
+	char name[64];
+	snprintf(name, sizeof(name), WAYBACK_METRICS_SHM_PREFIX "%d", (int)pid);
+
+	int fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+	if (fd < 0) {
+		wayback_log(LOG_ERROR, "Unable to open metrics page %s: %s", name, strerror(errno));
+		return EXIT_FAILURE;
+	}
+	const struct wayback_metrics_page *page =
+		mmap(NULL, sizeof(*page), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (page == MAP_FAILED) {
+		wayback_log(LOG_ERROR, "Unable to map metrics page %s: %s", name, strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	struct wayback_metrics_page m;
+	if (!wayback_metrics_read(page, &m) || m.magic != WAYBACK_METRICS_MAGIC ||
+	    m.version != WAYBACK_METRICS_VERSION) {
+		wayback_log(LOG_ERROR, "Metrics page %s is unreadable or has an unknown version", name);
+		munmap((void *)page, sizeof(*page));
+		return EXIT_FAILURE;
+	}
+	munmap((void *)page, sizeof(*page));
+
+	printf("clients %" PRIu32 "\n", m.clients);
+	printf("frames_committed %" PRIu64 "\n", m.frames_committed);
+	printf("frames_skipped %" PRIu64 "\n", m.frames_skipped);
+	printf("frames_failed %" PRIu64 "\n", m.frames_failed);
+	printf("scanout_frames %" PRIu64 "\n", m.scanout_frames);
+	for (int i = 0; i < WAYBACK_METRICS_LATENCY_BUCKETS; i++)
+		printf("commit_latency_%dus %" PRIu64 "\n", 1 << i, m.commit_latency[i]);
+	printf("key_events %" PRIu64 "\n", m.key_events);
+	printf("pointer_motion_events %" PRIu64 "\n", m.pointer_motion_events);
+	printf("pointer_button_events %" PRIu64 "\n", m.pointer_button_events);
+	printf("pointer_axis_events %" PRIu64 "\n", m.pointer_axis_events);
+	printf("surface_commits %" PRIu64 "\n", m.surface_commits);
+	printf("shm_buffers %" PRIu64 "\n", m.shm_buffers);
+	printf("dmabuf_buffers %" PRIu64 "\n", m.dmabuf_buffers);
+	printf("other_buffers %" PRIu64 "\n", m.other_buffers);
+	printf("shm_buffer_bytes %" PRIu64 "\n", m.shm_buffer_bytes);
+	printf("client_bytes_queued %" PRIu64 "\n", m.client_bytes_queued);
+	printf("client_backlog_max %" PRIu64 "\n", m.client_backlog_max);
+	printf("client_near_overflows %" PRIu64 "\n", m.client_near_overflows);
+	printf("touch_events %" PRIu64 "\n", m.touch_events);
+	printf("touch_frames %" PRIu64 "\n", m.touch_frames);
+	printf("damage_rects_in %" PRIu64 "\n", m.damage_rects_in);
+	printf("damage_rects_out %" PRIu64 "\n", m.damage_rects_out);
+	printf("damage_pixels_in %" PRIu64 "\n", m.damage_pixels_in);
+	printf("damage_pixels_out %" PRIu64 "\n", m.damage_pixels_out);
+	return EXIT_SUCCESS;
+}
+
+int main(int argc, char *argv[])
+{
+	wayback_log_init("wayback-ctl", LOG_INFO, NULL);
+
+	char *socket_path = NULL;
+	long pid = 0;
+	const struct optcmd opts[] = {
+		{ .name = "-socket",
+		  .description = "path to the control socket",
+		  .flag = OPT_OPERAND,
+		  .ignore = false },
+		{ .name = "-pid",
+		  .description = "pid of the wayback-compositor to control",
+		  .flag = OPT_OPERAND,
+		  .ignore = false },
+		{ .name = "-version",
+		  .description = "show wayback-ctl version",
+		  .flag = OPT_NOFLAG,
+		  .ignore = false },
+	};
+
+	int cur_opt = 0;
+	int command = -1;
+	while (cur_opt = optparse(argc, argv, opts, ARRAY_SIZE(opts)), cur_opt != -1) {
+		if (strcmp(argv[cur_opt], "-version") == 0) {
+			wayback_log(LOG_INFO,
+			            "Wayback <https://wayback.freedesktop.org/> X.Org compatibility layer");
+			wayback_log(LOG_INFO, "Version %s", WAYBACK_VERSION);
+			exit(EXIT_SUCCESS);
+		} else if (strcmp(argv[cur_opt], "-socket") == 0) {
+			free(socket_path);
+			socket_path = strdup_or_exit(argv[cur_opt + 1]);
+		} else if (strcmp(argv[cur_opt], "-pid") == 0) {
+			errno = 0;
+			char *end;
+			pid = strtol(argv[cur_opt + 1], &end, 10);
+			if (errno || *end != '\0' || pid <= 0) {
+				wayback_log(LOG_ERROR, "Invalid pid %s", argv[cur_opt + 1]);
+				exit(EXIT_FAILURE);
+			}
+			free(socket_path);
+			socket_path = control_socket_path(pid);
+			if (socket_path == NULL) {
+				wayback_log(LOG_ERROR, "XDG_RUNTIME_DIR is not set");
+				exit(EXIT_FAILURE);
+			}
+		} else if (argv[cur_opt][0] != '-') {
+			command = cur_opt;
+			break;
+		} else {
+			wayback_log(LOG_ERROR, "Unknown option %s", argv[cur_opt]);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (command == -1) {
+		wayback_log(LOG_ERROR, "No command given, try \"%s help\"", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	if (strcmp(argv[command], "metrics") == 0) {
+		if (pid == 0 && socket_path == NULL) {
+			char *path = find_control_socket();
+			const char *base = strrchr(path, '/');
+			if (base != NULL && strncmp(base + 1,
+			                            WAYBACK_CONTROL_SOCKET_PREFIX,
+			                            strlen(WAYBACK_CONTROL_SOCKET_PREFIX)) == 0)
+				pid = strtol(base + 1 + strlen(WAYBACK_CONTROL_SOCKET_PREFIX), NULL, 10);
+			free(path);
+		}
+		if (pid <= 0) {
+			wayback_log(LOG_ERROR, "The metrics command needs -pid");
+			exit(EXIT_FAILURE);
+		}
+		return print_metrics(pid);
+	}
+
+	char request[WAYBACK_CONTROL_MAX_REQUEST] = "";
+	size_t len = 0;
+	for (int i = command; i < argc; i++) {
+		int n = snprintf(
+			request + len, sizeof(request) - len, "%s%s", argv[i], i + 1 < argc ? " " : "\n");
+		if (n < 0 || (size_t)n >= sizeof(request) - len) {
+			wayback_log(LOG_ERROR, "Command too long");
+			exit(EXIT_FAILURE);
+		}
+		len += n;
+	}
+
+	if (socket_path == NULL)
+		socket_path = find_control_socket();
+
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+		wayback_log(LOG_ERROR, "Socket path %s is too long", socket_path);
+		exit(EXIT_FAILURE);
+	}
+	strcpy(addr.sun_path, socket_path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		wayback_log(LOG_ERROR, "Unable to connect to %s: %s", socket_path, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	free(socket_path);
+
+	if (write(fd, request, len) != (ssize_t)len) {
+		wayback_log(LOG_ERROR, "Failed to send command: %s", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	shutdown(fd, SHUT_WR);
+
+	char *reply = NULL;
+	size_t reply_len = 0;
+	FILE *stream = open_memstream(&reply, &reply_len);
+	char buffer[4096];
+	ssize_t n;
+	while ((n = read(fd, buffer, sizeof(buffer))) > 0)
+		fwrite(buffer, 1, n, stream);
+	fclose(stream);
+	close(fd);
+
+	/* The first line carries the status, the rest is the command output. */
+	char *body = strchr(reply, '\n');
+	if (body != NULL)
+		*body++ = '\0';
+
+	bool ok = strcmp(reply, "ok") == 0;
+	if (!ok)
+		wayback_log(LOG_ERROR, "%s", reply[0] != '\0' ? reply : "no reply from compositor");
+	else if (body != NULL)
+		fputs(body, stdout);
+
+	free(reply);
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,814 @@
+/*
+ * wayback-replay plays a session recorded by wayback-compositor back
+ * against a headless wayback-compositor, acting as Xwayland, and reports
+ * frame and CPU statistics.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "optparse.h"
+#include "utils.h"
+#include "wayback_log.h"
+#include "wayback_metrics.h"
+#include "wayback_record.h"
+#include "xdg-output-unstable-v1-client-protocol.h"
+#include "xdg-shell-client-protocol.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <wayland-client.h>
+
+/* Matches WL_CLOSURE_MAX_ARGS in libwayland */
+#define REPLAY_MAX_ARGS 20
+
+/* Interfaces the compositor may offer to Xwayland, anything else is skipped. */
+static const struct wl_interface *const known_interfaces[] = {
+	&wl_display_interface,
+	&wl_registry_interface,
+	&wl_callback_interface,
+	&wl_compositor_interface,
+	&wl_shm_pool_interface,
+	&wl_shm_interface,
+	&wl_buffer_interface,
+	&wl_data_offer_interface,
+	&wl_data_source_interface,
+	&wl_data_device_interface,
+	&wl_data_device_manager_interface,
+	&wl_surface_interface,
+	&wl_seat_interface,
+	&wl_pointer_interface,
+	&wl_keyboard_interface,
+	&wl_touch_interface,
+	&wl_output_interface,
+	&wl_region_interface,
+	&wl_subcompositor_interface,
+	&wl_subsurface_interface,
+	&xdg_wm_base_interface,
+	&xdg_positioner_interface,
+	&xdg_surface_interface,
+	&xdg_toplevel_interface,
+	&xdg_popup_interface,
+	&zxdg_output_manager_v1_interface,
+	&zxdg_output_v1_interface,
+};
+
+struct replay_object
+{
+	uint32_t id;
+	struct wl_proxy *proxy;
+	const struct wl_interface *interface;
+
+	/* xdg_surface */
+	uint32_t configure_serial;
+	bool configured;
+
+	/* wl_shm_pool */
+	int fd;
+	void *data;
+	size_t size;
+
+	/* wl_buffer */
+	uint32_t pool;
+	int32_t offset, stride, height;
+
+	/* wl_surface */
+	uint32_t attached;
+
+	/* wl_callback */
+	bool frame_callback;
+};
+
+struct replay_global
+{
+	uint32_t name;
+	char *interface;
+	uint32_t version;
+};
+
+struct replay
+{
+	struct wl_display *display;
+	bool max_speed;
+	uint64_t start_usec;
+
+	/* Indexed by the object id in the recording */
+	struct replay_object **objects;
+	size_t nobjects;
+
+	struct replay_global *recorded_globals, *globals;
+	size_t nrecorded_globals, nglobals;
+
+	uint64_t requests, skipped, buffers, frames;
+	uint64_t first_frame_usec, last_frame_usec;
+};
+
+struct record_cursor
+{
+	const uint8_t *p, *end;
+	bool error;
+};
+
+static uint64_t now_usec(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+}
+
+static uint32_t cursor_u32(struct record_cursor *cur)
+{
+	uint32_t value = 0;
+	if (cur->end - cur->p < 4) {
+		cur->error = true;
+		return 0;
+	}
+	memcpy(&value, cur->p, sizeof(value));
+	cur->p += 4;
+	return value;
+}
+
+static const void *cursor_bytes(struct record_cursor *cur, uint32_t *len)
+{
+	*len = cursor_u32(cur);
+	size_t padded = ((size_t)*len + 3) & ~(size_t)3;
+	if (cur->error || (size_t)(cur->end - cur->p) < padded) {
+		cur->error = true;
+		*len = 0;
+		return NULL;
+	}
+	const void *data = cur->p;
+	cur->p += padded;
+	return *len > 0 ? data : NULL;
+}
+
+static const char *cursor_string(struct record_cursor *cur)
+{
+	uint32_t len;
+	const char *str = cursor_bytes(cur, &len);
+	if (str != NULL && str[len - 1] != '\0') {
+		cur->error = true;
+		return NULL;
+	}
+	return str;
+}
+
+static const struct wl_interface *find_interface(const char *name)
+{
+	if (name == NULL)
+		return NULL;
+	for (size_t i = 0; i < ARRAY_SIZE(known_interfaces); i++) {
+		if (strcmp(known_interfaces[i]->name, name) == 0)
+			return known_interfaces[i];
+	}
+	return NULL;
+}
+
+static struct replay_object *object_get(struct replay *replay, uint32_t id)
+{
+	return id < replay->nobjects ? replay->objects[id] : NULL;
+}
+
+static void object_destroy(struct replay *replay, struct replay_object *object)
+{
+	if (object->data != NULL)
+		munmap(object->data, object->size);
+	if (object->fd >= 0)
+		close(object->fd);
+	replay->objects[object->id] = NULL;
+	free(object);
+}
+
+static void globals_add(struct replay_global **globals,
+                        size_t *nglobals,
+                        uint32_t name,
+                        const char *interface,
+                        uint32_t version)
+{
+	struct replay_global *tmp = realloc(*globals, (*nglobals + 1) * sizeof(**globals));
+	if (tmp == NULL) {
+		wayback_log(LOG_ERROR, "Failed to allocate memory for global");
+		exit(EXIT_FAILURE);
+	}
+	*globals = tmp;
+	tmp[*nglobals] = (struct replay_global){
+		.name = name,
+		.interface = strdup_or_exit(interface),
+		.version = version,
+	};
+	(*nglobals)++;
+}
+
+static int replay_dispatch(const void *implementation,
+                           void *target,
+                           uint32_t opcode,
+                           const struct wl_message *message,
+                           union wl_argument *args)
+{
+	struct replay *replay = (struct replay *)implementation;
+	struct replay_object *object = wl_proxy_get_user_data(target);
+
+	int arg = 0;
+	for (const char *c = message->signature; *c != '\0'; c++) {
+		if (*c == 'h')
+			close(args[arg].h);
+		if (*c != '?' && (*c < '0' || *c > '9'))
+			arg++;
+	}
+
+	/* Client headers only name request opcodes, all of these events are 0. */
+	if (object->interface == &wl_registry_interface && opcode == 0) {
+		globals_add(&replay->globals, &replay->nglobals, args[0].u, args[1].s, args[2].u);
+	} else if (object->interface == &xdg_surface_interface && opcode == 0) {
+		object->configure_serial = args[0].u;
+		object->configured = true;
+	} else if (object->interface == &wl_callback_interface && opcode == 0) {
+		if (object->frame_callback) {
+			uint64_t now = now_usec();
+			if (replay->frames++ == 0)
+				replay->first_frame_usec = now;
+			replay->last_frame_usec = now;
+		}
+		/* The compositor destroys callbacks once done, so does the recording. */
+		wl_proxy_destroy(target);
+		object_destroy(replay, object);
+	}
+	return 0;
+}
+
+static struct replay_object *object_create(struct replay *replay,
+                                           uint32_t id,
+                                           struct wl_proxy *proxy,
+                                           const struct wl_interface *interface)
+{
+	if (id >= replay->nobjects) {
+		size_t n = replay->nobjects ? replay->nobjects : 256;
+		while (n <= id)
+			n *= 2;
+		struct replay_object **objects = realloc(replay->objects, n * sizeof(*objects));
+		if (objects == NULL) {
+			wayback_log(LOG_ERROR, "Failed to allocate object table");
+			exit(EXIT_FAILURE);
+		}
+		memset(objects + replay->nobjects, 0, (n - replay->nobjects) * sizeof(*objects));
+		replay->objects = objects;
+		replay->nobjects = n;
+	}
+
+	/* The recorded client may reuse the id of an object the server deleted. */
+	if (replay->objects[id] != NULL)
+		object_destroy(replay, replay->objects[id]);
+
+	struct replay_object *object = calloc(1, sizeof(*object));
+	if (object == NULL) {
+		wayback_log(LOG_ERROR, "Failed to allocate object");
+		exit(EXIT_FAILURE);
+	}
+	object->id = id;
+	object->proxy = proxy;
+	object->interface = interface;
+	object->fd = -1;
+	replay->objects[id] = object;
+
+	if (id != 1)
+		wl_proxy_add_dispatcher(proxy, replay_dispatch, replay, object);
+	return object;
+}
+
+/* Dispatches events, waiting at most timeout_ms for new ones to arrive. */
+static void replay_pump(struct replay *replay, int timeout_ms)
+{
+	struct wl_display *display = replay->display;
+
+	while (wl_display_prepare_read(display) != 0) {
+		if (wl_display_dispatch_pending(display) < 0)
+			goto error;
+	}
+
+	struct pollfd pfd = { .fd = wl_display_get_fd(display), .events = POLLIN };
+	if (wl_display_flush(display) < 0) {
+		if (errno != EAGAIN) {
+			wl_display_cancel_read(display);
+			goto error;
+		}
+		pfd.events |= POLLOUT;
+	}
+
+	if (poll(&pfd, 1, timeout_ms) > 0 && (pfd.revents & POLLIN))
+		wl_display_read_events(display);
+	else
+		wl_display_cancel_read(display);
+
+	if (wl_display_dispatch_pending(display) >= 0)
+		return;
+
+error:
+	wayback_log(LOG_ERROR,
+	            "Connection to compositor lost: %s",
+	            strerror(wl_display_get_error(display)));
+	exit(EXIT_FAILURE);
+}
+
+static void replay_wait_until(struct replay *replay, uint64_t time_usec)
+{
+	for (;;) {
+		uint64_t elapsed = now_usec() - replay->start_usec;
+		if (elapsed >= time_usec)
+			return;
+		replay_pump(replay, (time_usec - elapsed + 999) / 1000);
+	}
+}
+
+static const struct replay_global *map_global(struct replay *replay, uint32_t recorded_name)
+{
+	const struct replay_global *recorded = NULL;
+	size_t index = 0;
+	for (size_t i = 0; i < replay->nrecorded_globals; i++) {
+		if (replay->recorded_globals[i].name == recorded_name) {
+			recorded = &replay->recorded_globals[i];
+			break;
+		}
+	}
+	if (recorded == NULL)
+		return NULL;
+
+	/* Globals of the same interface are matched in advertisement order. */
+	for (const struct replay_global *g = replay->recorded_globals; g != recorded; g++) {
+		if (strcmp(g->interface, recorded->interface) == 0)
+			index++;
+	}
+	for (size_t i = 0; i < replay->nglobals; i++) {
+		if (strcmp(replay->globals[i].interface, recorded->interface) == 0 && index-- == 0)
+			return &replay->globals[i];
+	}
+	return NULL;
+}
+
+static int create_pool_fd(int32_t size)
+{
+	static unsigned int serial;
+	char name[64];
+	snprintf(name, sizeof(name), "/wayback-replay-%d-%u", (int)getpid(), serial++);
+
+	int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+	if (fd >= 0)
+		shm_unlink(name);
+	if (fd < 0 || ftruncate(fd, size) < 0) {
+		wayback_log(LOG_ERROR, "Failed to create shm pool: %s", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	return fd;
+}
+
+static void replay_request(struct replay *replay, struct record_cursor *cur)
+{
+	uint32_t id = cursor_u32(cur);
+	uint32_t opcode = cursor_u32(cur);
+	const char *interface_name = cursor_string(cur);
+
+	struct replay_object *target = object_get(replay, id);
+	if (cur->error || target == NULL || interface_name == NULL ||
+	    strcmp(target->interface->name, interface_name) != 0 ||
+	    opcode >= (uint32_t)target->interface->method_count) {
+		replay->skipped++;
+		return;
+	}
+
+	const struct wl_message *message = &target->interface->methods[opcode];
+	union wl_argument args[REPLAY_MAX_ARGS] = { 0 };
+	struct wl_array arrays[REPLAY_MAX_ARGS];
+	uint32_t recorded_ids[REPLAY_MAX_ARGS] = { 0 };
+	const struct wl_interface *new_interface = NULL;
+	uint32_t new_id = 0;
+	uint32_t version = wl_proxy_get_version(target->proxy);
+	const char *last_string = NULL;
+	int fd_arg = -1;
+
+	int n = 0;
+	for (const char *c = message->signature; *c != '\0' && n < REPLAY_MAX_ARGS; c++) {
+		uint32_t len;
+		switch (*c) {
+			case 'i':
+			case 'u':
+			case 'f':
+				args[n++].u = cursor_u32(cur);
+				break;
+			case 'o': {
+				recorded_ids[n] = cursor_u32(cur);
+				struct replay_object *object = object_get(replay, recorded_ids[n]);
+				if (recorded_ids[n] != 0 && object == NULL) {
+					replay->skipped++;
+					return;
+				}
+				args[n++].o = object != NULL ? (struct wl_object *)object->proxy : NULL;
+				break;
+			}
+			case 'n':
+				new_id = cursor_u32(cur);
+				new_interface = message->types[n];
+				if (new_interface == NULL) {
+					/* wl_registry.bind spells out interface and version */
+					new_interface = find_interface(last_string);
+					version = args[n - 1].u;
+				}
+				args[n++].o = NULL;
+				break;
+			case 's':
+				last_string = cursor_string(cur);
+				args[n++].s = last_string;
+				break;
+			case 'a':
+				arrays[n].data = (void *)cursor_bytes(cur, &len);
+				arrays[n].size = arrays[n].alloc = len;
+				args[n].a = &arrays[n];
+				n++;
+				break;
+			case 'h':
+				fd_arg = n;
+				args[n++].h = -1;
+				break;
+			default:
+				break;
+		}
+	}
+
+	if (cur->error || (new_id != 0 && new_interface == NULL)) {
+		replay->skipped++;
+		return;
+	}
+
+	if (target->interface == &wl_registry_interface && opcode == WL_REGISTRY_BIND) {
+		const struct replay_global *global = map_global(replay, args[0].u);
+		if (global == NULL) {
+			wl_display_roundtrip(replay->display);
+			global = map_global(replay, args[0].u);
+		}
+		if (global == NULL) {
+			replay->skipped++;
+			return;
+		}
+		args[0].u = global->name;
+		if (version > global->version)
+			version = args[2].u = global->version;
+	} else if (target->interface == &xdg_surface_interface &&
+	           opcode == XDG_SURFACE_ACK_CONFIGURE) {
+		if (!target->configured)
+			wl_display_roundtrip(replay->display);
+		args[0].u = target->configure_serial;
+	} else if (target->interface == &wl_surface_interface && opcode == WL_SURFACE_ATTACH) {
+		target->attached = recorded_ids[0];
+	} else if (target->interface == &wl_shm_pool_interface && opcode == WL_SHM_POOL_RESIZE) {
+		munmap(target->data, target->size);
+		void *data = MAP_FAILED;
+		if (ftruncate(target->fd, args[0].i) == 0)
+			data = mmap(NULL, args[0].i, PROT_READ | PROT_WRITE, MAP_SHARED, target->fd, 0);
+		if (data == MAP_FAILED) {
+			wayback_log(LOG_ERROR, "Failed to resize shm pool: %s", strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+		target->data = data;
+		target->size = args[0].i;
+	}
+
+	int fd = -1;
+	if (fd_arg >= 0) {
+		if (target->interface == &wl_shm_interface && opcode == WL_SHM_CREATE_POOL)
+			fd = create_pool_fd(args[fd_arg + 1].i);
+		else
+			fd = open("/dev/null", O_RDWR | O_CLOEXEC);
+		args[fd_arg].h = fd;
+	}
+
+	/* Nearly every protocol names its destructors like this. */
+	bool destructor =
+		strcmp(message->name, "destroy") == 0 || strcmp(message->name, "release") == 0;
+
+	struct wl_proxy *proxy = wl_proxy_marshal_array_flags(target->proxy,
+	                                                      opcode,
+	                                                      new_interface,
+	                                                      version,
+	                                                      destructor ? WL_MARSHAL_FLAG_DESTROY : 0,
+	                                                      args);
+	replay->requests++;
+
+	if (new_id != 0 && proxy != NULL) {
+		struct replay_object *object = object_create(replay, new_id, proxy, new_interface);
+		if (target->interface == &wl_shm_interface && opcode == WL_SHM_CREATE_POOL) {
+			object->fd = fd;
+			object->size = args[2].i;
+			object->data = mmap(NULL, object->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			if (object->data == MAP_FAILED) {
+				wayback_log(LOG_ERROR, "Failed to map shm pool: %s", strerror(errno));
+				exit(EXIT_FAILURE);
+			}
+			fd = -1;
+		} else if (target->interface == &wl_shm_pool_interface &&
+		           opcode == WL_SHM_POOL_CREATE_BUFFER) {
+			object->pool = target->id;
+			object->offset = args[1].i;
+			object->height = args[3].i;
+			object->stride = args[4].i;
+		} else if (target->interface == &wl_surface_interface && opcode == WL_SURFACE_FRAME) {
+			object->frame_callback = true;
+		}
+	}
+
+	if (fd >= 0)
+		close(fd);
+	if (destructor)
+		object_destroy(replay, target);
+}
+
+/* Writes the recorded pixels into the buffer attached to the surface. */
+static void replay_buffer(struct replay *replay, struct record_cursor *cur, bool hashed)
+{
+	uint32_t surface_id = cursor_u32(cur);
+	cursor_u32(cur); /* width */
+	uint32_t height = cursor_u32(cur);
+	uint32_t stride = cursor_u32(cur);
+	cursor_u32(cur); /* format */
+	if (cur->error)
+		return;
+
+	struct replay_object *surface = object_get(replay, surface_id);
+	struct replay_object *buffer = surface ? object_get(replay, surface->attached) : NULL;
+	struct replay_object *pool = buffer ? object_get(replay, buffer->pool) : NULL;
+	if (pool == NULL || pool->data == NULL || buffer->offset < 0)
+		return;
+
+	size_t rows = height < (uint32_t)buffer->height ? height : (uint32_t)buffer->height;
+	size_t row_len = stride < (uint32_t)buffer->stride ? stride : (uint32_t)buffer->stride;
+	if ((size_t)buffer->offset + rows * buffer->stride > pool->size)
+		return;
+
+	uint8_t *dst = (uint8_t *)pool->data + buffer->offset;
+	if (hashed) {
+		uint64_t hash;
+		if ((size_t)(cur->end - cur->p) < sizeof(hash))
+			return;
+		memcpy(&hash, cur->p, sizeof(hash));
+		/* Same pixels for the same recorded contents, so damage stays realistic. */
+		for (size_t row = 0; row < rows; row++)
+			for (size_t x = 0; x + sizeof(hash) <= row_len; x += sizeof(hash))
+				memcpy(dst + row * buffer->stride + x, &hash, sizeof(hash));
+	} else {
+		if ((size_t)(cur->end - cur->p) < (size_t)stride * height)
+			return;
+		for (size_t row = 0; row < rows; row++)
+			memcpy(dst + row * buffer->stride, cur->p + row * stride, row_len);
+	}
+	replay->buffers++;
+}
+
+/* Remembers the globals the recorded client saw, to map wl_registry.bind names. */
+static void record_global(struct replay *replay, struct record_cursor *cur)
+{
+	cursor_u32(cur); /* object id */
+	uint32_t opcode = cursor_u32(cur);
+	const char *interface = cursor_string(cur);
+	if (cur->error || interface == NULL || strcmp(interface, "wl_registry") != 0 || opcode != 0)
+		return;
+
+	uint32_t name = cursor_u32(cur);
+	const char *global_interface = cursor_string(cur);
+	uint32_t version = cursor_u32(cur);
+	if (!cur->error && global_interface != NULL)
+		globals_add(
+			&replay->recorded_globals, &replay->nrecorded_globals, name, global_interface, version);
+}
+
+static const struct wayback_metrics_page *map_metrics(pid_t pid)
+{
+	char name[64];
+	snprintf(name, sizeof(name), WAYBACK_METRICS_SHM_PREFIX "%d", (int)pid);
+	int fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+	if (fd < 0)
+		return NULL;
+	const struct wayback_metrics_page *page =
+		mmap(NULL, sizeof(*page), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	return page != MAP_FAILED ? page : NULL;
+}
+
+static double timeval_sec(const struct timeval *tv)
+{
+	return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+extern char **environ;
+
+int main(int argc, char *argv[])
+{
+	wayback_log_init("wayback-replay", LOG_INFO, NULL);
+
+	struct replay replay = { 0 };
+	const char *path = NULL;
+	const struct optcmd opts[] = {
+		{ .name = "-maxspeed",
+		  .description = "replay as fast as possible instead of with the recorded timing",
+		  .flag = OPT_NOFLAG,
+		  .ignore = false },
+		{ .name = "-version",
+		  .description = "show wayback-replay version",
+		  .flag = OPT_NOFLAG,
+		  .ignore = false },
+	};
+
+	int cur_opt = 0;
+	while (cur_opt = optparse(argc, argv, opts, ARRAY_SIZE(opts)), cur_opt != -1) {
+		if (strcmp(argv[cur_opt], "-version") == 0) {
+			wayback_log(LOG_INFO,
+			            "Wayback <https://wayback.freedesktop.org/> X.Org compatibility layer");
+			wayback_log(LOG_INFO, "Version %s", WAYBACK_VERSION);
+			exit(EXIT_SUCCESS);
+		} else if (strcmp(argv[cur_opt], "-maxspeed") == 0) {
+			replay.max_speed = true;
+		} else if (argv[cur_opt][0] != '-' && path == NULL) {
+			path = argv[cur_opt];
+		} else {
+			wayback_log(LOG_ERROR, "Unknown option %s", argv[cur_opt]);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (path == NULL) {
+		wayback_log(LOG_ERROR, "Usage: %s [-maxspeed] <recording>", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	int record_fd = open(path, O_RDONLY | O_CLOEXEC);
+	struct stat st;
+	if (record_fd < 0 || fstat(record_fd, &st) < 0) {
+		wayback_log(LOG_ERROR, "Unable to open %s: %s", path, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	const uint8_t *record = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, record_fd, 0);
+	close(record_fd);
+	const struct wayback_record_file_header *file_header = (const void *)record;
+	if (record == MAP_FAILED || (size_t)st.st_size < sizeof(*file_header) ||
+	    memcmp(file_header->magic, WAYBACK_RECORD_MAGIC, sizeof(file_header->magic)) != 0 ||
+	    file_header->version != WAYBACK_RECORD_VERSION) {
+		wayback_log(LOG_ERROR, "%s is not a wayback recording", path);
+		exit(EXIT_FAILURE);
+	}
+
+	const char *compositor_path = getenv("WAYBACK_COMPOSITOR_PATH");
+	if (compositor_path == NULL)
+		compositor_path = WAYBACK_COMPOSITOR_EXEC_PATH;
+
+	if (access(compositor_path, X_OK) == -1) {
+		wayback_log(LOG_ERROR,
+		            "wayback-compositor executable %s not found or not executable",
+		            compositor_path);
+		exit(EXIT_FAILURE);
+	}
+
+	int socket_xwayback[2], socket_xwayland[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, socket_xwayback) == -1 ||
+	    socketpair(AF_UNIX, SOCK_STREAM, 0, socket_xwayland) == -1) {
+		wayback_log(LOG_ERROR, "Unable to create compositor sockets");
+		exit(EXIT_FAILURE);
+	}
+
+	/* Benchmark runs must be comparable: no real outputs or input devices. */
+	setenv("WLR_BACKENDS", "headless", false);
+	setenv("WLR_HEADLESS_OUTPUTS", "1", false);
+	setenv("WLR_LIBINPUT_NO_DEVICES", "1", false);
+	unsetenv("WAYBACK_RECORD");
+
+	posix_spawn_file_actions_t file_actions;
+	posix_spawn_file_actions_init(&file_actions);
+	posix_spawn_file_actions_addclose(&file_actions, socket_xwayback[1]);
+	posix_spawn_file_actions_addclose(&file_actions, socket_xwayland[1]);
+
+	char fd_xwayback[64];
+	char fd_xwayland[64];
+	snprintf(fd_xwayback, sizeof(fd_xwayback), "%d", socket_xwayback[0]);
+	snprintf(fd_xwayland, sizeof(fd_xwayland), "%d", socket_xwayland[0]);
+
+	pid_t comp_pid;
+	int ret = posix_spawn(&comp_pid,
+	                      compositor_path,
+	                      &file_actions,
+	                      NULL,
+	                      (char *[]){ (char *)compositor_path, fd_xwayback, fd_xwayland, NULL },
+	                      environ);
+	if (ret != 0) {
+		wayback_log(LOG_ERROR, "Failed to launch wayback-compositor: %s", strerror(ret));
+		exit(EXIT_FAILURE);
+	}
+	posix_spawn_file_actions_destroy(&file_actions);
+
+	close(socket_xwayback[0]);
+	close(socket_xwayland[0]);
+
+	replay.display = wl_display_connect_to_fd(socket_xwayland[1]);
+	if (replay.display == NULL) {
+		wayback_log(LOG_ERROR, "Unable to connect to wayback-compositor");
+		exit(EXIT_FAILURE);
+	}
+	object_create(&replay, 1, (struct wl_proxy *)replay.display, &wl_display_interface);
+
+	struct rusage self_start;
+	getrusage(RUSAGE_SELF, &self_start);
+	replay.start_usec = now_usec();
+
+	struct record_cursor cur = { .p = record + sizeof(*file_header), .end = record + st.st_size };
+	while (cur.end - cur.p >= (ptrdiff_t)sizeof(struct wayback_record_header)) {
+		struct wayback_record_header header;
+		memcpy(&header, cur.p, sizeof(header));
+		cur.p += sizeof(header);
+		if ((size_t)(cur.end - cur.p) < header.size) {
+			wayback_log(LOG_WARN, "Recording is truncated");
+			break;
+		}
+
+		struct record_cursor payload = { .p = cur.p, .end = cur.p + header.size };
+		cur.p += header.size;
+
+		if (!replay.max_speed)
+			replay_wait_until(&replay, header.time_usec);
+
+		switch (header.type) {
+			case WAYBACK_RECORD_REQUEST:
+				replay_request(&replay, &payload);
+				if (replay.max_speed)
+					replay_pump(&replay, 0);
+				break;
+			case WAYBACK_RECORD_EVENT:
+				record_global(&replay, &payload);
+				break;
+			case WAYBACK_RECORD_BUFFER:
+			case WAYBACK_RECORD_BUFFER_HASH:
+				replay_buffer(&replay, &payload, header.type == WAYBACK_RECORD_BUFFER_HASH);
+				break;
+			default:
+				break;
+		}
+	}
+
+	wl_display_roundtrip(replay.display);
+	uint64_t elapsed = now_usec() - replay.start_usec;
+
+	struct rusage self_end;
+	getrusage(RUSAGE_SELF, &self_end);
+
+	struct wayback_metrics_page metrics = { 0 };
+	const struct wayback_metrics_page *page = map_metrics(comp_pid);
+	if (page != NULL) {
+		wayback_metrics_read(page, &metrics);
+		munmap((void *)page, sizeof(*page));
+	}
+
+	/* Dropping both clients makes the compositor exit cleanly. */
+	wl_display_disconnect(replay.display);
+	close(socket_xwayback[1]);
+
+	int status;
+	struct rusage comp_usage = { 0 };
+	if (wait4(comp_pid, &status, 0, &comp_usage) < 0)
+		wayback_log(LOG_WARN, "Failed to wait for wayback-compositor: %s", strerror(errno));
+
+	double seconds = elapsed / 1e6;
+	double frame_span = (replay.last_frame_usec - replay.first_frame_usec) / 1e6;
+	printf("replayed %" PRIu64 " requests (%" PRIu64 " skipped), %" PRIu64
+	       " buffers in %.3f s (%s)\n",
+	       replay.requests,
+	       replay.skipped,
+	       replay.buffers,
+	       seconds,
+	       replay.max_speed ? "max speed" : "recorded timing");
+	printf("client frames: %" PRIu64 ", %.1f fps\n",
+	       replay.frames,
+	       frame_span > 0 ? (replay.frames - 1) / frame_span : 0.0);
+	if (page != NULL)
+		printf("compositor frames: %" PRIu64 " committed, %" PRIu64 " skipped, %" PRIu64
+		       " scanout\n",
+		       metrics.frames_committed,
+		       metrics.frames_skipped,
+		       metrics.scanout_frames);
+	printf("compositor cpu: %.3f s user, %.3f s sys, max rss %ld KiB\n",
+	       timeval_sec(&comp_usage.ru_utime),
+	       timeval_sec(&comp_usage.ru_stime),
+	       comp_usage.ru_maxrss);
+	printf("replay cpu: %.3f s user, %.3f s sys\n",
+	       timeval_sec(&self_end.ru_utime) - timeval_sec(&self_start.ru_utime),
+	       timeval_sec(&self_end.ru_stime) - timeval_sec(&self_start.ru_stime));
+
+	return EXIT_SUCCESS;
+}
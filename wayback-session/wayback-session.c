@@ -8,22 +8,31 @@
 #include "optparse.h"
 #include "utils.h"
 #include "wayback_log.h"
+#include "wayback_rusage.h"
 
 #include <ctype.h>
 #include <dirent.h>
 #include <errno.h>
 #include <getopt.h>
+#include <poll.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+/* How long -waitframe waits for the first frame before giving up */
+#define FIRST_FRAME_TIMEOUT_MSEC 5000
+
 pid_t xwayback_pid;
 pid_t session_pid;
 
+static volatile sig_atomic_t child_exited;
+static volatile sig_atomic_t sample_due;
+
 char *get_xinitrc_path()
 {
 	char *home = getenv("HOME");
@@ -42,16 +51,51 @@ char *get_xinitrc_path()
 	exit(EXIT_FAILURE);
 }
 
-void handle_child_exit(int sig)
+/* Children are reaped from main(), where it is safe to log their usage. */
+void handle_signal(int sig)
+{
+	if (sig == SIGCHLD)
+		child_exited = 1;
+	else if (sig == SIGALRM)
+		sample_due = 1;
+}
+
+static const char *child_name(pid_t pid)
+{
+	if (pid == xwayback_pid)
+		return "Xwayback";
+	if (pid == session_pid)
+		return "session";
+	return "child";
+}
+
+/* Returns whether the session is over. */
+static bool reap_children(void)
 {
-	pid_t pid = waitpid(-1, NULL, WNOHANG);
-	if (pid == session_pid || pid == xwayback_pid) {
-		if (pid == session_pid && xwayback_pid > 0)
-			kill(xwayback_pid, SIGTERM);
-		if (pid == xwayback_pid && session_pid > 0)
-			kill(session_pid, SIGTERM);
-		exit(EXIT_SUCCESS);
+	bool done = false;
+	int status;
+	struct rusage usage;
+	pid_t pid;
+	while ((pid = wait4(-1, &status, WNOHANG, &usage)) > 0) {
+		wayback_log_rusage(child_name(pid), pid, &usage, true);
+		if (pid == session_pid || pid == xwayback_pid) {
+			if (pid == session_pid && xwayback_pid > 0)
+				kill(xwayback_pid, SIGTERM);
+			if (pid == xwayback_pid && session_pid > 0)
+				kill(session_pid, SIGTERM);
+			done = true;
+		}
 	}
+	return done;
+}
+
+static void sample_children(void)
+{
+	struct rusage usage;
+	if (xwayback_pid > 0 && wayback_proc_rusage(xwayback_pid, &usage))
+		wayback_log_rusage("Xwayback", xwayback_pid, &usage, false);
+	if (session_pid > 0 && wayback_proc_rusage(session_pid, &usage))
+		wayback_log_rusage("session", session_pid, &usage, false);
 }
 
 int main(int argc, char *argv[])
@@ -60,6 +104,7 @@ int main(int argc, char *argv[])
 
 	char **session_cmd = NULL;
 	char *xinitrc_path = NULL;
+	bool wait_frame = false;
 	const struct optcmd opts[] = {
 		{ .name = "-sesscmd",
 		  .description = "run custom session command",
@@ -73,21 +118,38 @@ int main(int argc, char *argv[])
 		  .description = "show wayback-session version",
 		  .flag = OPT_NOFLAG,
 		  .ignore = false },
+		{ .name = "-waitframe",
+		  .description = "start the session once the X server is on screen",
+		  .flag = OPT_NOFLAG,
+		  .ignore = false },
 	};
-	signal(SIGCHLD, handle_child_exit);
+	struct sigaction action = { .sa_handler = handle_signal };
+	sigaction(SIGCHLD, &action, NULL);
+	sigaction(SIGALRM, &action, NULL);
+
+	/* Blocked outside of sigsuspend() so that no exit slips in between
+	 * checking the flags and waiting. Children get the original mask. */
+	sigset_t blocked, orig_mask;
+	sigemptyset(&blocked);
+	sigaddset(&blocked, SIGCHLD);
+	sigaddset(&blocked, SIGALRM);
+	sigprocmask(SIG_BLOCK, &blocked, &orig_mask);
 
 	int cur_opt = 0;
 	while (cur_opt = optparse(argc, argv, opts, ARRAY_SIZE(opts)), cur_opt != -1) {
-		if (strcmp(argv[cur_opt], "-version") == 0 || strcmp(argv[cur_opt], "-showconfig") == 0) {
+		if (optmatch == NULL) {
+			wayback_log(LOG_ERROR, "Unknown option %s", argv[cur_opt]);
+			exit(EXIT_FAILURE);
+		} else if (strcmp(argv[cur_opt], "-version") == 0 ||
+		           strcmp(argv[cur_opt], "-showconfig") == 0) {
 			wayback_log(LOG_INFO,
 			            "Wayback <https://wayback.freedesktop.org/> X.Org compatibility layer");
 			wayback_log(LOG_INFO, "Version %s", WAYBACK_VERSION);
 			exit(EXIT_SUCCESS);
 		} else if (strcmp(argv[cur_opt], "-sesscmd") == 0) {
 			session_cmd = &argv[cur_opt + 1];
-		} else {
-			wayback_log(LOG_ERROR, "Unknown option %s", argv[cur_opt]);
-			exit(EXIT_FAILURE);
+		} else if (strcmp(argv[cur_opt], "-waitframe") == 0) {
+			wait_frame = true;
 		}
 	}
 
@@ -115,9 +177,24 @@ int main(int argc, char *argv[])
 		exit(EXIT_FAILURE);
 	}
 
+	/* The compositor closes the write end once the first frame of the X
+	 * server was presented, see WAYBACK_READY_FD in Xwayback(1) */
+	int ready[2] = { -1, -1 };
+	if (wait_frame && pipe(ready) == -1) {
+		wayback_log(LOG_WARN, "Failed to create readiness pipe, not waiting for the first frame");
+		wait_frame = false;
+	}
+
 	xwayback_pid = fork();
 	if (xwayback_pid == 0) {
+		sigprocmask(SIG_SETMASK, &orig_mask, NULL);
 		close(fd[0]);
+		if (wait_frame) {
+			char *ready_str;
+			close(ready[0]);
+			asprintf_or_exit(&ready_str, "%d", ready[1]);
+			setenv("WAYBACK_READY_FD", ready_str, true);
+		}
 		wayback_log(LOG_INFO, "Launching with fd %d", fd[1]);
 		char *fd_str;
 		asprintf_or_exit(&fd_str, "%d", fd[1]);
@@ -132,6 +209,19 @@ int main(int argc, char *argv[])
 	if (n > 0) {
 		buffer[n - 1] = '\0'; // Convert from newline-terminated to null-terminated string
 		wayback_log(LOG_INFO, "Received display %s", buffer);
+	} else {
+		wayback_log(LOG_ERROR, "Xwayback exited without reporting a display");
+		kill(xwayback_pid, SIGTERM);
+		exit(EXIT_FAILURE);
+	}
+
+	if (wait_frame) {
+		close(ready[1]);
+		/* Returns on "ready", or EOF if the compositor went away early */
+		struct pollfd pfd = { .fd = ready[0], .events = POLLIN };
+		if (poll(&pfd, 1, FIRST_FRAME_TIMEOUT_MSEC) <= 0)
+			wayback_log(LOG_WARN, "No frame from the X server yet, starting the session anyway");
+		close(ready[0]);
 	}
 
 	char *x_display;
@@ -139,6 +229,7 @@ int main(int argc, char *argv[])
 
 	session_pid = fork();
 	if (session_pid == 0) {
+		sigprocmask(SIG_SETMASK, &orig_mask, NULL);
 		unsetenv("WAYLAND_DISPLAY");
 		setenv("XDG_SESSION_TYPE", "x11", true);
 		setenv("DISPLAY", x_display, true);
@@ -152,7 +243,24 @@ int main(int argc, char *argv[])
 		exit(EXIT_FAILURE);
 	}
 
-	while (1)
-		pause();
+	unsigned int interval = wayback_rusage_interval();
+	if (interval > 0)
+		alarm(interval);
+
+	for (;;) {
+		sigsuspend(&orig_mask);
+		if (sample_due) {
+			sample_due = 0;
+			sample_children();
+			alarm(interval);
+		}
+		if (child_exited) {
+			child_exited = 0;
+			if (reap_children())
+				break;
+		}
+	}
+
+	wayback_log_cgroup_usage();
 	return 0;
 }
@@ -0,0 +1,101 @@
+/*
+ * Xwayback's command line options
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "options.h"
+
+#include "optparse.h"
+#include "utils.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+const struct optcmd xwayback_opts[] = {
+	/* options handled by Xwayback */
+	{ .name = "-showconfig",
+	  .description = "alias to -version",
+	  .flag = OPT_NOFLAG,
+	  .ignore = false },
+	{ .name = "-version",
+	  .description = "show Xwayback version",
+	  .flag = OPT_NOFLAG,
+	  .ignore = false },
+	{ .name = "-verbose",
+	  .description = "set verbosity level for information printed on stderr",
+	  .flag = OPT_OPERAND,
+	  .ignore = false },
+	{ .name = "-novtswitch",
+	  .description = "do not switch VTs on startup (default)",
+	  .flag = OPT_NOFLAG,
+	  .ignore = false },
+	{ .name = "-rootless",
+	  .description = "show X11 windows as separate Wayland surfaces",
+	  .flag = OPT_NOFLAG,
+	  .ignore = false },
+	{ .name = "-noTouchPointerEmulation",
+	  .description = "don't emulate pointer events for touch input",
+	  .flag = OPT_NOFLAG,
+	  .ignore = false },
+
+	/* ignored options */
+	IGNORE_OPT("-decorate", OPT_NOFLAG),
+	IGNORE_OPT("-enable‐ei‐portal", OPT_NOFLAG),
+	IGNORE_OPT("-fullscreen", OPT_NOFLAG),
+	IGNORE_OPT("-geometry", OPT_OPERAND),
+	IGNORE_OPT("-glamor", OPT_OPERAND),
+	IGNORE_OPT("-hidpi", OPT_NOFLAG),
+	IGNORE_OPT("-host‐grab", OPT_NOFLAG),
+	IGNORE_OPT("-force‐xrandr‐emulation", OPT_NOFLAG),
+	IGNORE_OPT("-nokeymap", OPT_NOFLAG),
+	IGNORE_OPT("-shm", OPT_NOFLAG),
+	IGNORE_OPT("-wm", OPT_OPERAND),
+	IGNORE_OPT_DESC(
+		"vt", OPT_NUM, "VT switching is not supported; behaving as if -novtswitch is passed"),
+
+	/* Xorg(1)-specific options */
+	IGNORE_OPT("-allowMouseOpenFail", OPT_NOFLAG),
+	IGNORE_OPT("-allowNonLocalXvidtune", OPT_NOFLAG),
+	IGNORE_OPT("-bgamma", OPT_OPERAND),
+	IGNORE_OPT("-bpp", OPT_OPERAND), /* no longer supported by upstream Xorg(1) */
+	IGNORE_OPT("-config", OPT_OPERAND),
+	IGNORE_OPT("-configdir", OPT_OPERAND),
+	IGNORE_OPT("-configure", OPT_OPERAND),
+	IGNORE_OPT("-crt", OPT_OPERAND),
+	IGNORE_OPT("-depth", OPT_OPERAND),
+	IGNORE_OPT("-disableVidMode", OPT_NOFLAG),
+	IGNORE_OPT("-fbbbp", OPT_OPERAND),
+	IGNORE_OPT("-gamma", OPT_OPERAND),
+	IGNORE_OPT("-ggamma", OPT_OPERAND),
+	IGNORE_OPT("-ignoreABI", OPT_NOFLAG),
+	IGNORE_OPT("-isolateDevice", OPT_OPERAND),
+	IGNORE_OPT("-keeptty", OPT_NOFLAG),
+	IGNORE_OPT("-keyboard", OPT_OPERAND),
+	IGNORE_OPT("-layout", OPT_OPERAND),
+	IGNORE_OPT("-logverbose", OPT_OPERAND),
+	IGNORE_OPT("-modulepath", OPT_OPERAND),
+	IGNORE_OPT("-noautoBindCPU", OPT_NOFLAG),
+	IGNORE_OPT("-nosilk", OPT_NOFLAG),
+	IGNORE_OPT("-pointer", OPT_OPERAND),
+	IGNORE_OPT("-quiet", OPT_NOFLAG),
+	IGNORE_OPT("-rgamma", OPT_OPERAND),
+	IGNORE_OPT("-sharevts", OPT_NOFLAG),
+	IGNORE_OPT("-screen", OPT_OPERAND),
+	IGNORE_OPT("-showDefaultModulePath", OPT_NOFLAG),
+	IGNORE_OPT("-showDefaultLibPath", OPT_NOFLAG),
+	IGNORE_OPT("-showopts", OPT_NOFLAG),
+	IGNORE_OPT("-weight", OPT_OPERAND),
+	IGNORE_OPT("-verbose", OPT_OPERAND),
+};
+
+const uint32_t xwayback_nopts = ARRAY_SIZE(xwayback_opts);
+
+bool xwayback_forwarded(const struct optcmd *match)
+{
+	/* Everything Xwayback doesn't know about goes to Xwayland as is. Touch
+	 * pointer emulation is up to Xwayland as well, the compositor only
+	 * passes on touch events. */
+	return match == NULL || strcmp(match->name, "-noTouchPointerEmulation") == 0;
+}
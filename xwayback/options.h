@@ -0,0 +1,24 @@
+/*
+ * Xwayback's command line options
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef XWAYBACK_OPTIONS_IMPORTED
+#define XWAYBACK_OPTIONS_IMPORTED
+
+#include "optparse.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+extern const struct optcmd xwayback_opts[];
+extern const uint32_t xwayback_nopts;
+
+/*
+ * Whether an argument is passed on to Xwayland, given its entry in
+ * xwayback_opts as optparse() set optmatch to, or NULL.
+ */
+bool xwayback_forwarded(const struct optcmd *match);
+
+#endif
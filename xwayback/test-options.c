@@ -0,0 +1,107 @@
+/*
+ * Runs optparse() over Xwayback's options table and checks which arguments
+ * Xwayback handles, which it ignores along with their operands, and which
+ * it passes on to Xwayland.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "options.h"
+#include "optparse.h"
+#include "utils.h"
+#include "wayback_log.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static bool failed = false;
+
+static void check(bool ok, const char *what)
+{
+	if (!ok) {
+		wayback_log(LOG_ERROR, "FAIL: %s", what);
+		failed = true;
+	}
+}
+
+/* Duplicate names resolve to their first entry, -verbose is also ignored further down */
+static void test_duplicates(void)
+{
+	const struct optcmd *verbose = optfind(xwayback_opts, xwayback_nopts, "-verbose");
+	check(verbose != NULL && !verbose->ignore, "-verbose is handled by Xwayback");
+
+	const struct optcmd *last = NULL;
+	for (uint32_t i = 0; i < xwayback_nopts; i++) {
+		if (strcmp(xwayback_opts[i].name, "-verbose") == 0)
+			last = &xwayback_opts[i];
+	}
+	check(last != verbose && last->ignore, "-verbose has an ignored duplicate");
+}
+
+static void test_num(void)
+{
+	const struct optcmd *vt = optfind(xwayback_opts, xwayback_nopts, "vt7");
+	check(vt != NULL && strcmp(vt->name, "vt") == 0 && vt->flag == OPT_NUM, "vt7 matches vt");
+	vt = optfind(xwayback_opts, xwayback_nopts, "vt12");
+	check(vt != NULL && strcmp(vt->name, "vt") == 0, "vt12 matches vt");
+	check(!xwayback_forwarded(vt), "vt7 is not passed on to Xwayland");
+}
+
+static void test_forward(void)
+{
+	char *argv[] = {
+		"Xwayback",
+		":1",
+		"vt7",
+		"-verbose",
+		"3",
+		"-geometry",
+		"800x600",
+		"-listen",
+		"3",
+		"-noTouchPointerEmulation",
+		"-rootless",
+		"-decorate",
+	};
+	/* Positions optparse() returns, operands of known options are skipped */
+	const int positions[] = { 1, 2, 3, 5, 7, 8, 9, 10, 11 };
+	const char *expected[] = { ":1", "-listen", "3", "-noTouchPointerEmulation" };
+
+	const char *forward[ARRAY_SIZE(argv)];
+	size_t nforward = 0;
+	size_t nseen = 0;
+	int cur_opt;
+	optparse_reset();
+	while (cur_opt = optparse(ARRAY_SIZE(argv), argv, xwayback_opts, xwayback_nopts),
+	       cur_opt != -1) {
+		check(nseen < ARRAY_SIZE(positions) && positions[nseen] == cur_opt,
+		      "operands are consumed by their options");
+		nseen++;
+
+		if (strcmp(argv[cur_opt], "vt7") == 0)
+			check(optmatch != NULL && optmatch->ignore, "vt7 is ignored");
+		if (strcmp(argv[cur_opt], "-verbose") == 0)
+			check(optmatch != NULL && !optmatch->ignore, "-verbose is handled");
+		if (xwayback_forwarded(optmatch))
+			forward[nforward++] = argv[cur_opt];
+	}
+	check(nseen == ARRAY_SIZE(positions), "every argument is seen");
+
+	check(nforward == ARRAY_SIZE(expected), "the right number of arguments is forwarded");
+	for (size_t i = 0; i < nforward && i < ARRAY_SIZE(expected); i++)
+		check(strcmp(forward[i], expected[i]) == 0, "the right arguments are forwarded in order");
+}
+
+int main(int argc, char *argv[])
+{
+	/* Ignored options warn, which is expected here */
+	wayback_log_init("test-options", LOG_ERROR, NULL);
+
+	test_duplicates();
+	test_num();
+	test_forward();
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -6,19 +6,26 @@
  * SPDX-License-Identifier: MIT
  */
 
+#include "options.h"
 #include "optparse.h"
 #include "utils.h"
 #include "wayback_log.h"
+#include "wayback_mem.h"
+#include "wayback_output_cache.h"
+#include "wayback_prefetch.h"
+#include "wayback_rusage.h"
 #include "xdg-output-unstable-v1-client-protocol.h"
 
 #include <errno.h>
 #include <getopt.h>
+#include <limits.h>
 #include <signal.h>
 #include <spawn.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/wait.h>
@@ -55,6 +62,12 @@ struct xway_output
 	float refresh;
 };
 
+WAYBACK_POOL(output_pool, "outputs", struct xway_output);
+
+/* Size of the X screen when speculatively starting Xwayland for the first time */
+#define PLACEHOLDER_WIDTH 1024
+#define PLACEHOLDER_HEIGHT 768
+
 static pid_t comp_pid;
 static pid_t xway_pid;
 
@@ -186,7 +199,11 @@ static void handle_global(void *data,
 {
 	struct xwayback *xwayback = data;
 	if (strcmp(interface, wl_output_interface.name) == 0) {
-		struct xway_output *output = calloc(1, sizeof(struct xway_output));
+		struct xway_output *output = wayback_pool_alloc(&output_pool);
+		if (output == NULL) {
+			wayback_log(LOG_ERROR, "Failed to allocate output");
+			return;
+		}
 		output->xwayback = xwayback;
 		output->output = wl_registry_bind(registry, name, &wl_output_interface, 3);
 		wl_output_add_listener(output->output, &output_listener, output);
@@ -209,6 +226,103 @@ static const struct wl_registry_listener registry_listener = {
 	.global_remove = NULL, // TODO: handle_global_remove
 };
 
+static void output_destroy(struct xway_output *output)
+{
+	if (output->xdg_output != NULL)
+		zxdg_output_v1_destroy(output->xdg_output);
+	wl_output_destroy(output->output);
+	wl_list_remove(&output->link);
+	free(output->name);
+	free(output->description);
+	free(output->make);
+	free(output->model);
+	wayback_pool_free(&output_pool, output);
+}
+
+/*
+ * X screen size of the monitor Xwayland is most likely to end up on, as
+ * the compositor recorded it last time: the one chosen with WAYBACK_OUTPUT,
+ * or else the most recently used one at the origin of the layout.
+ */
+static bool cached_geometry(int *width, int *height)
+{
+	const struct wayback_output_cache *cache = wayback_output_cache_map();
+	if (cache == NULL)
+		return false;
+
+	const char *output = getenv("WAYBACK_OUTPUT");
+	const struct wayback_output_cache_entry *best = NULL;
+	for (int i = 0; i < WAYBACK_OUTPUT_CACHE_ENTRIES; i++) {
+		const struct wayback_output_cache_entry *entry = &cache->entries[i];
+		if (entry->key == 0 || entry->x_width <= 0 || entry->x_height <= 0)
+			continue;
+		if (output != NULL) {
+			char make_model[sizeof(entry->make) + sizeof(entry->model) + 1];
+			snprintf(make_model, sizeof(make_model), "%s %s", entry->make, entry->model);
+			if (strcmp(make_model, output) != 0 && strcmp(entry->make, output) != 0 &&
+			    strcmp(entry->name, output) != 0)
+				continue;
+		} else if (entry->x != 0 || entry->y != 0) {
+			continue;
+		}
+		if (best == NULL || entry->last_used > best->last_used)
+			best = entry;
+	}
+
+	if (best != NULL) {
+		*width = best->x_width;
+		*height = best->x_height;
+	}
+	wayback_output_cache_unmap(cache);
+	return best != NULL;
+}
+
+/*
+ * Reads what Xwayland will need into the page cache while the compositor
+ * starts up: Xwayland with its libraries, the xkb data it compiles the
+ * keymap from and the cursor theme.
+ */
+static void prefetch_xwayland(const char *xwayland_path)
+{
+	const char *xkb_root = getenv("XKB_CONFIG_ROOT");
+	const char *theme = getenv("XCURSOR_THEME");
+	const char *home = getenv("HOME");
+	if (xkb_root == NULL)
+		xkb_root = XKB_CONFIG_ROOT_PATH;
+	if (theme == NULL)
+		theme = "default";
+
+	/* Same search path as libXcursor */
+	char search[PATH_MAX];
+	const char *xcursor_path = getenv("XCURSOR_PATH");
+	if (xcursor_path == NULL) {
+		snprintf(search,
+		         sizeof(search),
+		         "%s/.local/share/icons:%s/.icons:/usr/share/icons:/usr/share/pixmaps",
+		         home != NULL ? home : "",
+		         home != NULL ? home : "");
+		xcursor_path = search;
+	}
+
+	char cursor_dirs[8][PATH_MAX];
+	const char *paths[2 + ARRAY_SIZE(cursor_dirs)] = { xwayland_path, xkb_root };
+	size_t count = 2;
+	while (*xcursor_path != '\0' && count < ARRAY_SIZE(paths)) {
+		int len = strcspn(xcursor_path, ":");
+		snprintf(cursor_dirs[count - 2],
+		         sizeof(cursor_dirs[0]),
+		         "%.*s/%s/cursors",
+		         len,
+		         xcursor_path,
+		         theme);
+		paths[count] = cursor_dirs[count - 2];
+		count++;
+		xcursor_path += len + (xcursor_path[len] == ':');
+	}
+
+	wayback_prefetch(paths, count);
+}
+
 static void handle_segv(int sig)
 {
 	const char *errormsg =
@@ -220,96 +334,124 @@ static void handle_segv(int sig)
 	write(STDERR_FILENO, errormsg, strlen(errormsg));
 }
 
+static void handle_alarm(int sig)
+{
+	/* Only interrupts wait4(), sampling happens in main() */
+}
+
+static void sample_children(void)
+{
+	struct rusage usage;
+	if (wayback_proc_rusage(comp_pid, &usage))
+		wayback_log_rusage("wayback-compositor", comp_pid, &usage, false);
+	if (xway_pid > 0 && wayback_proc_rusage(xway_pid, &usage))
+		wayback_log_rusage("Xwayland", xway_pid, &usage, false);
+}
+
+static const char *child_name(pid_t pid)
+{
+	if (pid == comp_pid)
+		return "wayback-compositor";
+	if (pid == xway_pid)
+		return "Xwayland";
+	return "child";
+}
+
 extern char **environ;
 
-int main(int argc, char *argv[])
+/* Everything needed to start Xwayland, see spawn_xwayland() */
+struct xwayland_launch
+{
+	const char *path;
+	const char *verbosity;
+	bool rootless;
+	const char *fd_xwm;
+	int socket_xwm;
+	int socket_xwayland;
+	int socket_xwayback;
+	const char **forward;
+	size_t nforward;
+};
+
+static void spawn_xwayland(const struct xwayland_launch *launch, int width, int height)
 {
-	struct xwayback *xwayback = malloc(sizeof(struct xwayback));
-	const struct optcmd opts[] = {
-		/* options handled by Xwayback */
-		{ .name = "-showconfig",
-		  .description = "alias to -version",
-		  .flag = OPT_NOFLAG,
-		  .ignore = false },
-		{ .name = "-version",
-		  .description = "show Xwayback version",
-		  .flag = OPT_NOFLAG,
-		  .ignore = false },
-		{ .name = "-verbose",
-		  .description = "set verbosity level for information printed on stderr",
-		  .flag = OPT_OPERAND,
-		  .ignore = false },
-		{ .name = "-novtswitch",
-		  .description = "do not switch VTs on startup (default)",
-		  .flag = OPT_NOFLAG,
-		  .ignore = false },
-
-		/* ignored options */
-		IGNORE_OPT("-decorate", OPT_NOFLAG),
-		IGNORE_OPT("-enable‐ei‐portal", OPT_NOFLAG),
-		IGNORE_OPT("-fullscreen", OPT_NOFLAG),
-		IGNORE_OPT("-geometry", OPT_OPERAND),
-		IGNORE_OPT("-glamor", OPT_OPERAND),
-		IGNORE_OPT("-hidpi", OPT_NOFLAG),
-		IGNORE_OPT("-host‐grab", OPT_NOFLAG),
-		IGNORE_OPT("-noTouchPointerEmulation", OPT_NOFLAG),
-		IGNORE_OPT("-force‐xrandr‐emulation", OPT_NOFLAG),
-		IGNORE_OPT("-nokeymap", OPT_NOFLAG),
-		IGNORE_OPT("-rootless", OPT_NOFLAG),
-		IGNORE_OPT("-shm", OPT_NOFLAG),
-		IGNORE_OPT("-wm", OPT_OPERAND),
-		IGNORE_OPT_DESC(
-			"vt", OPT_NUM, "VT switching is not supported; behaving as if -novtswitch is passed"),
-
-		/* Xorg(1)-specific options */
-		IGNORE_OPT("-allowMouseOpenFail", OPT_NOFLAG),
-		IGNORE_OPT("-allowNonLocalXvidtune", OPT_NOFLAG),
-		IGNORE_OPT("-bgamma", OPT_OPERAND),
-		IGNORE_OPT("-bpp", OPT_OPERAND), /* no longer supported by upstream Xorg(1) */
-		IGNORE_OPT("-config", OPT_OPERAND),
-		IGNORE_OPT("-configdir", OPT_OPERAND),
-		IGNORE_OPT("-configure", OPT_OPERAND),
-		IGNORE_OPT("-crt", OPT_OPERAND),
-		IGNORE_OPT("-depth", OPT_OPERAND),
-		IGNORE_OPT("-disableVidMode", OPT_NOFLAG),
-		IGNORE_OPT("-fbbbp", OPT_OPERAND),
-		IGNORE_OPT("-gamma", OPT_OPERAND),
-		IGNORE_OPT("-ggamma", OPT_OPERAND),
-		IGNORE_OPT("-ignoreABI", OPT_NOFLAG),
-		IGNORE_OPT("-isolateDevice", OPT_OPERAND),
-		IGNORE_OPT("-keeptty", OPT_NOFLAG),
-		IGNORE_OPT("-keyboard", OPT_OPERAND),
-		IGNORE_OPT("-layout", OPT_OPERAND),
-		IGNORE_OPT("-logverbose", OPT_OPERAND),
-		IGNORE_OPT("-modulepath", OPT_OPERAND),
-		IGNORE_OPT("-noautoBindCPU", OPT_NOFLAG),
-		IGNORE_OPT("-nosilk", OPT_NOFLAG),
-		IGNORE_OPT("-pointer", OPT_OPERAND),
-		IGNORE_OPT("-quiet", OPT_NOFLAG),
-		IGNORE_OPT("-rgamma", OPT_OPERAND),
-		IGNORE_OPT("-sharevts", OPT_NOFLAG),
-		IGNORE_OPT("-screen", OPT_OPERAND),
-		IGNORE_OPT("-showDefaultModulePath", OPT_NOFLAG),
-		IGNORE_OPT("-showDefaultLibPath", OPT_NOFLAG),
-		IGNORE_OPT("-showopts", OPT_NOFLAG),
-		IGNORE_OPT("-weight", OPT_OPERAND),
-		IGNORE_OPT("-verbose", OPT_OPERAND),
+	char way_display[64];
+	snprintf(way_display, sizeof(way_display), "%d", launch->socket_xwayland);
+	setenv("WAYLAND_SOCKET", way_display, true);
+
+	char geometry[64];
+	snprintf(geometry, sizeof(geometry), "%dx%d", width, height);
+	const char *xwayback_args[] = {
+		"-terminate", "3", "-geometry", geometry, "-verbose", launch->verbosity,
+	};
+	/* Rootless windows are sized by their clients, not by the output */
+	const char *rootless_args[] = {
+		"-terminate", "3", "-rootless", "-wm", launch->fd_xwm, "-verbose", launch->verbosity,
 	};
+	const char **xwayland_args = launch->rootless ? rootless_args : xwayback_args;
+	size_t xwayland_args_count =
+		launch->rootless ? ARRAY_SIZE(rootless_args) : ARRAY_SIZE(xwayback_args);
+
+	size_t count = 0;
+	const char *arguments[1 + ARRAY_SIZE(rootless_args) + launch->nforward + 1];
+	arguments[count++] = launch->path;
+	for (size_t i = 0; i < xwayland_args_count; i++)
+		arguments[count++] = xwayland_args[i];
+	for (size_t i = 0; i < launch->nforward; i++)
+		arguments[count++] = launch->forward[i];
+	arguments[count++] = NULL;
+
+	posix_spawn_file_actions_t file_actions;
+	posix_spawn_file_actions_init(&file_actions);
+	posix_spawn_file_actions_addclose(&file_actions, launch->socket_xwayback);
+
+	if (posix_spawn(&xway_pid, launch->path, &file_actions, NULL, (char **)arguments, environ) !=
+	    0) {
+		wayback_log(LOG_ERROR, "Failed to launch Xwayland");
+		exit(EXIT_FAILURE);
+	}
+	posix_spawn_file_actions_destroy(&file_actions);
+	unsetenv("WAYLAND_SOCKET");
+
+	close(launch->socket_xwayland);
+	if (launch->rootless)
+		close(launch->socket_xwm);
+}
+
+int main(int argc, char *argv[])
+{
+	struct xwayback *xwayback = calloc(1, sizeof(struct xwayback));
+	if (xwayback == NULL) {
+		wayback_log(LOG_ERROR, "Failed to allocate memory");
+		exit(EXIT_FAILURE);
+	}
 	int socket_xwayback[2];
 	int socket_xwayland[2];
+	int socket_xwm[2] = { -1, -1 };
 
 	signal(SIGSEGV, handle_segv);
 
 	wayback_log_init("Xwayback", LOG_INFO, NULL);
 
 	long verbosity = 0;
+	bool rootless = false;
+	const char *forward[argc];
+	size_t nforward = 0;
 	int cur_opt = 0;
-	while (cur_opt = optparse(argc, argv, opts, ARRAY_SIZE(opts)), cur_opt != -1) {
-		if (strcmp(argv[cur_opt], "-version") == 0 || strcmp(argv[cur_opt], "-showconfig") == 0) {
+	while (cur_opt = optparse(argc, argv, xwayback_opts, xwayback_nopts), cur_opt != -1) {
+		if (xwayback_forwarded(optmatch))
+			forward[nforward++] = argv[cur_opt];
+
+		if (optmatch == NULL) {
+			continue;
+		} else if (strcmp(argv[cur_opt], "-version") == 0 ||
+		           strcmp(argv[cur_opt], "-showconfig") == 0) {
 			wayback_log(LOG_INFO,
 			            "Wayback <https://wayback.freedesktop.org/> X.Org compatibility layer");
 			wayback_log(LOG_INFO, "Version %s", WAYBACK_VERSION);
 			exit(EXIT_SUCCESS);
+		} else if (strcmp(argv[cur_opt], "-rootless") == 0) {
+			rootless = true;
 		} else if (strcmp(argv[cur_opt], "-verbose") == 0) {
 			// set verbosity level
 			verbosity = strtol(argv[cur_opt + 1], NULL, 10);
@@ -354,6 +496,7 @@ int main(int argc, char *argv[])
 		wayback_compositor_path = WAYBACK_COMPOSITOR_EXEC_PATH;
 	if (xwayland_path == NULL)
 		xwayland_path = XWAYLAND_EXEC_PATH;
+	prefetch_xwayland(xwayland_path);
 
 	if (access(wayback_compositor_path, X_OK) == -1) {
 		wayback_log(LOG_ERROR,
@@ -377,10 +520,24 @@ int main(int argc, char *argv[])
 		exit(EXIT_FAILURE);
 	}
 
+	/* Xwayland's window manager connection, handled by the compositor */
+	char fd_xwm[64] = "";
+	if (rootless) {
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, socket_xwm) == -1) {
+			wayback_log(LOG_ERROR, "Unable to create window manager socket");
+			exit(EXIT_FAILURE);
+		}
+		snprintf(fd_xwm, sizeof(fd_xwm), "%d", socket_xwm[0]);
+		setenv("WAYBACK_XWM_FD", fd_xwm, true);
+		snprintf(fd_xwm, sizeof(fd_xwm), "%d", socket_xwm[1]);
+	}
+
 	posix_spawn_file_actions_t file_actions;
 	posix_spawn_file_actions_init(&file_actions);
 	posix_spawn_file_actions_addclose(&file_actions, socket_xwayback[1]);
 	posix_spawn_file_actions_addclose(&file_actions, socket_xwayland[1]);
+	if (rootless)
+		posix_spawn_file_actions_addclose(&file_actions, socket_xwm[1]);
 
 	char verbstr[4] = "";
 	char fd_xwayback[64];
@@ -404,10 +561,46 @@ int main(int argc, char *argv[])
 
 	close(socket_xwayback[0]);
 	close(socket_xwayland[0]);
+	if (rootless) {
+		close(socket_xwm[0]);
+		unsetenv("WAYBACK_XWM_FD");
+	}
+
+	/* Only the compositor reports readiness, Xwayland mustn't hold the fd */
+	const char *ready_fd = getenv("WAYBACK_READY_FD");
+	if (ready_fd != NULL) {
+		close(strtol(ready_fd, NULL, 10));
+		unsetenv("WAYBACK_READY_FD");
+	}
 
 	unsetenv("WAYLAND_DISPLAY");
 	unsetenv("WAYLAND_SOCKET");
 
+	struct xwayland_launch launch = {
+		.path = xwayland_path,
+		.verbosity = verbstr,
+		.rootless = rootless,
+		.fd_xwm = fd_xwm,
+		.socket_xwm = socket_xwm[1],
+		.socket_xwayland = socket_xwayland[1],
+		.socket_xwayback = socket_xwayback[1],
+		.forward = forward,
+		.nforward = nforward,
+	};
+
+	/* Overlap Xwayland's startup with the compositor's, assuming the output
+	 * size of the previous run. Should it be different, the compositor
+	 * resizes the rootful window once it is mapped. */
+	bool speculative = getenv("WAYBACK_SPECULATIVE_SPAWN") != NULL;
+	int cached_width = 0, cached_height = 0;
+	if (speculative) {
+		if (!cached_geometry(&cached_width, &cached_height)) {
+			cached_width = PLACEHOLDER_WIDTH;
+			cached_height = PLACEHOLDER_HEIGHT;
+		}
+		spawn_xwayland(&launch, cached_width, cached_height);
+	}
+
 	xwayback->display = wl_display_connect_to_fd(socket_xwayback[1]);
 	if (!xwayback->display) {
 		wayback_log(LOG_ERROR, "Unable to connect to wayback-compositor");
@@ -430,6 +623,7 @@ int main(int argc, char *argv[])
 			asprintf_or_exit(&output_make_model, "%s %s", out->make, out->model);
 			if (strcmp(output_make_model, output) == 0 || strcmp(out->make, output) == 0)
 				xwayback->first_output = out;
+			free(output_make_model);
 		}
 	}
 
@@ -438,55 +632,63 @@ int main(int argc, char *argv[])
 		exit(EXIT_FAILURE);
 	}
 
-	char way_display[64];
-	snprintf(way_display, sizeof(way_display), "%d", socket_xwayland[1]);
-	setenv("WAYLAND_SOCKET", way_display, true);
-
-	char geometry[4096] = "";
-	const char *xwayback_args[] = {
-		"-terminate", "3", "-geometry", geometry, "-verbose", verbstr,
-	};
-
-	snprintf(geometry,
-	         sizeof(geometry),
-	         "%dx%d",
-	         xwayback->first_output->width,
-	         xwayback->first_output->height);
-
-	size_t count = 0;
-	const char *arguments[argc - optind + ARRAY_SIZE(xwayback_args) + 1];
-	arguments[count++] = xwayland_path;
-	for (size_t i = 0; i < ARRAY_SIZE(xwayback_args); i++)
-		arguments[count++] = xwayback_args[i];
-	for (int i = 1; i < argc; i++) {
-		size_t j = 0;
-		for (; j < ARRAY_SIZE(opts); j++) {
-			if (strcmp(opts[j].name, argv[i]) == 0) {
-				if (opts[j].flag == OPT_OPERAND && (i + 1) < argc) {
-					i++;
-				}
-				break;
-			}
-		}
-		if (j == ARRAY_SIZE(opts)) {
-			arguments[count++] = argv[i];
-		}
+	int width = xwayback->first_output->width;
+	int height = xwayback->first_output->height;
+	if (!speculative) {
+		spawn_xwayland(&launch, width, height);
+	} else if (width != cached_width || height != cached_height) {
+		if (!rootless)
+			wayback_log(LOG_INFO,
+			            "Output is %dx%d rather than %dx%d, resizing the X screen",
+			            width,
+			            height,
+			            cached_width,
+			            cached_height);
 	}
 
-	arguments[count++] = NULL;
-
-	posix_spawn_file_actions_init(&file_actions);
-	posix_spawn_file_actions_addclose(&file_actions, socket_xwayback[1]);
-
-	if (posix_spawn(&xway_pid, xwayland_path, &file_actions, NULL, (char **)arguments, environ) !=
-	    0) {
-		wayback_log(LOG_ERROR, "Failed to launch Xwayland");
-		exit(EXIT_FAILURE);
+	/* Without SA_RESTART, SIGALRM makes wait4() return to take a sample */
+	unsigned int interval = wayback_rusage_interval();
+	if (interval > 0) {
+		struct sigaction alarm_action = { .sa_handler = handle_alarm };
+		sigaction(SIGALRM, &alarm_action, NULL);
+		alarm(interval);
 	}
 
-	close(socket_xwayland[1]);
-
-	waitid(P_PID, comp_pid, NULL, WEXITED);
+	int status = 0;
+	struct rusage usage;
+	pid_t pid;
+	while ((pid = wait4(-1, &status, 0, &usage)) != comp_pid) {
+		if (pid > 0) {
+			wayback_log_rusage(child_name(pid), pid, &usage, true);
+			if (pid == xway_pid)
+				xway_pid = 0;
+		} else if (errno == EINTR) {
+			sample_children();
+			alarm(interval);
+		} else {
+			break;
+		}
+	}
+	if (pid == comp_pid)
+		wayback_log_rusage("wayback-compositor", pid, &usage, true);
+
+	/* Xwayland normally goes away along with the compositor */
+	if (xway_pid > 0 && wait4(xway_pid, &status, WNOHANG, &usage) == xway_pid)
+		wayback_log_rusage("Xwayland", xway_pid, &usage, true);
+
+	/* The connection had to stay up until now, the compositor exits once
+	 * its Xwayback client is gone. */
+	struct xway_output *out, *tmp;
+	wl_list_for_each_safe(out, tmp, &xwayback->outputs, link)
+		output_destroy(out);
+	if (xwayback->xdg_output_manager != NULL)
+		zxdg_output_manager_v1_destroy(xwayback->xdg_output_manager);
+	wl_registry_destroy(registry);
+	wl_display_disconnect(xwayback->display);
+	free(xwayback);
+	/* Leaks fail the exit status when checking, see wayback-bench-startup -check */
+	if (!wayback_mem_finish() && getenv("WAYBACK_LEAK_CHECK") != NULL)
+		return EXIT_FAILURE;
 
 	return 0;
 }